@@ -0,0 +1,31 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include "ByteCounter.h"
+
+using namespace std;
+
+ByteCounter::ByteCounter()
+{
+	this->count = 0;
+}
+
+void ByteCounter::add(uint64_t bytes)
+{
+	__atomic_fetch_add(&this->count, bytes, __ATOMIC_RELAXED);
+}
+
+uint64_t ByteCounter::get() const
+{
+	return __atomic_load_n(&this->count, __ATOMIC_RELAXED);
+}
+
+/* Returns the bytes counted since the previous call and starts a new count. */
+uint64_t ByteCounter::snapshotAndReset()
+{
+	return __atomic_exchange_n(&this->count, 0, __ATOMIC_RELAXED);
+}
+
+void ByteCounter::reset()
+{
+	__atomic_store_n(&this->count, 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,32 @@
+#ifndef BYTECOUNTER_H_
+#define BYTECOUNTER_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#define CACHE_LINE_SIZE 64
+
+/*
+Byte counter shared between the thread that counts and the thread that reports.
+The count is a single 64-bit atomic on its own cache line, so adding never takes
+a lock and never shares a line with a neighbouring counter. snapshotAndReset()
+reads and clears it in one exchange, so no byte is lost or counted twice across
+an interval boundary.
+*/
+class ByteCounter
+{
+private:
+	uint64_t count __attribute__((aligned(CACHE_LINE_SIZE)));
+	char padding[CACHE_LINE_SIZE - sizeof(uint64_t)];
+
+public:
+	ByteCounter();
+
+	void add(uint64_t bytes);
+	uint64_t get() const;
+	uint64_t snapshotAndReset();
+	void reset();
+};
+
+#endif /* BYTECOUNTER_H_ */
@@ -0,0 +1,295 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <strings.h>
+#include "CircuitTable.h"
+
+using namespace std;
+
+/* Returns the CIRCUIT_STATE_* value of a circuit status keyword. */
+int parseCircuitState(const char* state)
+{
+	if(strcmp(state, "LAUNCHED") == 0)
+	{
+		return CIRCUIT_STATE_LAUNCHED;
+	}
+	else if(strcmp(state, "BUILT") == 0)
+	{
+		return CIRCUIT_STATE_BUILT;
+	}
+	else if(strcmp(state, "EXTENDED") == 0)
+	{
+		return CIRCUIT_STATE_EXTENDED;
+	}
+	else if(strcmp(state, "FAILED") == 0)
+	{
+		return CIRCUIT_STATE_FAILED;
+	}
+	else if(strcmp(state, "CLOSED") == 0)
+	{
+		return CIRCUIT_STATE_CLOSED;
+	}
+
+	return CIRCUIT_STATE_UNKNOWN;
+}
+
+/*
+Tells whether hop is the relay known by nickname and fingerprint. Either may be
+empty; the fingerprint may start with '$'. Both compare case-insensitively.
+*/
+bool matchCircuitHop(const CircuitHop& hop, const string& nickname, const string& fingerprint)
+{
+	const char* digest = fingerprint.c_str();
+	if(digest[0] == '$')
+	{
+		++digest;
+	}
+
+	if((hop.fingerprint.empty() == false) && (digest[0] != '\0') && (strcasecmp(hop.fingerprint.c_str(), digest) == 0))
+	{
+		return true;
+	}
+
+	return (hop.nickname.empty() == false) && (strcasecmp(hop.nickname.c_str(), nickname.c_str()) == 0);
+}
+
+/* Parses one comma-separated path into hops. */
+static void parsePath(const char* path, size_t length, vector<CircuitHop>& hops)
+{
+	hops.clear();
+
+	const char* end = path + length;
+	while(path < end)
+	{
+		const char* comma = (const char*)memchr(path, ',', end - path);
+		if(comma == NULL)
+		{
+			comma = end;
+		}
+
+		CircuitHop hop;
+		if(path[0] == '$')
+		{
+			const char* digest = path + 1;
+			const char* separator = digest;
+			while((separator < comma) && (*separator != '~') && (*separator != '='))
+			{
+				++separator;
+			}
+
+			hop.fingerprint.assign(digest, separator - digest);
+			for(size_t i = 0; i < hop.fingerprint.size(); i++)
+			{
+				hop.fingerprint[i] = toupper(hop.fingerprint[i]);
+			}
+
+			if(separator < comma)
+			{
+				hop.nickname.assign(separator + 1, comma - separator - 1);
+			}
+		}
+		else
+		{
+			hop.nickname.assign(path, comma - path);
+		}
+
+		hops.push_back(hop);
+		path = comma + 1;
+	}
+}
+
+CircuitTable::CircuitTable()
+{
+	this->buckets.resize(CIRCUIT_TABLE_INITIAL_BUCKETS);
+	this->count = 0;
+}
+
+unsigned int CircuitTable::hash(int id) const
+{
+	// Circuit IDs are handed out in sequence; the buckets are a power of two
+	return (unsigned int)id & (this->buckets.size() - 1);
+}
+
+/* Doubles the buckets once the table holds more circuits than buckets. */
+void CircuitTable::grow()
+{
+	vector< vector<CircuitInfo> > old;
+	old.swap(this->buckets);
+	this->buckets.resize(old.size() * 2);
+
+	for(unsigned int b = 0; b < old.size(); b++)
+	{
+		for(unsigned int i = 0; i < old[b].size(); i++)
+		{
+			this->buckets[this->hash(old[b][i].id)].push_back(old[b][i]);
+		}
+	}
+}
+
+/*
+Replaces the table with the circuits of a "getinfo circuit-status" reply: the
+"circuit-status=" line, one line per circuit and the closing "OK". Returns the
+number of circuits, or -1 when a line is malformed.
+*/
+int CircuitTable::load(const vector<string>& lines)
+{
+	this->clear();
+
+	for(unsigned int i = 0; i < lines.size(); i++)
+	{
+		const char* line = lines[i].c_str();
+		if(strncmp(line, "circuit-status=", 15) == 0)
+		{
+			line += 15;
+		}
+		else if((i == lines.size() - 1) && (strcmp(line, "OK") == 0))
+		{
+			continue;
+		}
+
+		if(line[0] == '\0')
+		{
+			continue;
+		}
+
+		if(this->update(line) == -1)
+		{
+			return -1;
+		}
+	}
+
+	return this->count;
+}
+
+/*
+Applies one circuit status line, "<ID> <status> [<path>] [<key>=<value> ...]".
+Returns the CIRCUIT_STATE_* value of the circuit, or -1 when the line is malformed.
+*/
+int CircuitTable::update(const char* line)
+{
+	char* end;
+	long id = strtol(line, &end, 10);
+	if((end == line) || (*end != ' '))
+	{
+		fprintf(stderr, "[CircuitTable::update] Malformed circuit status: %s\n", line);
+		return -1;
+	}
+
+	const char* status = end + 1;
+	size_t statusLength = strcspn(status, " ");
+	char state[16];
+	if((statusLength == 0) || (statusLength >= sizeof(state)))
+	{
+		fprintf(stderr, "[CircuitTable::update] Malformed circuit status: %s\n", line);
+		return -1;
+	}
+	memcpy(state, status, statusLength);
+	state[statusLength] = '\0';
+
+	CircuitInfo info;
+	info.id = (int)id;
+	info.state = parseCircuitState(state);
+
+	// The path, when present, is the first argument; any other argument with '=' is a key=value pair
+	const char* argument = status + statusLength;
+	while(*argument == ' ')
+	{
+		argument++;
+		size_t length = strcspn(argument, " ");
+		const char* equals = (const char*)memchr(argument, '=', length);
+
+		if((argument == status + statusLength + 1) && ((argument[0] == '$') || (equals == NULL)))
+		{
+			parsePath(argument, length, info.path);
+		}
+		else if((equals != NULL) && (strncmp(argument, "PURPOSE=", 8) == 0))
+		{
+			info.purpose.assign(argument + 8, length - 8);
+		}
+
+		argument += length;
+	}
+
+	if((info.state == CIRCUIT_STATE_FAILED) || (info.state == CIRCUIT_STATE_CLOSED))
+	{
+		this->remove(info.id);
+		return info.state;
+	}
+
+	vector<CircuitInfo>& bucket = this->buckets[this->hash(info.id)];
+	for(unsigned int i = 0; i < bucket.size(); i++)
+	{
+		if(bucket[i].id == info.id)
+		{
+			bucket[i] = info;
+			return info.state;
+		}
+	}
+
+	bucket.push_back(info);
+	if(++this->count > (int)this->buckets.size())
+	{
+		this->grow();
+	}
+
+	return info.state;
+}
+
+/* Returns the circuit with the given ID, or NULL when Tor has not reported it or it is gone. */
+const CircuitInfo* CircuitTable::find(int id) const
+{
+	const vector<CircuitInfo>& bucket = this->buckets[this->hash(id)];
+	for(unsigned int i = 0; i < bucket.size(); i++)
+	{
+		if(bucket[i].id == id)
+		{
+			return &bucket[i];
+		}
+	}
+
+	return NULL;
+}
+
+void CircuitTable::remove(int id)
+{
+	vector<CircuitInfo>& bucket = this->buckets[this->hash(id)];
+	for(unsigned int i = 0; i < bucket.size(); i++)
+	{
+		if(bucket[i].id == id)
+		{
+			bucket[i] = bucket.back();
+			bucket.pop_back();
+			--this->count;
+			return;
+		}
+	}
+}
+
+void CircuitTable::clear()
+{
+	for(unsigned int b = 0; b < this->buckets.size(); b++)
+	{
+		this->buckets[b].clear();
+	}
+	this->count = 0;
+}
+
+int CircuitTable::getCount() const
+{
+	return this->count;
+}
+
+/* Appends the IDs of all the circuits in the table to ids. */
+void CircuitTable::getIds(vector<int>& ids) const
+{
+	for(unsigned int b = 0; b < this->buckets.size(); b++)
+	{
+		for(unsigned int i = 0; i < this->buckets[b].size(); i++)
+		{
+			ids.push_back(this->buckets[b][i].id);
+		}
+	}
+}
@@ -0,0 +1,67 @@
+#ifndef CIRCUITTABLE_H_
+#define CIRCUITTABLE_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define CIRCUIT_STATE_UNKNOWN	0
+#define CIRCUIT_STATE_LAUNCHED	1
+#define CIRCUIT_STATE_BUILT		2
+#define CIRCUIT_STATE_EXTENDED	3
+#define CIRCUIT_STATE_FAILED	4
+#define CIRCUIT_STATE_CLOSED	5
+
+#define CIRCUIT_TABLE_INITIAL_BUCKETS 64
+
+/* One relay of a circuit path; fingerprint is upper-case hex without the '$', empty when Tor gave only the nickname */
+struct CircuitHop
+{
+	string fingerprint;
+	string nickname;
+};
+
+struct CircuitInfo
+{
+	int id;
+	int state;
+	vector<CircuitHop> path;
+	string purpose;
+};
+
+int parseCircuitState(const char* state);
+bool matchCircuitHop(const CircuitHop& hop, const string& nickname, const string& fingerprint);
+
+/*
+Tor's circuits as the control port reports them, in a hash table keyed by
+circuit ID. load() takes the lines of "getinfo circuit-status" and update()
+takes the text of each CIRC event after "CIRC ", in the same "<ID> <status>
+[<path>] [<key>=<value> ...]" format; a FAILED or CLOSED circuit leaves the
+table. Hops are "$fingerprint~nickname" (or "=" for the older separator),
+"$fingerprint" or a bare nickname.
+*/
+class CircuitTable
+{
+private:
+	vector< vector<CircuitInfo> > buckets;
+	int count;
+
+	unsigned int hash(int id) const;
+	void grow();
+
+public:
+	CircuitTable();
+
+	int load(const vector<string>& lines);
+	int update(const char* line);
+	const CircuitInfo* find(int id) const;
+	void remove(int id);
+	void clear();
+	int getCount() const;
+	void getIds(vector<int>& ids) const;
+};
+
+#endif /* CIRCUITTABLE_H_ */
@@ -0,0 +1,74 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cmath>
+#include "correlation.h"
+#include "CorrelationAccumulator.h"
+
+using namespace std;
+
+CorrelationAccumulator::CorrelationAccumulator()
+{
+	this->reset();
+}
+
+void CorrelationAccumulator::add(double x, double y)
+{
+	++this->count;
+
+	double dx = x - this->meanX;
+	this->meanX += dx / this->count;
+	double dy = y - this->meanY;
+	this->meanY += dy / this->count;
+
+	// one factor uses the old mean and the other the updated one
+	this->m2X += dx * (x - this->meanX);
+	this->m2Y += dy * (y - this->meanY);
+	this->coMoment += dx * (y - this->meanY);
+}
+
+void CorrelationAccumulator::reset()
+{
+	this->count = 0;
+	this->meanX = 0;
+	this->meanY = 0;
+	this->m2X = 0;
+	this->m2Y = 0;
+	this->coMoment = 0;
+}
+
+long CorrelationAccumulator::getCount() const
+{
+	return this->count;
+}
+
+double CorrelationAccumulator::getMeanX() const
+{
+	return this->meanX;
+}
+
+double CorrelationAccumulator::getMeanY() const
+{
+	return this->meanY;
+}
+
+/* Returns the correlation of the pairs added so far, or CORRELATION_ERROR if it is undefined. */
+double CorrelationAccumulator::getCorrelation() const
+{
+	if((this->count < 2) || (this->m2X <= 0) || (this->m2Y <= 0))
+	{
+		return CORRELATION_ERROR;
+	}
+
+	double r = this->coMoment / sqrt(this->m2X * this->m2Y);
+
+	if(r > 1.0)
+	{
+		r = 1.0;
+	}
+	else if(r < -1.0)
+	{
+		r = -1.0;
+	}
+
+	return r;
+}
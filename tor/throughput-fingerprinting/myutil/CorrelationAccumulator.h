@@ -0,0 +1,33 @@
+#ifndef CORRELATIONACCUMULATOR_H_
+#define CORRELATIONACCUMULATOR_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+
+/*
+Incremental (Welford-style) Pearson correlation of a stream of (x, y)
+pairs. Each add() updates the running means, the sums of squared deviations
+and the co-moment in O(1), so a correlation is available after every sample
+without keeping the series around.
+*/
+class CorrelationAccumulator
+{
+private:
+	long count;
+	double meanX;
+	double meanY;
+	double m2X;		// sum of squared deviations of x
+	double m2Y;		// sum of squared deviations of y
+	double coMoment;	// sum of (x - meanX) * (y - meanY)
+
+public:
+	CorrelationAccumulator();
+	void add(double x, double y);
+	void reset();
+	long getCount() const;
+	double getMeanX() const;
+	double getMeanY() const;
+	double getCorrelation() const;
+};
+
+#endif /* CORRELATIONACCUMULATOR_H_ */
@@ -0,0 +1,205 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "FlowTable.h"
+
+using namespace std;
+
+#define FLOW_SLOT_EMPTY		0
+#define FLOW_SLOT_ACTIVE	1
+#define FLOW_SLOT_DELETED	2
+
+FlowKey createFlowKey(uint32_t sourceAddress, uint16_t sourcePort, uint32_t destinationAddress, uint16_t destinationPort)
+{
+	FlowKey key;
+	memset(&key, 0, sizeof(key));
+
+	key.sourceAddress = sourceAddress;
+	key.sourcePort = sourcePort;
+	key.destinationAddress = destinationAddress;
+	key.destinationPort = destinationPort;
+
+	return key;
+}
+
+/* Rounds a byte offset up to a cache line. */
+static size_t alignOffset(size_t offset)
+{
+	return (offset + CACHE_LINE_SIZE - 1) & ~((size_t)CACHE_LINE_SIZE - 1);
+}
+
+FlowTable::FlowTable(int maxFlows, int keyType, double binWidth, int binCount, int seriesCount)
+{
+	if((maxFlows <= 0) || ((keyType != FLOW_KEY_SOURCE) && (keyType != FLOW_KEY_FULL)))
+	{
+		fprintf(stderr, "[FlowTable::FlowTable] Invalid flow count or key type. Terminating process.\n");
+		exit(1);
+	}
+
+	// at most half full, so probe sequences stay short
+	this->capacity = 1;
+	while(this->capacity < 2 * maxFlows)
+	{
+		this->capacity <<= 1;
+	}
+
+	this->keyType = keyType;
+	this->binCount = binCount;
+	this->seriesCount = seriesCount;
+
+	size_t binnerOffset = alignOffset(this->capacity * sizeof(FlowSlot));
+	size_t binOffset = alignOffset(binnerOffset + this->capacity * sizeof(IntervalBinner));
+	size_t memoryLength = binOffset + (size_t)this->capacity * binCount * seriesCount * sizeof(ByteCounter);
+
+	if(posix_memalign(&this->memory, CACHE_LINE_SIZE, memoryLength) != 0)
+	{
+		fprintf(stderr, "[FlowTable::FlowTable] Cannot allocate %lu bytes. Terminating process.\n", (unsigned long)memoryLength);
+		exit(1);
+	}
+
+	// every slot starts FLOW_SLOT_EMPTY
+	memset(this->memory, 0, memoryLength);
+	this->slots = (FlowSlot*)this->memory;
+	this->binners = (IntervalBinner*)((char*)this->memory + binnerOffset);
+
+	ByteCounter* bins = (ByteCounter*)((char*)this->memory + binOffset);
+	for(int i = 0; i < this->capacity; i++)
+	{
+		new(&this->binners[i]) IntervalBinner(binWidth, binCount, seriesCount, &bins[(size_t)i * binCount * seriesCount]);
+	}
+}
+
+FlowTable::~FlowTable()
+{
+	for(int i = 0; i < this->capacity; i++)
+	{
+		this->binners[i].~IntervalBinner();
+	}
+
+	free(this->memory);
+}
+
+FlowKey FlowTable::maskKey(const FlowKey& key) const
+{
+	if(this->keyType == FLOW_KEY_SOURCE)
+	{
+		return createFlowKey(key.sourceAddress, key.sourcePort, 0, 0);
+	}
+
+	return createFlowKey(key.sourceAddress, key.sourcePort, key.destinationAddress, key.destinationPort);
+}
+
+unsigned int FlowTable::hash(const FlowKey& key) const
+{
+	uint64_t h = ((uint64_t)key.sourceAddress << 16) ^ key.sourcePort;
+	h ^= (((uint64_t)key.destinationAddress << 16) ^ key.destinationPort) * 0x9E3779B97F4A7C15ULL;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 32;
+
+	return (unsigned int)h & (this->capacity - 1);
+}
+
+/* Returns the id of the flow for key, registering it if needed, or -1 if the table is full. */
+int FlowTable::registerFlow(const FlowKey& key)
+{
+	FlowKey k = this->maskKey(key);
+	int existing = this->lookup(k);
+	if(existing != -1)
+	{
+		return existing;
+	}
+
+	unsigned int i = this->hash(k);
+	for(int n = 0; n < this->capacity; n++, i = (i + 1) & (this->capacity - 1))
+	{
+		if(this->slots[i].state != FLOW_SLOT_ACTIVE)
+		{
+			this->slots[i].key = k;
+			this->binners[i].start(0);
+			__atomic_store_n(&this->slots[i].state, FLOW_SLOT_ACTIVE, __ATOMIC_RELEASE);
+
+			return i;
+		}
+	}
+
+	fprintf(stderr, "[FlowTable::registerFlow] The flow table is full.\n");
+	return -1;
+}
+
+void FlowTable::unregisterFlow(int flow)
+{
+	__atomic_store_n(&this->slots[flow].state, FLOW_SLOT_DELETED, __ATOMIC_RELEASE);
+
+	// a tombstone at the end of a probe run is not needed to reach anything; clear
+	// it and any tombstones before it so lookups of unknown flows stay short
+	unsigned int next = (flow + 1) & (this->capacity - 1);
+	if(this->slots[next].state == FLOW_SLOT_EMPTY)
+	{
+		unsigned int i = flow;
+		while(this->slots[i].state == FLOW_SLOT_DELETED)
+		{
+			__atomic_store_n(&this->slots[i].state, FLOW_SLOT_EMPTY, __ATOMIC_RELEASE);
+			i = (i - 1) & (this->capacity - 1);
+		}
+	}
+}
+
+/* Returns the id of the flow key belongs to, or -1. */
+int FlowTable::lookup(const FlowKey& key) const
+{
+	FlowKey k = this->maskKey(key);
+	unsigned int i = this->hash(k);
+
+	for(int n = 0; n < this->capacity; n++, i = (i + 1) & (this->capacity - 1))
+	{
+		int state = __atomic_load_n(&this->slots[i].state, __ATOMIC_ACQUIRE);
+
+		if(state == FLOW_SLOT_EMPTY)
+		{
+			break;
+		}
+
+		if((state == FLOW_SLOT_ACTIVE)
+				&& (this->slots[i].key.sourceAddress == k.sourceAddress)
+				&& (this->slots[i].key.sourcePort == k.sourcePort)
+				&& (this->slots[i].key.destinationAddress == k.destinationAddress)
+				&& (this->slots[i].key.destinationPort == k.destinationPort))
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*
+Adds bytes seen at timestamp to series of the flow key belongs to. Returns the
+flow id, or -1 if no flow is registered for key.
+*/
+int FlowTable::add(const FlowKey& key, int series, double timestamp, uint64_t bytes)
+{
+	int flow = this->lookup(key);
+	if(flow == -1)
+	{
+		this->unmatchedBytes.add(bytes);
+		return -1;
+	}
+
+	this->binners[flow].add(series, timestamp, bytes);
+
+	return flow;
+}
+
+IntervalBinner* FlowTable::getBinner(int flow)
+{
+	return &this->binners[flow];
+}
+
+/* Returns the bytes of packets that belonged to no registered flow. */
+uint64_t FlowTable::getUnmatchedBytes() const
+{
+	return this->unmatchedBytes.get();
+}
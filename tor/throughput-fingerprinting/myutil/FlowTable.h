@@ -0,0 +1,70 @@
+#ifndef FLOWTABLE_H_
+#define FLOWTABLE_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "ByteCounter.h"
+#include "IntervalBinner.h"
+
+#define FLOW_KEY_SOURCE	0	// flows are told apart by source address and port
+#define FLOW_KEY_FULL	1	// flows are told apart by source and destination address and port
+
+/* TCP flow key; addresses in network byte order, ports in host byte order */
+struct FlowKey
+{
+	uint32_t sourceAddress;
+	uint32_t destinationAddress;
+	uint16_t sourcePort;
+	uint16_t destinationPort;
+};
+
+FlowKey createFlowKey(uint32_t sourceAddress, uint16_t sourcePort, uint32_t destinationAddress, uint16_t destinationPort);
+
+/*
+Demultiplexes one capture into many measured flows. Flows are registered up
+front and looked up per packet in an open-addressing table with linear
+probing; each flow has its own IntervalBinner. The table and the bins live in
+one cache-line aligned allocation, which the capture thread fills and the
+measurement threads read.
+
+Only registerFlow() and unregisterFlow() modify the table and they must be
+called from one thread; lookups from the capture thread need no lock.
+*/
+class FlowTable
+{
+private:
+	struct FlowSlot
+	{
+		int state;
+		FlowKey key;
+	};
+
+	int capacity;
+	int keyType;
+	int binCount;
+	int seriesCount;
+
+	void* memory;
+
+	FlowSlot* slots;
+	IntervalBinner* binners;
+	ByteCounter unmatchedBytes;
+
+	FlowKey maskKey(const FlowKey& key) const;
+	unsigned int hash(const FlowKey& key) const;
+
+public:
+	FlowTable(int maxFlows, int keyType, double binWidth, int binCount, int seriesCount);
+	~FlowTable();
+
+	int registerFlow(const FlowKey& key);
+	void unregisterFlow(int flow);
+	int lookup(const FlowKey& key) const;
+
+	int add(const FlowKey& key, int series, double timestamp, uint64_t bytes);
+	IntervalBinner* getBinner(int flow);
+	uint64_t getUnmatchedBytes() const;
+};
+
+#endif /* FLOWTABLE_H_ */
@@ -0,0 +1,145 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <sched.h>
+#include "IntervalBinner.h"
+
+using namespace std;
+
+/*
+binCount must cover the bins that can be open at once, the reader's polling
+period plus the lag divided by binWidth, and one more.
+*/
+IntervalBinner::IntervalBinner(double binWidth, int binCount, int seriesCount)
+{
+	this->initialize(binWidth, binCount, seriesCount);
+
+	this->bins = new ByteCounter[(size_t)binCount * seriesCount];
+	if(this->bins == NULL)
+	{
+		fprintf(stderr, "[IntervalBinner::IntervalBinner] Memory allocation error. Terminating process.\n");
+		exit(1);
+	}
+	this->ownsBins = true;
+}
+
+/* Uses the caller's binCount * seriesCount zeroed counters, e.g. in shared memory. */
+IntervalBinner::IntervalBinner(double binWidth, int binCount, int seriesCount, ByteCounter* bins)
+{
+	this->initialize(binWidth, binCount, seriesCount);
+
+	this->bins = bins;
+	this->ownsBins = false;
+}
+
+void IntervalBinner::initialize(double binWidth, int binCount, int seriesCount)
+{
+	if((binWidth <= 0) || (binCount < 2) || (seriesCount <= 0))
+	{
+		fprintf(stderr, "[IntervalBinner::IntervalBinner] Invalid bin width, bin count or series count. Terminating process.\n");
+		exit(1);
+	}
+
+	this->binWidth = binWidth;
+	this->binCount = binCount;
+	this->seriesCount = seriesCount;
+	this->origin = 0;
+	this->nextBin = 0;
+	this->activeWriters = 0;
+}
+
+IntervalBinner::~IntervalBinner()
+{
+	if(this->ownsBins)
+	{
+		delete [] this->bins;
+	}
+}
+
+/* Clears every bin and makes origin the start of bin 0. */
+void IntervalBinner::start(double origin)
+{
+	for(size_t i = 0; i < (size_t)this->binCount * this->seriesCount; i++)
+	{
+		this->bins[i].reset();
+	}
+
+	this->lateBytes.reset();
+	this->origin = origin;
+	__atomic_store_n(&this->nextBin, 0, __ATOMIC_RELEASE);
+}
+
+double IntervalBinner::getBinWidth() const
+{
+	return this->binWidth;
+}
+
+double IntervalBinner::getOrigin() const
+{
+	return this->origin;
+}
+
+/*
+Adds bytes seen at timestamp (in seconds, same clock as origin) to series.
+Returns 0, or -1 if the bin was already collected or is not in the ring yet.
+*/
+int IntervalBinner::add(int series, double timestamp, uint64_t bytes)
+{
+	int64_t bin = (int64_t)floor((timestamp - this->origin) / this->binWidth);
+
+	// Pairs with next(): either this sees the new nextBin or next() waits for the add
+	__atomic_add_fetch(&this->activeWriters, 1, __ATOMIC_SEQ_CST);
+	int64_t first = __atomic_load_n(&this->nextBin, __ATOMIC_SEQ_CST);
+
+	if((bin < first) || (bin >= first + this->binCount - 1))
+	{
+		__atomic_sub_fetch(&this->activeWriters, 1, __ATOMIC_RELEASE);
+		this->lateBytes.add(bytes);
+		return -1;
+	}
+
+	this->bins[(size_t)(bin % this->binCount) * this->seriesCount + series].add(bytes);
+	__atomic_sub_fetch(&this->activeWriters, 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+If the oldest uncollected bin ended at least lag seconds before now, stores its
+index and the bytes of every series (bytes[seriesCount]), clears it and returns
+true. Otherwise returns false.
+*/
+bool IntervalBinner::next(double now, double lag, int64_t* index, uint64_t* bytes)
+{
+	int64_t bin = __atomic_load_n(&this->nextBin, __ATOMIC_ACQUIRE);
+
+	if(now < this->origin + (bin + 1) * this->binWidth + lag)
+	{
+		return false;
+	}
+
+	// New add() calls now count bin as late; wait for the ones that already passed the check
+	__atomic_store_n(&this->nextBin, bin + 1, __ATOMIC_SEQ_CST);
+	while(__atomic_load_n(&this->activeWriters, __ATOMIC_SEQ_CST) != 0)
+	{
+		sched_yield();
+	}
+
+	ByteCounter* slot = &this->bins[(size_t)(bin % this->binCount) * this->seriesCount];
+	for(int s = 0; s < this->seriesCount; s++)
+	{
+		bytes[s] = slot[s].snapshotAndReset();
+	}
+
+	*index = bin;
+
+	return true;
+}
+
+/* Returns the bytes that could not be placed in their bin. */
+uint64_t IntervalBinner::getLateBytes() const
+{
+	return this->lateBytes.get();
+}
@@ -0,0 +1,54 @@
+#ifndef INTERVALBINNER_H_
+#define INTERVALBINNER_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "ByteCounter.h"
+
+/*
+Assigns bytes to fixed-width time bins by the timestamp of the packet or recv()
+that carried them, not by when a monitor thread happens to wake up. Bins are
+kept in a ring of ByteCounters (one per bin and series), so any number of
+capture and receive threads can add without locking while one reader collects
+completed bins. A bin is complete once the clock has passed its end by a lag,
+which gives late timestamps time to arrive; bytes for a bin that has already
+been collected, or for one beyond the ring, are counted as late instead.
+
+An add() that races with the collection of its bin either lands before the
+bin is read or is counted as late: next() moves nextBin on first and reads the
+bin only once no add() that saw the old nextBin is still in flight. The ring
+takes binCount - 1 bins ahead of the collected ones, so the bin being read is
+never also the target of a bin binCount later.
+*/
+class IntervalBinner
+{
+private:
+	double binWidth;
+	int binCount;
+	int seriesCount;
+	double origin;
+	int64_t nextBin;
+	uint64_t activeWriters __attribute__((aligned(CACHE_LINE_SIZE)));	// add() calls between their nextBin check and their add
+	char padding[CACHE_LINE_SIZE - sizeof(uint64_t)];
+	ByteCounter* bins;
+	bool ownsBins;
+	ByteCounter lateBytes;
+
+	void initialize(double binWidth, int binCount, int seriesCount);
+
+public:
+	IntervalBinner(double binWidth, int binCount, int seriesCount);
+	IntervalBinner(double binWidth, int binCount, int seriesCount, ByteCounter* bins);
+	~IntervalBinner();
+
+	void start(double origin);
+	double getBinWidth() const;
+	double getOrigin() const;
+
+	int add(int series, double timestamp, uint64_t bytes);
+	bool next(double now, double lag, int64_t* index, uint64_t* bytes);
+	uint64_t getLateBytes() const;
+};
+
+#endif /* INTERVALBINNER_H_ */
@@ -0,0 +1,134 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <time.h>
+#include <sys/timerfd.h>
+#include "IntervalTimer.h"
+
+using namespace std;
+
+IntervalTimer::IntervalTimer()
+{
+	this->fd = -1;
+	this->period = 0;
+	this->tickCount = 0;
+	this->missedTicks = 0;
+}
+
+IntervalTimer::~IntervalTimer()
+{
+	this->stop();
+}
+
+/*
+Arms the timer with its first deadline one period from now. Periods are kept to
+the nanosecond. Returns 0 on success and -1 on error.
+*/
+int IntervalTimer::start(double period)
+{
+	this->stop();
+
+	long long periodNsec = (long long)(period * 1000000000.0 + 0.5);
+	if(periodNsec <= 0)
+	{
+		fprintf(stderr, "[IntervalTimer::start] Invalid period %f.\n", period);
+		return -1;
+	}
+
+	this->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if(this->fd == -1)
+	{
+		fprintf(stderr, "[IntervalTimer::start] Error in creating timer: %s.\n", strerror(errno));
+		return -1;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = periodNsec / 1000000000LL;
+	spec.it_interval.tv_nsec = periodNsec % 1000000000LL;
+	spec.it_value.tv_sec = now.tv_sec + spec.it_interval.tv_sec;
+	spec.it_value.tv_nsec = now.tv_nsec + spec.it_interval.tv_nsec;
+	if(spec.it_value.tv_nsec >= 1000000000L)
+	{
+		spec.it_value.tv_sec++;
+		spec.it_value.tv_nsec -= 1000000000L;
+	}
+
+	if(timerfd_settime(this->fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+	{
+		fprintf(stderr, "[IntervalTimer::start] Error in arming timer: %s.\n", strerror(errno));
+		::close(this->fd);
+		this->fd = -1;
+		return -1;
+	}
+
+	this->period = periodNsec / 1000000000.0;
+	this->tickCount = 0;
+	this->missedTicks = 0;
+
+	return 0;
+}
+
+/*
+Blocks until the next deadline. Returns the number of deadlines that passed since
+the previous call, which is more than 1 when ticks were missed, or -1 on error.
+*/
+int64_t IntervalTimer::wait()
+{
+	if(this->fd == -1)
+	{
+		fprintf(stderr, "[IntervalTimer::wait] Timer is not started.\n");
+		return -1;
+	}
+
+	uint64_t expirations;
+	while(1)
+	{
+		ssize_t res = read(this->fd, &expirations, sizeof(expirations));
+		if(res == sizeof(expirations))
+		{
+			break;
+		}
+
+		if((res == -1) && (errno == EINTR))
+		{
+			continue;
+		}
+
+		fprintf(stderr, "[IntervalTimer::wait] Error in reading timer: %s.\n", (res == -1) ? strerror(errno) : "short read");
+		return -1;
+	}
+
+	this->tickCount += expirations;
+	this->missedTicks += expirations - 1;
+
+	return (int64_t)expirations;
+}
+
+double IntervalTimer::getPeriod() const
+{
+	return this->period;
+}
+
+uint64_t IntervalTimer::getTickCount() const
+{
+	return this->tickCount;
+}
+
+uint64_t IntervalTimer::getMissedTicks() const
+{
+	return this->missedTicks;
+}
+
+void IntervalTimer::stop()
+{
+	if(this->fd != -1)
+	{
+		::close(this->fd);
+		this->fd = -1;
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef INTERVALTIMER_H_
+#define INTERVALTIMER_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdint.h>
+
+/*
+Periodic tick source on a timerfd. Deadlines are absolute CLOCK_MONOTONIC times
+start + k * period, so the time spent between ticks never shifts the next one
+and no error accumulates over a long measurement. When the caller falls behind,
+wait() reports how many ticks it missed instead of silently stretching the
+interval.
+*/
+class IntervalTimer
+{
+private:
+	int fd;
+	double period;
+	uint64_t tickCount;
+	uint64_t missedTicks;
+
+public:
+	IntervalTimer();
+	~IntervalTimer();
+
+	int start(double period);
+	int64_t wait();
+	double getPeriod() const;
+	uint64_t getTickCount() const;
+	uint64_t getMissedTicks() const;
+	void stop();
+};
+
+#endif /* INTERVALTIMER_H_ */
@@ -0,0 +1,523 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "correlation.h"
+#include "trace.h"
+#include "LSHIndex.h"
+
+using namespace std;
+
+struct BucketOrder
+{
+	bool operator()(const LSHBucketEntry& a, const LSHBucketEntry& b) const
+	{
+		return (a.signature < b.signature) || ((a.signature == b.signature) && (a.entry < b.entry));
+	}
+};
+
+struct LSHMatchOrder
+{
+	bool operator()(const LSHMatch& a, const LSHMatch& b) const
+	{
+		return a.correlation > b.correlation;
+	}
+};
+
+/* Rounds a section size up to the 8-byte alignment used in the index file. */
+static size_t alignSection(size_t size)
+{
+	return (size + 7) & ~((size_t)7);
+}
+
+/* xorshift64* generator with Box-Muller, used to draw the projection vectors. */
+static double nextGaussian(uint64_t* state)
+{
+	double u[2];
+
+	for(int i = 0; i < 2; i++)
+	{
+		*state ^= *state >> 12;
+		*state ^= *state << 25;
+		*state ^= *state >> 27;
+
+		// 53 random bits mapped to (0, 1]
+		u[i] = ((*state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0) + (1.0 / 18014398509481984.0);
+	}
+
+	return sqrt(-2.0 * log(u[0])) * cos(2 * M_PI * u[1]);
+}
+
+LSHIndex::LSHIndex()
+{
+	this->mapAddress = NULL;
+	this->mapLength = 0;
+
+	this->header = NULL;
+	this->relays = NULL;
+	this->entries = NULL;
+	this->projections = NULL;
+	this->values = NULL;
+	this->buckets = NULL;
+}
+
+LSHIndex::~LSHIndex()
+{
+	this->close();
+}
+
+void LSHIndex::close()
+{
+	if(this->mapAddress != NULL)
+	{
+		munmap(this->mapAddress, this->mapLength);
+		this->mapAddress = NULL;
+		this->mapLength = 0;
+	}
+
+	this->header = NULL;
+	this->relays = NULL;
+	this->entries = NULL;
+	this->projections = NULL;
+	this->values = NULL;
+	this->buckets = NULL;
+}
+
+/* Returns the signature of a z-normalized window in one table. */
+uint32_t LSHIndex::computeSignature(const double* window, int table) const
+{
+	int length = this->header->windowLength;
+	int bits = this->header->bitsPerTable;
+	uint32_t signature = 0;
+	vector<double> projection(length);
+
+	for(int b = 0; b < bits; b++)
+	{
+		const float* p = this->projections + ((size_t)table * bits + b) * length;
+
+		for(int i = 0; i < length; i++)
+		{
+			projection[i] = p[i];
+		}
+
+		if(dotProduct(&projection[0], window, length) >= 0)
+		{
+			signature |= (1U << b);
+		}
+	}
+
+	return signature;
+}
+
+/*
+Hashes every window of every relay series in a tor-node-throughput-calc
+output file. Returns the number of windows indexed, or -1 on error.
+*/
+int LSHIndex::build(const string& relayTraceFileName, int windowLength, int windowStride, int bitsPerTable, int tableCount, unsigned int seed)
+{
+	if((windowLength < 2) || (windowStride < 1) || (bitsPerTable < 1) || (bitsPerTable > LSH_MAX_BITS_PER_TABLE) || (tableCount < 1))
+	{
+		fprintf(stderr, "[LSHIndex::build] Invalid index parameters.\n");
+		return -1;
+	}
+
+	vector<RelayTrace> traces;
+	if(readRelayTraceFile(relayTraceFileName, traces) == -1)
+	{
+		return -1;
+	}
+
+	this->close();
+
+	memset(&this->builtHeader, 0, sizeof(this->builtHeader));
+	memcpy(this->builtHeader.magic, LSH_MAGIC, sizeof(this->builtHeader.magic));
+	this->builtHeader.windowLength = windowLength;
+	this->builtHeader.windowStride = windowStride;
+	this->builtHeader.bitsPerTable = bitsPerTable;
+	this->builtHeader.tableCount = tableCount;
+
+	this->builtRelays.clear();
+	this->builtEntries.clear();
+	this->builtValues.clear();
+	this->builtBuckets.clear();
+
+	// draw the projections first so that computeSignature() can use them
+	uint64_t state = 0x9E3779B97F4A7C15ULL ^ seed;
+	this->builtProjections.resize((size_t)tableCount * bitsPerTable * windowLength);
+	for(size_t i = 0; i < this->builtProjections.size(); i++)
+	{
+		this->builtProjections[i] = (float)nextGaussian(&state);
+	}
+
+	this->header = &this->builtHeader;
+	this->projections = &this->builtProjections[0];
+
+	vector<double> series;
+	vector<double> normalized(windowLength);
+	vector<uint32_t> signatures;
+
+	for(unsigned int r = 0; r < traces.size(); r++)
+	{
+		int n = traces[r].samples.size();
+		if(n < windowLength)
+		{
+			continue;
+		}
+
+		LSHRelayRecord record;
+		memset(&record, 0, sizeof(record));
+		strncpy(record.name, traces[r].middleman.c_str(), LSH_NAME_LENGTH - 1);
+		strncpy(record.fingerprint, traces[r].fingerprint.c_str(), LSH_NAME_LENGTH - 1);
+		record.valueOffset = this->builtValues.size();
+		record.valueCount = n;
+
+		series.resize(n);
+		for(int i = 0; i < n; i++)
+		{
+			series[i] = traces[r].samples[i].throughput;
+			this->builtValues.push_back((float)series[i]);
+		}
+
+		uint32_t relay = this->builtRelays.size();
+		this->builtRelays.push_back(record);
+
+		for(int offset = 0; offset + windowLength <= n; offset += windowStride)
+		{
+			if(zNormalize(&series[offset], windowLength, &normalized[0], windowLength) == false)
+			{
+				continue; // a constant window carries no shape to match
+			}
+
+			LSHEntry entry;
+			entry.relay = relay;
+			entry.offset = offset;
+			this->builtEntries.push_back(entry);
+
+			for(int t = 0; t < tableCount; t++)
+			{
+				signatures.push_back(this->computeSignature(&normalized[0], t));
+			}
+		}
+	}
+
+	uint32_t entryCount = this->builtEntries.size();
+
+	this->builtHeader.relayCount = this->builtRelays.size();
+	this->builtHeader.entryCount = entryCount;
+	this->builtHeader.valueCount = this->builtValues.size();
+
+	this->builtBuckets.resize((size_t)tableCount * entryCount);
+	for(int t = 0; t < tableCount; t++)
+	{
+		LSHBucketEntry* table = &this->builtBuckets[(size_t)t * entryCount];
+
+		for(uint32_t e = 0; e < entryCount; e++)
+		{
+			table[e].signature = signatures[(size_t)e * tableCount + t];
+			table[e].entry = e;
+		}
+
+		sort(table, table + entryCount, BucketOrder());
+	}
+
+	this->relays = (this->builtRelays.size() > 0) ? &this->builtRelays[0] : NULL;
+	this->entries = (entryCount > 0) ? &this->builtEntries[0] : NULL;
+	this->values = (this->builtValues.size() > 0) ? &this->builtValues[0] : NULL;
+	this->buckets = (entryCount > 0) ? &this->builtBuckets[0] : NULL;
+
+	return entryCount;
+}
+
+/* Writes the index in the on-disk format. Returns 0 on success and -1 on error. */
+int LSHIndex::save(const string& fileName) const
+{
+	if(this->header == NULL)
+	{
+		fprintf(stderr, "[LSHIndex::save] The index is empty.\n");
+		return -1;
+	}
+
+	FILE* outFile = fopen(fileName.c_str(), "wb");
+	if(outFile == NULL)
+	{
+		fprintf(stderr, "[LSHIndex::save] Cannot open file %s for output.\n", fileName.c_str());
+		return -1;
+	}
+
+	const LSHFileHeader* h = this->header;
+	size_t projectionCount = (size_t)h->tableCount * h->bitsPerTable * h->windowLength;
+
+	const void* section[6] = {h, this->relays, this->entries, this->projections, this->values, this->buckets};
+	size_t size[6] = {sizeof(LSHFileHeader), h->relayCount * sizeof(LSHRelayRecord), h->entryCount * sizeof(LSHEntry), projectionCount * sizeof(float), h->valueCount * sizeof(float), (size_t)h->tableCount * h->entryCount * sizeof(LSHBucketEntry)};
+	const char padding[8] = {0};
+	bool ok = true;
+
+	for(int i = 0; (i < 6) && ok; i++)
+	{
+		if(size[i] > 0)
+		{
+			ok = (fwrite(section[i], 1, size[i], outFile) == size[i]);
+		}
+
+		size_t pad = alignSection(size[i]) - size[i];
+		if(ok && (pad > 0))
+		{
+			ok = (fwrite(padding, 1, pad, outFile) == pad);
+		}
+	}
+
+	if((fclose(outFile) != 0) || (ok == false))
+	{
+		fprintf(stderr, "[LSHIndex::save] Error in writing file %s.\n", fileName.c_str());
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Maps an index file written by save(). Returns 0 on success and -1 on error. */
+int LSHIndex::open(const string& fileName)
+{
+	this->close();
+
+	int fd = ::open(fileName.c_str(), O_RDONLY);
+	if(fd == -1)
+	{
+		fprintf(stderr, "[LSHIndex::open] Cannot open file %s for input.\n", fileName.c_str());
+		return -1;
+	}
+
+	struct stat st;
+	if((fstat(fd, &st) == -1) || ((size_t)st.st_size < sizeof(LSHFileHeader)))
+	{
+		fprintf(stderr, "[LSHIndex::open] File %s is not an index file.\n", fileName.c_str());
+		::close(fd);
+		return -1;
+	}
+
+	void* address = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if(address == MAP_FAILED)
+	{
+		fprintf(stderr, "[LSHIndex::open] Cannot map file %s.\n", fileName.c_str());
+		return -1;
+	}
+
+	const char* p = (const char*)address;
+	const LSHFileHeader* h = (const LSHFileHeader*)p;
+	size_t length = st.st_size;
+
+	// Every count is checked against the mapping before it is multiplied, so no section size can overflow
+	bool valid = (memcmp(h->magic, LSH_MAGIC, sizeof(h->magic)) == 0) && (h->windowLength > 0) && (h->windowLength <= length)
+			&& (h->bitsPerTable > 0) && (h->bitsPerTable <= LSH_MAX_BITS_PER_TABLE) && (h->tableCount > 0) && (h->tableCount <= length)
+			&& (h->relayCount <= length / sizeof(LSHRelayRecord)) && (h->entryCount <= length / sizeof(LSHEntry))
+			&& (h->valueCount <= length / sizeof(float));
+
+	size_t size[6] = {0};
+	size_t offset[6] = {0};
+	size_t total = 0;
+
+	if(valid == true)
+	{
+		size_t projectionCount = (size_t)h->tableCount * h->bitsPerTable * h->windowLength;
+		size_t bucketCount = (size_t)h->tableCount * h->entryCount;
+
+		valid = (projectionCount <= length / sizeof(float)) && (bucketCount <= length / sizeof(LSHBucketEntry));
+
+		size[0] = sizeof(LSHFileHeader);
+		size[1] = h->relayCount * sizeof(LSHRelayRecord);
+		size[2] = h->entryCount * sizeof(LSHEntry);
+		size[3] = projectionCount * sizeof(float);
+		size[4] = h->valueCount * sizeof(float);
+		size[5] = bucketCount * sizeof(LSHBucketEntry);
+	}
+
+	// Each section has to end inside the mapping, and the last one at its end
+	for(int i = 0; (i < 6) && valid; i++)
+	{
+		offset[i] = total;
+		valid = (alignSection(size[i]) <= length - total);
+		total += alignSection(size[i]);
+	}
+
+	if((valid == false) || (total != length))
+	{
+		fprintf(stderr, "[LSHIndex::open] File %s is not a valid index file.\n", fileName.c_str());
+		munmap(address, st.st_size);
+		return -1;
+	}
+
+	// The relay records point into the value section and hold zero-terminated names
+	const LSHRelayRecord* relays = (const LSHRelayRecord*)(p + offset[1]);
+	for(uint32_t i = 0; i < h->relayCount; i++)
+	{
+		if((relays[i].valueOffset > h->valueCount) || (relays[i].valueCount > h->valueCount - relays[i].valueOffset)
+				|| (memchr(relays[i].name, '\0', LSH_NAME_LENGTH) == NULL) || (memchr(relays[i].fingerprint, '\0', LSH_NAME_LENGTH) == NULL))
+		{
+			fprintf(stderr, "[LSHIndex::open] File %s has an invalid record for relay %u.\n", fileName.c_str(), i);
+			munmap(address, st.st_size);
+			return -1;
+		}
+	}
+
+	this->mapAddress = address;
+	this->mapLength = st.st_size;
+
+	this->header = h;
+	this->relays = relays;
+	this->entries = (const LSHEntry*)(p + offset[2]);
+	this->projections = (const float*)(p + offset[3]);
+	this->values = (const float*)(p + offset[4]);
+	this->buckets = (const LSHBucketEntry*)(p + offset[5]);
+
+	return 0;
+}
+
+int LSHIndex::getRelayCount() const
+{
+	return (this->header != NULL) ? this->header->relayCount : 0;
+}
+
+int LSHIndex::getEntryCount() const
+{
+	return (this->header != NULL) ? this->header->entryCount : 0;
+}
+
+int LSHIndex::getWindowLength() const
+{
+	return (this->header != NULL) ? this->header->windowLength : 0;
+}
+
+string LSHIndex::getName(int relay) const
+{
+	return string(this->relays[relay].name);
+}
+
+string LSHIndex::getFingerprint(int relay) const
+{
+	return string(this->relays[relay].fingerprint);
+}
+
+/*
+Finds the k relays with the best matching window for the first windowLength
+values of the query and stores them in matches, best first. Every table is
+probed at the query's signature and, with multiProbe, at every signature one
+bit away. Candidates are re-scored with the exact correlation. Returns the
+number of candidate windows re-scored, or -1 on error.
+*/
+int LSHIndex::query(const double* values, int n, int k, bool multiProbe, vector<LSHMatch>& matches) const
+{
+	matches.clear();
+
+	if(this->header == NULL)
+	{
+		fprintf(stderr, "[LSHIndex::query] The index is empty.\n");
+		return -1;
+	}
+
+	int length = this->header->windowLength;
+
+	if(n < length)
+	{
+		fprintf(stderr, "[LSHIndex::query] Query has %d samples; the index needs at least %d.\n", n, length);
+		return -1;
+	}
+
+	vector<double> q(length);
+	if(zNormalize(values, length, &q[0], length) == false)
+	{
+		fprintf(stderr, "[LSHIndex::query] The standard deviation of the query is zero.\n");
+		return -1;
+	}
+
+	uint32_t entryCount = this->header->entryCount;
+	int bits = this->header->bitsPerTable;
+	vector<uint32_t> candidates;
+
+	for(uint32_t t = 0; t < this->header->tableCount; t++)
+	{
+		const LSHBucketEntry* table = this->buckets + (size_t)t * entryCount;
+		uint32_t signature = this->computeSignature(&q[0], t);
+		int probeCount = multiProbe ? (bits + 1) : 1;
+
+		for(int p = 0; p < probeCount; p++)
+		{
+			LSHBucketEntry key;
+			key.signature = (p == 0) ? signature : (signature ^ (1U << (p - 1)));
+			key.entry = 0;
+
+			const LSHBucketEntry* it = lower_bound(table, table + entryCount, key, BucketOrder());
+
+			for(; (it != table + entryCount) && (it->signature == key.signature); ++it)
+			{
+				if(it->entry >= entryCount)
+				{
+					fprintf(stderr, "[LSHIndex::query] Bucket entry of table %u points past the %u windows of the index.\n", t, entryCount);
+					return -1;
+				}
+				candidates.push_back(it->entry);
+			}
+		}
+	}
+
+	sort(candidates.begin(), candidates.end());
+	candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+	map<int, LSHMatch> bestPerRelay;
+	vector<double> window(length);
+
+	for(unsigned int c = 0; c < candidates.size(); c++)
+	{
+		const LSHEntry& e = this->entries[candidates[c]];
+
+		// Entries of a mapped file are only checked when a lookup reaches them
+		if((e.relay >= this->header->relayCount) || (e.offset > this->relays[e.relay].valueCount)
+				|| ((uint32_t)length > this->relays[e.relay].valueCount - e.offset))
+		{
+			fprintf(stderr, "[LSHIndex::query] Window %u lies outside the series of its relay.\n", candidates[c]);
+			return -1;
+		}
+
+		const float* v = this->values + this->relays[e.relay].valueOffset + e.offset;
+
+		for(int i = 0; i < length; i++)
+		{
+			window[i] = v[i];
+		}
+
+		LSHMatch m;
+		m.relay = e.relay;
+		m.offset = e.offset;
+		m.correlation = pearsonCorrelation(values, &window[0], length);
+
+		map<int, LSHMatch>::iterator it = bestPerRelay.find(m.relay);
+		if((it == bestPerRelay.end()) || (m.correlation > it->second.correlation))
+		{
+			bestPerRelay[m.relay] = m;
+		}
+	}
+
+	for(map<int, LSHMatch>::iterator it = bestPerRelay.begin(); it != bestPerRelay.end(); ++it)
+	{
+		matches.push_back(it->second);
+	}
+
+	sort(matches.begin(), matches.end(), LSHMatchOrder());
+
+	if((int)matches.size() > k)
+	{
+		matches.resize(k);
+	}
+
+	return candidates.size();
+}
@@ -0,0 +1,120 @@
+#ifndef LSHINDEX_H_
+#define LSHINDEX_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define LSH_MAGIC "TPLSH001"
+
+#define LSH_DEFAULT_WINDOW_LENGTH	128
+#define LSH_DEFAULT_WINDOW_STRIDE	32
+#define LSH_DEFAULT_BITS_PER_TABLE	16
+#define LSH_DEFAULT_TABLE_COUNT		8
+#define LSH_MAX_BITS_PER_TABLE		32
+#define LSH_NAME_LENGTH				64
+
+/*
+On-disk layout (little endian, every section 8-byte aligned):
+
+	LSHFileHeader
+	LSHRelayRecord		[relayCount]
+	LSHEntry			[entryCount]		(relay, window offset) of every hashed window
+	float				[tableCount * bitsPerTable * windowLength]	projection vectors
+	float				[valueCount]		raw throughput series of all relays
+	LSHBucketEntry		[tableCount * entryCount]	per table, sorted by signature
+
+The file is mapped read-only by LSHIndex::open(), so a lookup only touches
+the pages of the buckets it probes and of the windows it re-scores.
+*/
+struct LSHFileHeader
+{
+	char magic[8];
+	uint32_t windowLength;
+	uint32_t windowStride;
+	uint32_t bitsPerTable;
+	uint32_t tableCount;
+	uint32_t relayCount;
+	uint32_t entryCount;
+	uint64_t valueCount;
+};
+
+struct LSHRelayRecord
+{
+	char name[LSH_NAME_LENGTH];
+	char fingerprint[LSH_NAME_LENGTH];
+	uint64_t valueOffset;
+	uint32_t valueCount;
+	uint32_t reserved;
+};
+
+struct LSHEntry
+{
+	uint32_t relay;
+	uint32_t offset;
+};
+
+struct LSHBucketEntry
+{
+	uint32_t signature;
+	uint32_t entry;
+};
+
+struct LSHMatch
+{
+	int relay;
+	int offset;			// start of the best matching window in the relay's series
+	double correlation;
+};
+
+/*
+Sign-random-projection (SimHash) index over z-normalized fixed-length
+windows of relay throughput series. Each of tableCount tables hashes a
+window to bitsPerTable bits, the signs of its dot products with random
+Gaussian vectors; windows with a high correlation agree on most bits.
+Lookups binary-search the sorted bucket arrays, so they are sublinear in the
+number of windows, and the candidates are then re-scored exactly.
+*/
+class LSHIndex
+{
+private:
+	// storage used while building; the pointers below refer to it or to the mapped file
+	LSHFileHeader builtHeader;
+	vector<LSHRelayRecord> builtRelays;
+	vector<LSHEntry> builtEntries;
+	vector<float> builtProjections;
+	vector<float> builtValues;
+	vector<LSHBucketEntry> builtBuckets;
+
+	void* mapAddress;
+	size_t mapLength;
+
+	const LSHFileHeader* header;
+	const LSHRelayRecord* relays;
+	const LSHEntry* entries;
+	const float* projections;
+	const float* values;
+	const LSHBucketEntry* buckets;
+
+	uint32_t computeSignature(const double* window, int table) const;
+	void close();
+
+public:
+	LSHIndex();
+	~LSHIndex();
+	int build(const string& relayTraceFileName, int windowLength, int windowStride, int bitsPerTable, int tableCount, unsigned int seed);
+	int save(const string& fileName) const;
+	int open(const string& fileName);
+	int getRelayCount() const;
+	int getEntryCount() const;
+	int getWindowLength() const;
+	string getName(int relay) const;
+	string getFingerprint(int relay) const;
+	int query(const double* values, int n, int k, bool multiProbe, vector<LSHMatch>& matches) const;
+};
+
+#endif /* LSHINDEX_H_ */
@@ -3,6 +3,8 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
 #include "Packet.h"
 
 using namespace std;
@@ -83,3 +85,142 @@ unsigned char* Packet::getPayload() const
 {
 	return this->payload;
 }
+
+PacketView::PacketView(const unsigned char* p, int captureLength, int length)
+{
+	this->packet = p;
+	this->captureLength = captureLength;
+	this->length = length;
+
+	this->ethernetHeaderLength = ETHERNET_HEADER_LEN;
+	this->ipHeaderLength = 0;
+	this->tcpHeaderLength = 0;
+	this->ipTotalLength = 0;
+	this->sourceAddress = 0;
+	this->destinationAddress = 0;
+	this->sourcePort = 0;
+	this->destinationPort = 0;
+	this->valid = false;
+
+	if(this->captureLength < this->ethernetHeaderLength + 20)
+	{
+		return;
+	}
+
+	// IPv6, ARP and VLAN-tagged frames do not carry the IPv4 header at this offset
+	const struct hdr_ethernet* eth = (const struct hdr_ethernet*)(this->packet);
+	if(ntohs(eth->ether_type) != ETHERTYPE_IP)
+	{
+		return;
+	}
+
+	const struct hdr_ip* ip = (const struct hdr_ip*)(this->packet + this->ethernetHeaderLength);
+	if(IP_V(ip) != 4)
+	{
+		return;
+	}
+
+	this->ipHeaderLength = IP_HL(ip) * 4;
+	this->ipTotalLength = ntohs(ip->ip_len);
+	if((this->ipHeaderLength < 20) || (this->captureLength < this->ethernetHeaderLength + this->ipHeaderLength + 20))
+	{
+		return;
+	}
+
+	const struct hdr_tcp* tcp = (const struct hdr_tcp*)(this->packet + this->ethernetHeaderLength + this->ipHeaderLength);
+	this->tcpHeaderLength = TCP_OFF(tcp) * 4;
+	if((this->tcpHeaderLength < 20) || (this->captureLength < this->ethernetHeaderLength + this->ipHeaderLength + this->tcpHeaderLength))
+	{
+		return;
+	}
+
+	// segmentation offload leaves ip_len at zero on locally sent packets
+	if(this->ipTotalLength == 0)
+	{
+		this->ipTotalLength = this->length - this->ethernetHeaderLength;
+	}
+
+	if(this->ipTotalLength < this->ipHeaderLength + this->tcpHeaderLength)
+	{
+		return;
+	}
+
+	this->sourceAddress = ip->ip_src.s_addr;
+	this->destinationAddress = ip->ip_dst.s_addr;
+	this->sourcePort = ntohs(tcp->tcp_sport);
+	this->destinationPort = ntohs(tcp->tcp_dport);
+
+	this->valid = true;
+}
+
+bool PacketView::isValid() const
+{
+	return this->valid;
+}
+
+int PacketView::getLength() const
+{
+	return this->length;
+}
+
+int PacketView::getCaptureLength() const
+{
+	return this->captureLength;
+}
+
+int PacketView::getEthernetHeaderLength() const
+{
+	return this->ethernetHeaderLength;
+}
+
+int PacketView::getIPHeaderLength() const
+{
+	return this->ipHeaderLength;
+}
+
+int PacketView::getTCPHeaderLength() const
+{
+	return this->tcpHeaderLength;
+}
+
+int PacketView::getPayloadLength() const
+{
+	if(this->valid == false)
+	{
+		return 0;
+	}
+
+	return (this->ipTotalLength - this->ipHeaderLength - this->tcpHeaderLength);
+}
+
+const unsigned char* PacketView::getPayload() const
+{
+	int offset = this->ethernetHeaderLength + this->ipHeaderLength + this->tcpHeaderLength;
+
+	if((this->valid == false) || (offset >= this->captureLength))
+	{
+		return NULL;
+	}
+
+	return this->packet + offset;
+}
+
+uint32_t PacketView::getSourceAddress() const
+{
+	return this->sourceAddress;
+}
+
+uint32_t PacketView::getDestinationAddress() const
+{
+	return this->destinationAddress;
+}
+
+uint16_t PacketView::getSourcePort() const
+{
+	return this->sourcePort;
+}
+
+uint16_t PacketView::getDestinationPort() const
+{
+	return this->destinationPort;
+}
@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <stdint.h>
 
 /* Ethernet addresses are 6 bytes */
 #define ETHERNET_ADDR_LEN	6
@@ -19,6 +20,9 @@ struct hdr_ethernet
 
 #define ETHERNET_HEADER_LEN 14
 
+/* Snapshot length that still covers Ethernet + IP + TCP headers with options */
+#define PACKET_HEADER_SNAPLEN 96
+
 /* IP header */
 struct hdr_ip
 {
@@ -86,4 +90,46 @@ public:
 	unsigned char* getPayload() const; // unsafe
 };
 
+/*
+Non-owning view of a captured frame. The headers are parsed in place from the
+capture buffer, so the view is only valid inside the pcap callback that
+received it. Nothing is allocated or copied, and a frame whose headers do not
+fit in the captured bytes, or that is not an untagged IPv4 frame, is marked
+invalid instead of terminating the process.
+The payload length comes from the IP total length, so only the headers need to
+be captured (see PACKET_HEADER_SNAPLEN) and Ethernet padding is not counted.
+*/
+class PacketView
+{
+private:
+	const unsigned char* packet;
+	int captureLength;
+	int length;
+
+	int ethernetHeaderLength;
+	int ipHeaderLength;
+	int tcpHeaderLength;
+	int ipTotalLength;
+	uint32_t sourceAddress;
+	uint32_t destinationAddress;
+	uint16_t sourcePort;
+	uint16_t destinationPort;
+	bool valid;
+
+public:
+	PacketView(const unsigned char* p, int captureLength, int length);
+	bool isValid() const;
+	int getLength() const;
+	int getCaptureLength() const;
+	int getEthernetHeaderLength() const;
+	int getIPHeaderLength() const;
+	int getTCPHeaderLength() const;
+	int getPayloadLength() const;
+	const unsigned char* getPayload() const; // NULL if the payload was not captured
+	uint32_t getSourceAddress() const; // network byte order
+	uint32_t getDestinationAddress() const; // network byte order
+	uint16_t getSourcePort() const;
+	uint16_t getDestinationPort() const;
+};
+
 #endif /* PACKET_H_ */
@@ -0,0 +1,275 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include "PacketRing.h"
+
+using namespace std;
+
+PacketRing::PacketRing()
+{
+	this->fd = -1;
+	this->ring = NULL;
+	this->ringLength = 0;
+	this->blockSize = 0;
+	this->blockCount = 0;
+	this->currentBlock = 0;
+	this->skipOutgoing = true;
+}
+
+PacketRing::~PacketRing()
+{
+	this->close();
+}
+
+/*
+Opens the ring on device and attaches filter (filterLength instructions). Without
+a filter, frames are cut to snapLength. skipOutgoing leaves out the frames the
+host sends. Returns 0 on success and -1 on error.
+*/
+int PacketRing::open(const char* device, int snapLength, const struct sock_filter* filter, int filterLength, int blockSize, int blockCount, bool skipOutgoing)
+{
+	this->close();
+
+	unsigned int ifIndex = if_nametoindex(device);
+	if(ifIndex == 0)
+	{
+		fprintf(stderr, "[PacketRing::open] Unknown device %s.\n", device);
+		return -1;
+	}
+
+	// protocol 0 keeps the socket idle until bind(), after the filter and ring are in place
+	this->fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if(this->fd == -1)
+	{
+		fprintf(stderr, "[PacketRing::open] Error in creating packet socket: %s.\n", strerror(errno));
+		return -1;
+	}
+
+	int version = TPACKET_V3;
+	if(setsockopt(this->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+	{
+		fprintf(stderr, "[PacketRing::open] TPACKET_V3 is not supported: %s.\n", strerror(errno));
+		this->close();
+		return -1;
+	}
+
+	struct sock_filter snapFilter = {BPF_RET | BPF_K, 0, 0, (unsigned int)snapLength};
+	struct sock_fprog program;
+
+	if(filter != NULL)
+	{
+		program.len = filterLength;
+		program.filter = (struct sock_filter*)filter;
+	}
+	else
+	{
+		program.len = 1;
+		program.filter = &snapFilter;
+	}
+
+	if(setsockopt(this->fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == -1)
+	{
+		fprintf(stderr, "[PacketRing::open] Error in attaching filter: %s.\n", strerror(errno));
+		this->close();
+		return -1;
+	}
+
+	struct tpacket_req3 req;
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = blockSize;
+	req.tp_block_nr = blockCount;
+	req.tp_frame_size = PACKET_RING_FRAME_SIZE;
+	req.tp_frame_nr = ((size_t)blockSize * blockCount) / PACKET_RING_FRAME_SIZE;
+	req.tp_retire_blk_tov = PACKET_RING_BLOCK_TIMEOUT;
+
+	if(setsockopt(this->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+	{
+		fprintf(stderr, "[PacketRing::open] Error in setting up a ring of %d blocks of %d bytes: %s.\n", blockCount, blockSize, strerror(errno));
+		this->close();
+		return -1;
+	}
+
+	this->ringLength = (size_t)blockSize * blockCount;
+	void* address = mmap(NULL, this->ringLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, this->fd, 0);
+	if(address == MAP_FAILED)
+	{
+		// locking is only an optimization
+		address = mmap(NULL, this->ringLength, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+	}
+
+	if(address == MAP_FAILED)
+	{
+		fprintf(stderr, "[PacketRing::open] Error in mapping the ring: %s.\n", strerror(errno));
+		this->ringLength = 0;
+		this->close();
+		return -1;
+	}
+
+	this->ring = (unsigned char*)address;
+	this->blockSize = blockSize;
+	this->blockCount = blockCount;
+	this->currentBlock = 0;
+	this->skipOutgoing = skipOutgoing;
+
+	struct sockaddr_ll address_ll;
+	memset(&address_ll, 0, sizeof(address_ll));
+	address_ll.sll_family = AF_PACKET;
+	address_ll.sll_protocol = htons(ETH_P_ALL);
+	address_ll.sll_ifindex = ifIndex;
+
+	if(bind(this->fd, (struct sockaddr*)&address_ll, sizeof(address_ll)) == -1)
+	{
+		fprintf(stderr, "[PacketRing::open] Error in binding to device %s: %s.\n", device, strerror(errno));
+		this->close();
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+Replaces the filter of the open ring; the kernel swaps it atomically, so this
+may be called while another thread dispatches. Returns 0 on success and -1 on
+error.
+*/
+int PacketRing::setFilter(const struct sock_filter* filter, int filterLength)
+{
+	struct sock_fprog program;
+	program.len = filterLength;
+	program.filter = (struct sock_filter*)filter;
+
+	if(setsockopt(this->fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == -1)
+	{
+		fprintf(stderr, "[PacketRing::setFilter] Error in attaching filter: %s.\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Returns the packet socket, for poll() along with other descriptors, or -1 when the ring is not open. */
+int PacketRing::getDescriptor() const
+{
+	return this->fd;
+}
+
+/*
+Waits up to timeout milliseconds for a block, then passes every frame of every
+ready block to handler, but the sent ones with skipOutgoing, and returns the
+blocks to the kernel. Returns the number of frames handled, or -1 on error.
+*/
+int PacketRing::dispatch(PacketRingHandler handler, void* arg, int timeout)
+{
+	if(this->ring == NULL)
+	{
+		fprintf(stderr, "[PacketRing::dispatch] The ring is not open.\n");
+		return -1;
+	}
+
+	struct tpacket_block_desc* block = (struct tpacket_block_desc*)(this->ring + (size_t)this->currentBlock * this->blockSize);
+
+	if((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+	{
+		struct pollfd pfd;
+		pfd.fd = this->fd;
+		pfd.events = POLLIN | POLLERR;
+		pfd.revents = 0;
+
+		if(poll(&pfd, 1, timeout) == -1)
+		{
+			if(errno == EINTR)
+			{
+				return 0;
+			}
+
+			fprintf(stderr, "[PacketRing::dispatch] Error in poll: %s.\n", strerror(errno));
+			return -1;
+		}
+	}
+
+	int frameCount = 0;
+
+	for(int b = 0; b < this->blockCount; b++)
+	{
+		if((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+		{
+			break;
+		}
+
+		unsigned int packetCount = block->hdr.bh1.num_pkts;
+		struct tpacket3_hdr* header = (struct tpacket3_hdr*)((unsigned char*)block + block->hdr.bh1.offset_to_first_pkt);
+
+		for(unsigned int i = 0; i < packetCount; i++)
+		{
+			// The link-level address follows the frame header
+			const struct sockaddr_ll* link = (const struct sockaddr_ll*)((unsigned char*)header + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+			if((this->skipOutgoing == false) || (link->sll_pkttype != PACKET_OUTGOING))
+			{
+				struct timeval ts;
+				ts.tv_sec = header->tp_sec;
+				ts.tv_usec = header->tp_nsec / 1000;
+
+				handler(arg, &ts, (unsigned char*)header + header->tp_mac, header->tp_snaplen, header->tp_len);
+				++frameCount;
+			}
+
+			header = (struct tpacket3_hdr*)((unsigned char*)header + header->tp_next_offset);
+		}
+
+		__atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+		this->currentBlock = (this->currentBlock + 1) % this->blockCount;
+		block = (struct tpacket_block_desc*)(this->ring + (size_t)this->currentBlock * this->blockSize);
+	}
+
+	return frameCount;
+}
+
+/*
+Stores the frames seen (drops included, as with pcap_stats) and the frames
+dropped by the kernel since the previous call.
+Returns 0 on success and -1 on error.
+*/
+int PacketRing::getStatistics(unsigned int* packets, unsigned int* drops)
+{
+	struct tpacket_stats_v3 stats;
+	socklen_t length = sizeof(stats);
+
+	if(getsockopt(this->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &length) == -1)
+	{
+		fprintf(stderr, "[PacketRing::getStatistics] Error in reading statistics: %s.\n", strerror(errno));
+		return -1;
+	}
+
+	*packets = stats.tp_packets;
+	*drops = stats.tp_drops;
+
+	return 0;
+}
+
+void PacketRing::close()
+{
+	if(this->ring != NULL)
+	{
+		munmap(this->ring, this->ringLength);
+		this->ring = NULL;
+		this->ringLength = 0;
+	}
+
+	if(this->fd != -1)
+	{
+		::close(this->fd);
+		this->fd = -1;
+	}
+}
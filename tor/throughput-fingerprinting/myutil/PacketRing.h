@@ -0,0 +1,49 @@
+#ifndef PACKETRING_H_
+#define PACKETRING_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <linux/filter.h>
+
+#define PACKET_RING_DEFAULT_BLOCK_SIZE	(1 << 20)	// in bytes, a multiple of the page size
+#define PACKET_RING_DEFAULT_BLOCK_COUNT	64
+#define PACKET_RING_FRAME_SIZE			2048
+#define PACKET_RING_BLOCK_TIMEOUT		100			// in milliseconds, before a partly filled block is handed over
+
+typedef void (*PacketRingHandler)(void* arg, const struct timeval* ts, const unsigned char* frame, int captureLength, int length);
+
+/*
+Capture socket backed by an AF_PACKET TPACKET_V3 ring. The kernel fills whole
+blocks of frames in shared memory and hands a block over when it is full or
+PACKET_RING_BLOCK_TIMEOUT has passed, so one wakeup serves every frame in the
+block with no copy or system call per packet. The classic BPF program attached
+to the socket does the filtering in the kernel; its return value is the
+snapshot length, as with libpcap. With skipOutgoing, frames the host sends
+are not handed over; on loopback every packet is also seen as received, and
+libpcap drops the sent copy the same way.
+*/
+class PacketRing
+{
+private:
+	int fd;
+	unsigned char* ring;
+	size_t ringLength;
+	int blockSize;
+	int blockCount;
+	int currentBlock;
+	bool skipOutgoing;
+
+public:
+	PacketRing();
+	~PacketRing();
+
+	int open(const char* device, int snapLength, const struct sock_filter* filter, int filterLength, int blockSize, int blockCount, bool skipOutgoing = true);
+	int setFilter(const struct sock_filter* filter, int filterLength);
+	int getDescriptor() const;
+	int dispatch(PacketRingHandler handler, void* arg, int timeout);
+	int getStatistics(unsigned int* packets, unsigned int* drops);
+	void close();
+};
+
+#endif /* PACKETRING_H_ */
@@ -5,15 +5,23 @@
 #include <cstring>
 #include <string>
 #include "StringTokenizer.h"
+#include "correlation.h"
 #include "R.h"
 
 using namespace std;
 
+/* Computes Pearson's correlation coefficient in-process (see correlation.cpp). */
 double calculateCorrelation(const double* x, const double* y, int n)
+{
+	return pearsonCorrelation(x, y, n);
+}
+
+/* Computes Pearson's correlation coefficient by running R; kept for cross-checking the native kernel. */
+double calculateCorrelationR(const double* x, const double* y, int n)
 {
 	if(n < 2)
 	{
-		fprintf(stderr, "[calculateCorrelation] Insufficient data. Number of elements at each data set must be >= 2.\n");
+		fprintf(stderr, "[calculateCorrelationR] Insufficient data. Number of elements at each data set must be >= 2.\n");
 		return -2.0;
 	}
 
@@ -39,7 +47,7 @@ double calculateCorrelation(const double* x, const double* y, int n)
 	int fd = mkstemp(inputFileName);
 	if (fd == -1)
 	{
-		fprintf(stderr, "[calculateCorrelation] Error in creating temporary input file %s.\n", inputFileName);
+		fprintf(stderr, "[calculateCorrelationR] Error in creating temporary input file %s.\n", inputFileName);
 		return -2.0;
 	}
 
@@ -48,7 +56,7 @@ double calculateCorrelation(const double* x, const double* y, int n)
 	FILE* fpRin = fopen(inputFileName, "w");
 	if(fpRin == NULL)
 	{
-		fprintf(stderr, "[calculateCorrelation] Error in accessing temporary input file %s.\n", inputFileName);
+		fprintf(stderr, "[calculateCorrelationR] Error in accessing temporary input file %s.\n", inputFileName);
 		unlink(inputFileName);
 		return -2.0;
 	}
@@ -70,7 +78,7 @@ double calculateCorrelation(const double* x, const double* y, int n)
 	int res = system(strCommand.c_str());
 	if(res == -1)
 	{
-		fprintf(stderr, "[calculateCorrelation] Error in executing command %s.\n", strCommand.c_str());
+		fprintf(stderr, "[calculateCorrelationR] Error in executing command %s.\n", strCommand.c_str());
 		unlink(inputFileName);
 		unlink(strOutputFileName.c_str());
 		return -2.0;
@@ -79,7 +87,7 @@ double calculateCorrelation(const double* x, const double* y, int n)
 	FILE* fpRout = fopen(strOutputFileName.c_str(), "r");
 	if(fpRout == NULL)
 	{
-		fprintf(stderr, "[calculateCorrelation] Cannot open output file %s.\n", strOutputFileName.c_str());
+		fprintf(stderr, "[calculateCorrelationR] Cannot open output file %s.\n", strOutputFileName.c_str());
 		unlink(inputFileName);
 		unlink(strOutputFileName.c_str());
 		return -2.0;
@@ -104,19 +112,19 @@ double calculateCorrelation(const double* x, const double* y, int n)
 		{
 			if(feof(fpRout) != 0)
 			{
-				fprintf(stderr, "[calculateCorrelation] Incomplete data at output file %s.\n", strOutputFileName.c_str());
+				fprintf(stderr, "[calculateCorrelationR] Incomplete data at output file %s.\n", strOutputFileName.c_str());
 				corrVal = -2.0;
 				break;
 			}
 			else if(ferror(fpRout) != 0)
 			{
-				fprintf(stderr, "[calculateCorrelation] Error in reading output file %s.\n", strOutputFileName.c_str());
+				fprintf(stderr, "[calculateCorrelationR] Error in reading output file %s.\n", strOutputFileName.c_str());
 				corrVal = -2.0;
 				break;
 			}
 			else
 			{
-				fprintf(stderr, "[calculateCorrelation] Unknown error in reading output file %s.\n", strOutputFileName.c_str());
+				fprintf(stderr, "[calculateCorrelationR] Unknown error in reading output file %s.\n", strOutputFileName.c_str());
 				corrVal = -2.0;
 				break;
 			}
@@ -125,7 +133,7 @@ double calculateCorrelation(const double* x, const double* y, int n)
 		StringTokenizer st(buffer, " \r\n");
 		if(st.countTokens() != 2)
 		{
-			fprintf(stderr, "[calculateCorrelation] Unsupported format in output file %s.\n", strOutputFileName.c_str());
+			fprintf(stderr, "[calculateCorrelationR] Unsupported format in output file %s.\n", strOutputFileName.c_str());
 			corrVal = -2.0;
 			break;
 		}
@@ -7,5 +7,6 @@
 #define MAX_BUFFER_SIZE 4096
 
 double calculateCorrelation(const double* x, const double* y, int n);
+double calculateCorrelationR(const double* x, const double* y, int n);
 
 #endif /* R_H_ */
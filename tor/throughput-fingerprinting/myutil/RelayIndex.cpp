@@ -0,0 +1,337 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <cmath>
+#include "correlation.h"
+#include "dtw.h"
+#include "trace.h"
+#include "RelayIndex.h"
+
+using namespace std;
+
+struct BoundOrder
+{
+	bool operator()(const pair<double, int>& a, const pair<double, int>& b) const
+	{
+		return a.first > b.first;
+	}
+};
+
+struct MatchOrder
+{
+	bool operator()(const RelayMatch& a, const RelayMatch& b) const
+	{
+		return a.correlation > b.correlation;
+	}
+};
+
+struct DistanceOrder
+{
+	bool operator()(const RelayMatch& a, const RelayMatch& b) const
+	{
+		return a.distance < b.distance;
+	}
+};
+
+RelayIndex::RelayIndex(int seriesLength, int segmentCount)
+{
+	this->seriesLength = (seriesLength > 2) ? seriesLength : 2;
+	this->segmentCount = (segmentCount > 0) ? segmentCount : 1;
+
+	if(this->segmentCount > this->seriesLength)
+	{
+		this->segmentCount = this->seriesLength;
+	}
+
+	// trailing samples that do not fill a segment are left out of the bound, which keeps it a lower bound
+	this->segmentLength = this->seriesLength / this->segmentCount;
+}
+
+void RelayIndex::computePAA(const double* normalized, double* out) const
+{
+	for(int s = 0; s < this->segmentCount; s++)
+	{
+		const double* v = normalized + s * this->segmentLength;
+		double sum = 0;
+
+		for(int i = 0; i < this->segmentLength; i++)
+		{
+			sum += v[i];
+		}
+
+		out[s] = sum / this->segmentLength;
+	}
+}
+
+/* Adds the first seriesLength values of a relay's series. Returns the relay ID, or -1 if the series is too short or constant. */
+int RelayIndex::add(const string& name, const string& fingerprint, const double* values, int n)
+{
+	if(n < this->seriesLength)
+	{
+		return -1;
+	}
+
+	size_t offset = this->series.size();
+	this->series.resize(offset + this->seriesLength);
+
+	if(zNormalize(values, this->seriesLength, &this->series[offset], this->seriesLength) == false)
+	{
+		this->series.resize(offset);
+		return -1;
+	}
+
+	size_t paaOffset = this->paa.size();
+	this->paa.resize(paaOffset + this->segmentCount);
+	this->computePAA(&this->series[offset], &this->paa[paaOffset]);
+
+	this->names.push_back(name);
+	this->fingerprints.push_back(fingerprint);
+
+	return this->names.size() - 1;
+}
+
+/* Adds the throughput series of every relay in a tor-node-throughput-calc output file. Returns the number of relays added, or -1 on error. */
+int RelayIndex::load(const string& fileName)
+{
+	vector<RelayTrace> traces;
+
+	if(readRelayTraceFile(fileName, traces) == -1)
+	{
+		return -1;
+	}
+
+	int count = 0;
+	vector<double> values;
+
+	for(unsigned int i = 0; i < traces.size(); i++)
+	{
+		values.resize(traces[i].samples.size());
+
+		for(unsigned int j = 0; j < values.size(); j++)
+		{
+			values[j] = traces[i].samples[j].throughput;
+		}
+
+		if((values.size() > 0) && (this->add(traces[i].middleman, traces[i].fingerprint, &values[0], values.size()) != -1))
+		{
+			++count;
+		}
+	}
+
+	return count;
+}
+
+int RelayIndex::getRelayCount() const
+{
+	return this->names.size();
+}
+
+int RelayIndex::getSeriesLength() const
+{
+	return this->seriesLength;
+}
+
+const string& RelayIndex::getName(int relay) const
+{
+	return this->names[relay];
+}
+
+const string& RelayIndex::getFingerprint(int relay) const
+{
+	return this->fingerprints[relay];
+}
+
+const double* RelayIndex::getSeries(int relay) const
+{
+	return &this->series[(size_t)relay * this->seriesLength];
+}
+
+/* Upper bound on the correlation between the query (given by its PAA) and a relay. */
+double RelayIndex::getUpperBound(const double* queryPAA, int relay) const
+{
+	const double* p = &this->paa[(size_t)relay * this->segmentCount];
+	double d = 0;
+
+	for(int s = 0; s < this->segmentCount; s++)
+	{
+		double diff = queryPAA[s] - p[s];
+		d += diff * diff;
+	}
+
+	return 1.0 - (this->segmentLength * d) / 2.0;
+}
+
+/*
+Finds the k relays whose series correlate best with the first seriesLength
+values of the query and stores them in matches, best first. Returns the
+number of relays whose exact correlation had to be computed, or -1 if the
+query is too short or constant.
+*/
+int RelayIndex::query(const double* values, int n, int k, vector<RelayMatch>& matches) const
+{
+	matches.clear();
+
+	if(n < this->seriesLength)
+	{
+		fprintf(stderr, "[RelayIndex::query] Query has %d samples; the index needs at least %d.\n", n, this->seriesLength);
+		return -1;
+	}
+
+	vector<double> q(this->seriesLength);
+	if(zNormalize(values, this->seriesLength, &q[0], this->seriesLength) == false)
+	{
+		fprintf(stderr, "[RelayIndex::query] The standard deviation of the query is zero.\n");
+		return -1;
+	}
+
+	vector<double> qPAA(this->segmentCount);
+	this->computePAA(&q[0], &qPAA[0]);
+
+	int relayCount = this->getRelayCount();
+	vector< pair<double, int> > candidates(relayCount);
+
+	for(int r = 0; r < relayCount; r++)
+	{
+		candidates[r] = make_pair(this->getUpperBound(&qPAA[0], r), r);
+	}
+
+	sort(candidates.begin(), candidates.end(), BoundOrder());
+
+	priority_queue<RelayMatch, vector<RelayMatch>, MatchOrder> best; // worst of the current top k on top
+	int scored = 0;
+
+	for(int i = 0; (i < relayCount) && (k > 0); i++)
+	{
+		if(((int)best.size() == k) && (candidates[i].first <= best.top().correlation))
+		{
+			break; // no remaining relay can make it into the top k
+		}
+
+		RelayMatch m;
+		m.relay = candidates[i].second;
+		m.correlation = dotProduct(&q[0], this->getSeries(m.relay), this->seriesLength);
+		m.distance = sqrt((m.correlation < 1.0) ? (2.0 - 2.0 * m.correlation) : 0.0);
+		++scored;
+
+		if((int)best.size() < k)
+		{
+			best.push(m);
+		}
+		else if(m.correlation > best.top().correlation)
+		{
+			best.pop();
+			best.push(m);
+		}
+	}
+
+	while(best.empty() == false)
+	{
+		matches.push_back(best.top());
+		best.pop();
+	}
+
+	reverse(matches.begin(), matches.end());
+
+	return scored;
+}
+
+/*
+Finds the k relays with the smallest DTW distance (Sakoe-Chiba band of
++/- window samples) to the first seriesLength values of the query. Relays are
+visited in order of their correlation bound so that good matches tighten the
+pruning threshold early; LB_Keogh rules out most of the rest before any DTW
+is computed, and the DTW itself is abandoned early. Returns the number of
+relays whose DTW computation was started, or -1 on error.
+*/
+int RelayIndex::queryDTW(const double* values, int n, int k, int window, vector<RelayMatch>& matches) const
+{
+	matches.clear();
+
+	if(n < this->seriesLength)
+	{
+		fprintf(stderr, "[RelayIndex::queryDTW] Query has %d samples; the index needs at least %d.\n", n, this->seriesLength);
+		return -1;
+	}
+
+	int length = this->seriesLength;
+
+	vector<double> q(length);
+	if(zNormalize(values, length, &q[0], length) == false)
+	{
+		fprintf(stderr, "[RelayIndex::queryDTW] The standard deviation of the query is zero.\n");
+		return -1;
+	}
+
+	vector<double> qPAA(this->segmentCount);
+	this->computePAA(&q[0], &qPAA[0]);
+
+	vector<double> lower(length), upper(length);
+	computeEnvelope(&q[0], length, window, &lower[0], &upper[0]);
+
+	int relayCount = this->getRelayCount();
+	vector< pair<double, int> > candidates(relayCount);
+
+	for(int r = 0; r < relayCount; r++)
+	{
+		candidates[r] = make_pair(this->getUpperBound(&qPAA[0], r), r);
+	}
+
+	sort(candidates.begin(), candidates.end(), BoundOrder());
+
+	priority_queue<RelayMatch, vector<RelayMatch>, DistanceOrder> best; // worst of the current top k on top
+	vector<double> contribution(length), cumulativeBound(length + 1);
+	int scored = 0;
+
+	for(int i = 0; (i < relayCount) && (k > 0); i++)
+	{
+		const double* c = this->getSeries(candidates[i].second);
+		double bestSoFar = DTW_INFINITY;
+
+		if((int)best.size() == k)
+		{
+			bestSoFar = best.top().distance * best.top().distance;
+		}
+
+		if(lbKeogh(c, &lower[0], &upper[0], length, bestSoFar, &contribution[0]) >= bestSoFar)
+		{
+			continue;
+		}
+
+		cumulateBound(&contribution[0], length, &cumulativeBound[0]);
+
+		double d = dtwDistance(&q[0], c, length, window, bestSoFar, &cumulativeBound[0]);
+		++scored;
+
+		if(d >= bestSoFar)
+		{
+			continue;
+		}
+
+		RelayMatch m;
+		m.relay = candidates[i].second;
+		m.correlation = dotProduct(&q[0], c, length);
+		m.distance = sqrt(d);
+
+		if((int)best.size() == k)
+		{
+			best.pop();
+		}
+
+		best.push(m);
+	}
+
+	while(best.empty() == false)
+	{
+		matches.push_back(best.top());
+		best.pop();
+	}
+
+	reverse(matches.begin(), matches.end());
+
+	return scored;
+}
@@ -0,0 +1,59 @@
+#ifndef RELAYINDEX_H_
+#define RELAYINDEX_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define RELAY_INDEX_DEFAULT_SEGMENT_COUNT 32
+
+struct RelayMatch
+{
+	int relay;
+	double correlation;
+	double distance;	// Euclidean distance, or DTW distance for queryDTW(), between the normalized series
+};
+
+/*
+In-memory index of relay throughput series for top-K correlation search.
+Every series is cut to a common length and z-normalized to unit norm, so
+that for two indexed vectors ||a - b||^2 = 2 - 2r. A piecewise aggregate
+approximation (PAA, the segment means) of each vector gives a cheap lower
+bound on that distance and hence an upper bound on r; queries visit relays
+in order of decreasing bound and stop as soon as no remaining bound can
+beat the current K-th best correlation. queryDTW() ranks by dynamic time
+warping distance instead, which tolerates drift and stretching between the
+client and relay traces.
+*/
+class RelayIndex
+{
+private:
+	int seriesLength;
+	int segmentCount;
+	int segmentLength;
+
+	vector<string> names;
+	vector<string> fingerprints;
+	vector<double> series;	// seriesLength normalized values per relay
+	vector<double> paa;		// segmentCount segment means per relay
+
+	void computePAA(const double* normalized, double* out) const;
+
+public:
+	RelayIndex(int seriesLength, int segmentCount);
+	int add(const string& name, const string& fingerprint, const double* values, int n);
+	int load(const string& fileName);
+	int getRelayCount() const;
+	int getSeriesLength() const;
+	const string& getName(int relay) const;
+	const string& getFingerprint(int relay) const;
+	const double* getSeries(int relay) const;
+	double getUpperBound(const double* queryPAA, int relay) const;
+	int query(const double* values, int n, int k, vector<RelayMatch>& matches) const;
+	int queryDTW(const double* values, int n, int k, int window, vector<RelayMatch>& matches) const;
+};
+
+#endif /* RELAYINDEX_H_ */
@@ -0,0 +1,448 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include "RelayTable.h"
+
+using namespace std;
+
+#define RELAY_MAX_FIELDS 10
+
+struct RelayFlagName
+{
+	const char* name;
+	uint32_t flag;
+};
+
+static const RelayFlagName relayFlagNames[] = {
+	{"Authority", RELAY_FLAG_AUTHORITY},
+	{"BadExit", RELAY_FLAG_BADEXIT},
+	{"Exit", RELAY_FLAG_EXIT},
+	{"Fast", RELAY_FLAG_FAST},
+	{"Guard", RELAY_FLAG_GUARD},
+	{"HSDir", RELAY_FLAG_HSDIR},
+	{"Running", RELAY_FLAG_RUNNING},
+	{"Stable", RELAY_FLAG_STABLE},
+	{"V2Dir", RELAY_FLAG_V2DIR},
+	{"Valid", RELAY_FLAG_VALID}
+};
+
+/*
+Splits the line [line, end) at spaces. Stores the first maxFields fields and
+returns the number of fields in the line.
+*/
+static int splitFields(const char* line, const char* end, const char** fields, size_t* lengths, int maxFields)
+{
+	int count = 0;
+
+	while(line < end)
+	{
+		if(*line == ' ')
+		{
+			++line;
+			continue;
+		}
+
+		const char* start = line;
+		while((line < end) && (*line != ' '))
+		{
+			++line;
+		}
+
+		if(count < maxFields)
+		{
+			fields[count] = start;
+			lengths[count] = line - start;
+		}
+		++count;
+	}
+
+	return count;
+}
+
+/* Copies a field of length characters into a zero-terminated buffer of size bytes. Returns false when it does not fit. */
+static bool copyField(char* buffer, size_t size, const char* field, size_t length)
+{
+	if(length >= size)
+	{
+		return false;
+	}
+
+	memcpy(buffer, field, length);
+	buffer[length] = '\0';
+
+	return true;
+}
+
+/* Parses a field of decimal digits. Returns false when the field is empty, has another character or exceeds max. */
+static bool parseNumber(const char* field, size_t length, uint32_t max, uint32_t* value)
+{
+	uint64_t result = 0;
+
+	if(length == 0)
+	{
+		return false;
+	}
+
+	for(size_t i = 0; i < length; i++)
+	{
+		if((field[i] < '0') || (field[i] > '9'))
+		{
+			return false;
+		}
+
+		result = result * 10 + (field[i] - '0');
+		if(result > max)
+		{
+			return false;
+		}
+	}
+
+	*value = (uint32_t)result;
+
+	return true;
+}
+
+/* Parses a dotted IPv4 address into network byte order. */
+static bool parseAddress(const char* field, size_t length, uint32_t* address)
+{
+	char buffer[INET_ADDRSTRLEN];
+	struct in_addr addr;
+
+	if((copyField(buffer, sizeof(buffer), field, length) == false) || (inet_pton(AF_INET, buffer, &addr) != 1))
+	{
+		return false;
+	}
+
+	*address = addr.s_addr;
+
+	return true;
+}
+
+/*
+Decodes the unpadded base64 identity of a router status line, 20 bytes in 27
+characters, into "$" and 40 upper-case hex digits.
+*/
+static bool decodeIdentity(const char* field, size_t length, char* fingerprint)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	unsigned char digest[21];
+	uint32_t bits = 0;
+	int bitCount = 0;
+	int byteCount = 0;
+
+	if((length == 28) && (field[27] == '='))
+	{
+		length = 27;
+	}
+
+	if(length != 27)
+	{
+		return false;
+	}
+
+	for(size_t i = 0; i < length; i++)
+	{
+		char c = field[i];
+		uint32_t v;
+
+		if((c >= 'A') && (c <= 'Z'))
+		{
+			v = c - 'A';
+		}
+		else if((c >= 'a') && (c <= 'z'))
+		{
+			v = c - 'a' + 26;
+		}
+		else if((c >= '0') && (c <= '9'))
+		{
+			v = c - '0' + 52;
+		}
+		else if(c == '+')
+		{
+			v = 62;
+		}
+		else if(c == '/')
+		{
+			v = 63;
+		}
+		else
+		{
+			return false;
+		}
+
+		bits = (bits << 6) | v;
+		bitCount += 6;
+		if(bitCount >= 8)
+		{
+			bitCount -= 8;
+			digest[byteCount++] = (unsigned char)(bits >> bitCount);
+		}
+	}
+
+	fingerprint[0] = '$';
+	for(int i = 0; i < 20; i++)
+	{
+		fingerprint[1 + 2 * i] = hex[digest[i] >> 4];
+		fingerprint[2 + 2 * i] = hex[digest[i] & 0x0f];
+	}
+	fingerprint[41] = '\0';
+
+	return true;
+}
+
+/*
+Maps fileName and replaces the table with its relays. Returns the number of
+relays, or -1 on error.
+*/
+int RelayTable::load(const char* fileName)
+{
+	this->clear();
+
+	int fd = open(fileName, O_RDONLY);
+	if(fd == -1)
+	{
+		fprintf(stderr, "[RelayTable::load] Cannot open file %s for input: %s.\n", fileName, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) == -1)
+	{
+		fprintf(stderr, "[RelayTable::load] Cannot read the size of file %s: %s.\n", fileName, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if(st.st_size == 0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	void* address = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(address == MAP_FAILED)
+	{
+		fprintf(stderr, "[RelayTable::load] Error in mapping file %s: %s.\n", fileName, strerror(errno));
+		return -1;
+	}
+
+	// The file is read once from start to end
+	madvise(address, st.st_size, MADV_SEQUENTIAL);
+
+	const char* data = (const char*)address;
+	size_t length = st.st_size;
+	int res;
+
+	if((length >= 23) && (memcmp(data, "network-status-version ", 23) == 0))
+	{
+		res = this->parseConsensus(data, length, fileName);
+	}
+	else
+	{
+		res = this->parseNodeInfo(data, length, fileName);
+	}
+
+	munmap(address, st.st_size);
+
+	if(res == -1)
+	{
+		this->clear();
+	}
+
+	return res;
+}
+
+/*
+Reads the "r", "s" and "w" lines of every router status entry. The "r" line of
+the full flavor has a descriptor digest after the identity, the one of the
+microdescriptor flavor does not; both end with the IP address, ORPort and DirPort.
+*/
+int RelayTable::parseConsensus(const char* data, size_t length, const char* fileName)
+{
+	const char* end = data + length;
+	const char* fields[RELAY_MAX_FIELDS];
+	size_t lengths[RELAY_MAX_FIELDS];
+	bool inEntry = false;	// the "s" and "w" lines belong to the last "r" line
+	int lineNumber = 0;
+
+	// A consensus lists a relay every 300 or so bytes
+	this->relays.reserve(length / 256);
+
+	while(data < end)
+	{
+		const char* lineEnd = (const char*)memchr(data, '\n', end - data);
+		if(lineEnd == NULL)
+		{
+			lineEnd = end;
+		}
+
+		const char* line = data;
+		data = lineEnd + 1;
+		++lineNumber;
+
+		if((lineEnd > line) && (lineEnd[-1] == '\r'))
+		{
+			--lineEnd;
+		}
+
+		if((lineEnd - line < 2) || (line[1] != ' '))
+		{
+			// Signatures follow the footer
+			if((lineEnd - line >= 16) && (memcmp(line, "directory-footer", 16) == 0))
+			{
+				break;
+			}
+
+			continue;
+		}
+
+		if(line[0] == 'r')
+		{
+			int count = splitFields(line, lineEnd, fields, lengths, RELAY_MAX_FIELDS);
+			if((count != 8) && (count != 9))
+			{
+				fprintf(stderr, "[RelayTable::parseConsensus] Malformed router status at line %d of file %s.\n", lineNumber, fileName);
+				return -1;
+			}
+
+			RelayEntry relay;
+			memset(&relay, 0, sizeof(relay));
+			uint32_t orPort;
+			uint32_t dirPort;
+
+			int a = count - 3; // IP address, then ORPort and DirPort
+			if((copyField(relay.nickname, sizeof(relay.nickname), fields[1], lengths[1]) == false)
+					|| (decodeIdentity(fields[2], lengths[2], relay.fingerprint) == false)
+					|| (parseAddress(fields[a], lengths[a], &relay.address) == false)
+					|| (parseNumber(fields[a + 1], lengths[a + 1], 65535, &orPort) == false)
+					|| (parseNumber(fields[a + 2], lengths[a + 2], 65535, &dirPort) == false))
+			{
+				fprintf(stderr, "[RelayTable::parseConsensus] Malformed router status at line %d of file %s.\n", lineNumber, fileName);
+				return -1;
+			}
+
+			relay.orPort = (uint16_t)orPort;
+			relay.dirPort = (uint16_t)dirPort;
+			this->relays.push_back(relay);
+			inEntry = true;
+		}
+		else if((line[0] == 's') && (inEntry == true))
+		{
+			RelayEntry& relay = this->relays.back();
+
+			const char* p = line + 2;
+			while(p < lineEnd)
+			{
+				const char* flagEnd = (const char*)memchr(p, ' ', lineEnd - p);
+				if(flagEnd == NULL)
+				{
+					flagEnd = lineEnd;
+				}
+
+				for(unsigned int i = 0; i < sizeof(relayFlagNames) / sizeof(relayFlagNames[0]); i++)
+				{
+					size_t nameLength = strlen(relayFlagNames[i].name);
+					if((nameLength == (size_t)(flagEnd - p)) && (memcmp(p, relayFlagNames[i].name, nameLength) == 0))
+					{
+						relay.flags |= relayFlagNames[i].flag;
+						break;
+					}
+				}
+
+				p = flagEnd + 1;
+			}
+		}
+		else if((line[0] == 'w') && (inEntry == true))
+		{
+			int count = splitFields(line, lineEnd, fields, lengths, RELAY_MAX_FIELDS);
+			for(int i = 1; (i < count) && (i < RELAY_MAX_FIELDS); i++)
+			{
+				if((lengths[i] > 10) && (memcmp(fields[i], "Bandwidth=", 10) == 0))
+				{
+					parseNumber(fields[i] + 10, lengths[i] - 10, 0xffffffff, &this->relays.back().bandwidth);
+				}
+			}
+		}
+	}
+
+	return this->relays.size();
+}
+
+/* Reads a node info file, skipping empty lines. */
+int RelayTable::parseNodeInfo(const char* data, size_t length, const char* fileName)
+{
+	const char* end = data + length;
+	const char* fields[RELAY_MAX_FIELDS];
+	size_t lengths[RELAY_MAX_FIELDS];
+	int lineNumber = 0;
+
+	while(data < end)
+	{
+		const char* lineEnd = (const char*)memchr(data, '\n', end - data);
+		if(lineEnd == NULL)
+		{
+			lineEnd = end;
+		}
+
+		const char* line = data;
+		data = lineEnd + 1;
+		++lineNumber;
+
+		if((lineEnd > line) && (lineEnd[-1] == '\r'))
+		{
+			--lineEnd;
+		}
+
+		int count = splitFields(line, lineEnd, fields, lengths, RELAY_MAX_FIELDS);
+		if(count == 0)
+		{
+			continue;
+		}
+
+		RelayEntry relay;
+		memset(&relay, 0, sizeof(relay));
+		uint32_t orPort;
+		uint32_t dirPort;
+
+		if((count < 9)
+				|| (copyField(relay.nickname, sizeof(relay.nickname), fields[0], lengths[0]) == false)
+				|| (parseAddress(fields[1], lengths[1], &relay.address) == false)
+				|| (parseNumber(fields[2], lengths[2], 65535, &orPort) == false)
+				|| (parseNumber(fields[4], lengths[4], 65535, &dirPort) == false)
+				|| (copyField(relay.fingerprint, sizeof(relay.fingerprint), fields[5], lengths[5]) == false))
+		{
+			fprintf(stderr, "[RelayTable::parseNodeInfo] Unknown data format at line %d of file %s.\n", lineNumber, fileName);
+			return -1;
+		}
+
+		relay.orPort = (uint16_t)orPort;
+		relay.dirPort = (uint16_t)dirPort;
+		relay.flags = RELAY_FLAG_RUNNING | RELAY_FLAG_VALID;
+		this->relays.push_back(relay);
+	}
+
+	return this->relays.size();
+}
+
+int RelayTable::getRelayCount() const
+{
+	return (int)this->relays.size();
+}
+
+const RelayEntry& RelayTable::getRelay(int relay) const
+{
+	return this->relays[relay];
+}
+
+void RelayTable::clear()
+{
+	this->relays.clear();
+}
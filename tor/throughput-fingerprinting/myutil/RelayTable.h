@@ -0,0 +1,60 @@
+#ifndef RELAYTABLE_H_
+#define RELAYTABLE_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+#define RELAY_NICKNAME_LENGTH		20	// 19 characters and the terminating zero
+#define RELAY_FINGERPRINT_LENGTH	42	// "$", 40 hex digits and the terminating zero
+
+#define RELAY_FLAG_AUTHORITY	0x0001
+#define RELAY_FLAG_BADEXIT		0x0002
+#define RELAY_FLAG_EXIT			0x0004
+#define RELAY_FLAG_FAST			0x0008
+#define RELAY_FLAG_GUARD		0x0010
+#define RELAY_FLAG_HSDIR		0x0020
+#define RELAY_FLAG_RUNNING		0x0040
+#define RELAY_FLAG_STABLE		0x0080
+#define RELAY_FLAG_V2DIR		0x0100
+#define RELAY_FLAG_VALID		0x0200
+
+/* One relay, in a fixed-size record so that the table is one contiguous array */
+struct RelayEntry
+{
+	uint32_t address;		// IPv4, network byte order
+	uint16_t orPort;
+	uint16_t dirPort;
+	uint32_t flags;			// RELAY_FLAG_*
+	uint32_t bandwidth;		// consensus weight ("w Bandwidth="), 0 when unknown
+	char nickname[RELAY_NICKNAME_LENGTH];
+	char fingerprint[RELAY_FINGERPRINT_LENGTH];
+};
+
+/*
+The relays to probe, read in one pass over a memory-mapped file. The file is
+either a Tor network status consensus, full or microdescriptor flavored (Tor's
+cached-consensus or cached-microdesc-consensus), or a node info file with one
+"<nickname> <IP address> <ORPort> <SOCKSPort> <DirPort> <fingerprint> ..." line
+of at least 9 fields per relay. Relays of a node info file are taken to be
+Running and Valid and have no bandwidth.
+*/
+class RelayTable
+{
+private:
+	vector<RelayEntry> relays;
+
+	int parseConsensus(const char* data, size_t length, const char* fileName);
+	int parseNodeInfo(const char* data, size_t length, const char* fileName);
+
+public:
+	int load(const char* fileName);
+	int getRelayCount() const;
+	const RelayEntry& getRelay(int relay) const;
+	void clear();
+};
+
+#endif /* RELAYTABLE_H_ */
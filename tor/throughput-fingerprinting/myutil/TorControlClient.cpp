@@ -0,0 +1,390 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "net.h"
+#include "TorControlClient.h"
+
+using namespace std;
+
+struct TorControlExecution
+{
+	TorControlReply* reply;
+	bool done;
+};
+
+static void completeExecution(void* arg, const TorControlReply* reply)
+{
+	TorControlExecution* execution = (TorControlExecution*)arg;
+
+	*execution->reply = *reply;
+	execution->done = true;
+}
+
+TorControlClient::TorControlClient()
+{
+	this->fd = -1;
+	this->inData = false;
+	this->eventHandler = NULL;
+	this->eventArg = NULL;
+}
+
+TorControlClient::~TorControlClient()
+{
+	this->close();
+}
+
+/*
+Connects to the control port at ipAddress:port and makes the socket non-blocking.
+Returns 0 on success and -1 on error.
+*/
+int TorControlClient::open(const char* ipAddress, unsigned short port)
+{
+	this->close();
+
+	this->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(this->fd == -1)
+	{
+		fprintf(stderr, "[TorControlClient::open] Error in creating socket: %s.\n", strerror(errno));
+		return -1;
+	}
+
+	struct sockaddr_in address = createSocketAddress(ipAddress, port);
+	if(connect(this->fd, (struct sockaddr*)&address, sizeof(address)) == -1)
+	{
+		fprintf(stderr, "[TorControlClient::open] Cannot connect to %s:%u: %s.\n", ipAddress, port, strerror(errno));
+		this->close();
+		return -1;
+	}
+
+	if(fcntl(this->fd, F_SETFL, fcntl(this->fd, F_GETFL) | O_NONBLOCK) == -1)
+	{
+		fprintf(stderr, "[TorControlClient::open] Error in making the socket non-blocking: %s.\n", strerror(errno));
+		this->close();
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Sets the handler called with every asynchronous (650) event. */
+void TorControlClient::setEventHandler(TorControlHandler handler, void* arg)
+{
+	this->eventHandler = handler;
+	this->eventArg = arg;
+}
+
+/*
+Queues command, which ends with a line break, and writes as much of it as the
+socket takes. handler, when not NULL, is called by process() with the reply.
+Returns 0 on success and -1 on error.
+*/
+int TorControlClient::send(const string& command, TorControlHandler handler, void* arg)
+{
+	if(this->fd == -1)
+	{
+		fprintf(stderr, "[TorControlClient::send] The connection is not open.\n");
+		return -1;
+	}
+
+	Command pending;
+	pending.handler = handler;
+	pending.arg = arg;
+
+	this->output += command;
+	this->commands.push_back(pending);
+
+	return this->flush();
+}
+
+/*
+Sends command and processes the connection until its reply arrives; the events
+and the replies of earlier commands that arrive meanwhile are handled as usual.
+Returns the status code of the reply, or -1 on error.
+*/
+int TorControlClient::execute(const string& command, TorControlReply* reply)
+{
+	TorControlExecution execution;
+	execution.reply = reply;
+	execution.done = false;
+
+	if(this->send(command, completeExecution, &execution) == -1)
+	{
+		return -1;
+	}
+
+	while(execution.done == false)
+	{
+		if(this->process(-1) == -1)
+		{
+			return -1;
+		}
+	}
+
+	return reply->status;
+}
+
+/*
+Waits up to timeout milliseconds (-1 for no limit) for the connection, then
+writes the queued commands and handles the replies and events that arrived.
+Returns the number of replies and events handled, or -1 on error.
+*/
+int TorControlClient::process(int timeout)
+{
+	if(this->fd == -1)
+	{
+		fprintf(stderr, "[TorControlClient::process] The connection is not open.\n");
+		return -1;
+	}
+
+	struct pollfd pfd;
+	pfd.fd = this->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	if(this->output.empty() == false)
+	{
+		pfd.events |= POLLOUT;
+	}
+
+	int res = poll(&pfd, 1, timeout);
+	if(res == -1)
+	{
+		if(errno == EINTR)
+		{
+			return 0;
+		}
+
+		fprintf(stderr, "[TorControlClient::process] Error in poll: %s.\n", strerror(errno));
+		return -1;
+	}
+	else if(res == 0)
+	{
+		return 0;
+	}
+
+	if(((pfd.revents & POLLOUT) != 0) && (this->flush() == -1))
+	{
+		return -1;
+	}
+
+	if((pfd.revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+	{
+		return 0;
+	}
+
+	int received = this->receive();
+	int handled = this->parse();
+
+	if(handled == -1)
+	{
+		return -1;
+	}
+
+	if(received == -1)
+	{
+		// Tor closes the connection after answering "quit"
+		int unanswered = this->getPendingCount();
+		this->close();
+
+		if(unanswered > 0)
+		{
+			fprintf(stderr, "[TorControlClient::process] Lost the connection to Tor control server with %d commands unanswered.\n", unanswered);
+			return -1;
+		}
+	}
+
+	return handled;
+}
+
+/* Returns the number of commands sent and not yet answered. */
+int TorControlClient::getPendingCount() const
+{
+	return (int)this->commands.size();
+}
+
+/* Returns the socket, for callers that wait on it together with other descriptors. */
+int TorControlClient::getSocket() const
+{
+	return this->fd;
+}
+
+void TorControlClient::close()
+{
+	if(this->fd != -1)
+	{
+		::close(this->fd);
+		this->fd = -1;
+	}
+
+	this->input.clear();
+	this->output.clear();
+	this->commands.clear();
+	this->reply.lines.clear();
+	this->inData = false;
+}
+
+/* Writes the queued bytes until the socket is full. Returns 0 on success and -1 on error. */
+int TorControlClient::flush()
+{
+	while(this->output.empty() == false)
+	{
+		ssize_t res = ::send(this->fd, this->output.data(), this->output.size(), MSG_NOSIGNAL);
+		if(res == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			else if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			{
+				break;
+			}
+
+			fprintf(stderr, "[TorControlClient::flush] Error in sending to Tor control server: %s.\n", strerror(errno));
+			return -1;
+		}
+
+		this->output.erase(0, res);
+	}
+
+	return 0;
+}
+
+/*
+Appends everything the socket has to the input. Returns the number of bytes read,
+or -1 when the connection failed or was closed by Tor; what was read before that
+is kept for parse().
+*/
+int TorControlClient::receive()
+{
+	char buffer[TOR_CONTROL_READ_SIZE];
+	int total = 0;
+
+	while(true)
+	{
+		ssize_t res = recv(this->fd, buffer, sizeof(buffer), 0);
+		if(res > 0)
+		{
+			this->input.append(buffer, res);
+			total += res;
+			continue;
+		}
+		else if(res == 0)
+		{
+			return -1;
+		}
+		else if(errno == EINTR)
+		{
+			continue;
+		}
+		else if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+		{
+			return total;
+		}
+
+		fprintf(stderr, "[TorControlClient::receive] Error in receiving from Tor control server: %s.\n", strerror(errno));
+		return -1;
+	}
+}
+
+/*
+Parses the complete lines of the input and hands every completed reply or event
+to its handler. An incomplete line stays in the input. Returns the number of
+replies and events handled, or -1 on a protocol error.
+*/
+int TorControlClient::parse()
+{
+	size_t start = 0;
+	size_t end;
+	int handled = 0;
+
+	while((end = this->input.find('\n', start)) != string::npos)
+	{
+		size_t length = end - start;
+		if((length > 0) && (this->input[end - 1] == '\r'))
+		{
+			--length;
+		}
+
+		const char* line = this->input.data() + start;
+		start = end + 1;
+
+		if(this->inData == true)
+		{
+			if((length == 1) && (line[0] == '.'))
+			{
+				this->inData = false;
+			}
+			else if((length > 0) && (line[0] == '.'))
+			{
+				this->reply.lines.push_back(string(line + 1, length - 1));
+			}
+			else
+			{
+				this->reply.lines.push_back(string(line, length));
+			}
+			continue;
+		}
+
+		if((length < 4) || (isdigit(line[0]) == 0) || (isdigit(line[1]) == 0) || (isdigit(line[2]) == 0)
+				|| ((line[3] != ' ') && (line[3] != '-') && (line[3] != '+')))
+		{
+			fprintf(stderr, "[TorControlClient::parse] Malformed line from Tor control server: %.*s\n", (int)length, line);
+			this->input.erase(0, start);
+			return -1;
+		}
+
+		this->reply.status = (line[0] - '0') * 100 + (line[1] - '0') * 10 + (line[2] - '0');
+		this->reply.lines.push_back(string(line + 4, length - 4));
+
+		if(line[3] == '+')
+		{
+			this->inData = true;
+			continue;
+		}
+		else if(line[3] == '-')
+		{
+			continue;
+		}
+
+		// The end line completes the reply or event
+		if(this->reply.status == TOR_CONTROL_STATUS_EVENT)
+		{
+			if(this->eventHandler != NULL)
+			{
+				this->eventHandler(this->eventArg, &this->reply);
+			}
+		}
+		else if(this->commands.empty() == true)
+		{
+			fprintf(stderr, "[TorControlClient::parse] Reply from Tor control server without a command: %.*s\n", (int)length, line);
+			this->input.erase(0, start);
+			this->reply.lines.clear();
+			return -1;
+		}
+		else
+		{
+			Command command = this->commands.front();
+			this->commands.pop_front();
+
+			if(command.handler != NULL)
+			{
+				command.handler(command.arg, &this->reply);
+			}
+		}
+
+		this->reply.lines.clear();
+		++handled;
+	}
+
+	this->input.erase(0, start);
+
+	return handled;
+}
@@ -0,0 +1,74 @@
+#ifndef TORCONTROLCLIENT_H_
+#define TORCONTROLCLIENT_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+using namespace std;
+
+#define TOR_CONTROL_STATUS_EVENT	650
+#define TOR_CONTROL_READ_SIZE		16384
+
+/*
+One reply or asynchronous event of the Tor control protocol. lines holds the text
+after the status code of every "NNN-" mid line and of the "NNN " end line, in
+order; the lines of a "NNN+" data block follow the line that opened it, with the
+terminating "." removed and leading dots unescaped.
+*/
+struct TorControlReply
+{
+	int status;
+	vector<string> lines;
+};
+
+typedef void (*TorControlHandler)(void* arg, const TorControlReply* reply);
+
+/*
+Client of the Tor control port on a non-blocking socket. Commands are pipelined:
+send() queues a command with its own completion handler and returns at once, and
+Tor answers commands in the order they were sent, so many commands can be in
+flight. process() writes what it can, parses whatever has arrived and calls the
+handler of each completed reply, or the event handler for a 650 event, however
+the bytes were split. Replies have no size limit. Handlers must not call
+process() or execute() themselves.
+*/
+class TorControlClient
+{
+private:
+	struct Command
+	{
+		TorControlHandler handler;
+		void* arg;
+	};
+
+	int fd;
+	string input;
+	string output;
+	deque<Command> commands;	// sent commands waiting for their replies
+	TorControlReply reply;		// the reply or event being parsed
+	bool inData;				// between a "NNN+" line and its "."
+	TorControlHandler eventHandler;
+	void* eventArg;
+
+	int flush();
+	int receive();
+	int parse();
+
+public:
+	TorControlClient();
+	~TorControlClient();
+
+	int open(const char* ipAddress, unsigned short port);
+	void setEventHandler(TorControlHandler handler, void* arg);
+	int send(const string& command, TorControlHandler handler, void* arg);
+	int execute(const string& command, TorControlReply* reply);
+	int process(int timeout);
+	int getPendingCount() const;
+	int getSocket() const;
+	void close();
+};
+
+#endif /* TORCONTROLCLIENT_H_ */
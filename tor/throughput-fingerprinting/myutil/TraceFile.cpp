@@ -0,0 +1,301 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "TraceFile.h"
+
+using namespace std;
+
+static void copyName(char* destination, const string& source)
+{
+	memset(destination, 0, TRACE_FILE_NAME_LENGTH);
+	strncpy(destination, source.c_str(), TRACE_FILE_NAME_LENGTH - 1);
+}
+
+TraceFileWriter::TraceFileWriter()
+{
+	this->fd = -1;
+	this->inTrace = false;
+	memset(&this->header, 0, sizeof(this->header));
+}
+
+TraceFileWriter::~TraceFileWriter()
+{
+	this->close();
+}
+
+/*
+Creates fileName, truncating it unless truncate is false; writers that share one
+file open it without truncating. Returns 0 on success and -1 on error.
+*/
+int TraceFileWriter::open(const char* fileName, bool truncate)
+{
+	this->close();
+
+	this->fd = ::open(fileName, O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0) | O_APPEND, 0644);
+	if(this->fd == -1)
+	{
+		fprintf(stderr, "[TraceFileWriter::open] Cannot open file %s for output: %s.\n", fileName, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Starts a new trace; a trace still open is discarded. */
+void TraceFileWriter::beginTrace(const string& middleman, const string& exit, const string& fingerprint, double interval, double startTime)
+{
+	memset(&this->header, 0, sizeof(this->header));
+	memcpy(this->header.magic, TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC));
+	this->header.version = TRACE_FILE_VERSION;
+	this->header.headerSize = sizeof(TraceFileHeader);
+	copyName(this->header.middleman, middleman);
+	copyName(this->header.exit, exit);
+	copyName(this->header.fingerprint, fingerprint);
+	this->header.interval = interval;
+	this->header.startTime = startTime;
+
+	this->times.clear();
+	this->throughputs.clear();
+	this->goodputs.clear();
+
+	this->inTrace = true;
+}
+
+void TraceFileWriter::add(double time, double throughput, double goodput)
+{
+	if(this->inTrace == false)
+	{
+		return;
+	}
+
+	this->times.push_back(time);
+	this->throughputs.push_back(throughput);
+	this->goodputs.push_back(goodput);
+}
+
+/*
+Appends the current trace to the file. Returns the number of samples written, 0
+when no trace was open, or -1 on error.
+*/
+int TraceFileWriter::endTrace()
+{
+	if((this->inTrace == false) || (this->fd == -1))
+	{
+		return 0;
+	}
+
+	this->inTrace = false;
+	this->header.sampleCount = this->times.size();
+
+	size_t columnLength = this->times.size() * sizeof(double);
+
+	struct iovec iov[4];
+	iov[0].iov_base = &this->header;
+	iov[0].iov_len = sizeof(this->header);
+	iov[1].iov_base = (columnLength > 0) ? &this->times[0] : NULL;
+	iov[1].iov_len = columnLength;
+	iov[2].iov_base = (columnLength > 0) ? &this->throughputs[0] : NULL;
+	iov[2].iov_len = columnLength;
+	iov[3].iov_base = (columnLength > 0) ? &this->goodputs[0] : NULL;
+	iov[3].iov_len = columnLength;
+
+	size_t total = sizeof(this->header) + 3 * columnLength;
+	size_t written = 0;
+	int first = 0;
+
+	// O_APPEND keeps traces from different writers whole; a short write resumes where it stopped
+	while(written < total)
+	{
+		ssize_t res = writev(this->fd, &iov[first], 4 - first);
+		if(res == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			fprintf(stderr, "[TraceFileWriter::endTrace] Error in writing trace: %s.\n", strerror(errno));
+			return -1;
+		}
+
+		written += res;
+		while((first < 4) && ((size_t)res >= iov[first].iov_len))
+		{
+			res -= iov[first].iov_len;
+			first++;
+		}
+		if(first < 4)
+		{
+			iov[first].iov_base = (char*)iov[first].iov_base + res;
+			iov[first].iov_len -= res;
+		}
+	}
+
+	return this->times.size();
+}
+
+/* Writes the open trace, if any, and closes the file. Returns 0 on success and -1 on error. */
+int TraceFileWriter::close()
+{
+	int res = 0;
+
+	if(this->fd != -1)
+	{
+		if(this->endTrace() == -1)
+		{
+			res = -1;
+		}
+
+		::close(this->fd);
+		this->fd = -1;
+	}
+
+	return res;
+}
+
+TraceFile::TraceFile()
+{
+	this->fd = -1;
+	this->map = NULL;
+	this->length = 0;
+}
+
+TraceFile::~TraceFile()
+{
+	this->close();
+}
+
+/*
+Maps fileName and indexes its traces. A trace cut short at the end of the file
+(a measurement killed while writing) is ignored. Returns the number of traces or
+-1 on error.
+*/
+int TraceFile::open(const char* fileName)
+{
+	this->close();
+
+	this->fd = ::open(fileName, O_RDONLY);
+	if(this->fd == -1)
+	{
+		fprintf(stderr, "[TraceFile::open] Cannot open file %s for input: %s.\n", fileName, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if(fstat(this->fd, &st) == -1)
+	{
+		fprintf(stderr, "[TraceFile::open] Cannot read the size of file %s: %s.\n", fileName, strerror(errno));
+		this->close();
+		return -1;
+	}
+
+	this->length = st.st_size;
+	if(this->length == 0)
+	{
+		return 0;
+	}
+
+	this->map = (unsigned char*)mmap(NULL, this->length, PROT_READ, MAP_PRIVATE, this->fd, 0);
+	if(this->map == MAP_FAILED)
+	{
+		fprintf(stderr, "[TraceFile::open] Error in mapping file %s: %s.\n", fileName, strerror(errno));
+		this->map = NULL;
+		this->close();
+		return -1;
+	}
+
+	size_t offset = 0;
+	while(offset + sizeof(TraceFileHeader) <= this->length)
+	{
+		const TraceFileHeader* header = (const TraceFileHeader*)(this->map + offset);
+
+		if((memcmp(header->magic, TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC)) != 0) || (header->version != TRACE_FILE_VERSION) || (header->headerSize != sizeof(TraceFileHeader)))
+		{
+			fprintf(stderr, "[TraceFile::open] File %s has no valid trace at offset %lu.\n", fileName, (unsigned long)offset);
+			this->close();
+			return -1;
+		}
+
+		size_t traceLength = sizeof(TraceFileHeader) + 3 * header->sampleCount * sizeof(double);
+		if((header->sampleCount > this->length) || (offset + traceLength > this->length))
+		{
+			break;
+		}
+
+		this->headers.push_back(header);
+		offset += traceLength;
+	}
+
+	if(offset != this->length)
+	{
+		fprintf(stderr, "[TraceFile::open] Ignoring %lu bytes of a truncated trace at the end of file %s.\n", (unsigned long)(this->length - offset), fileName);
+	}
+
+	return this->headers.size();
+}
+
+int TraceFile::getTraceCount() const
+{
+	return this->headers.size();
+}
+
+const TraceFileHeader* TraceFile::getHeader(int trace) const
+{
+	return this->headers[trace];
+}
+
+const double* TraceFile::getTimes(int trace) const
+{
+	return (const double*)(this->headers[trace] + 1);
+}
+
+const double* TraceFile::getThroughputs(int trace) const
+{
+	return this->getTimes(trace) + this->headers[trace]->sampleCount;
+}
+
+const double* TraceFile::getGoodputs(int trace) const
+{
+	return this->getTimes(trace) + 2 * this->headers[trace]->sampleCount;
+}
+
+void TraceFile::close()
+{
+	this->headers.clear();
+
+	if(this->map != NULL)
+	{
+		munmap(this->map, this->length);
+		this->map = NULL;
+	}
+	this->length = 0;
+
+	if(this->fd != -1)
+	{
+		::close(this->fd);
+		this->fd = -1;
+	}
+}
+
+/* Returns true if fileName starts with a binary trace header. */
+bool isTraceFile(const char* fileName)
+{
+	FILE* inFile = fopen(fileName, "rb");
+	if(inFile == NULL)
+	{
+		return false;
+	}
+
+	char magic[sizeof(TRACE_FILE_MAGIC)];
+	bool res = (fread(magic, sizeof(magic), 1, inFile) == 1) && (memcmp(magic, TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC)) == 0);
+
+	fclose(inFile);
+
+	return res;
+}
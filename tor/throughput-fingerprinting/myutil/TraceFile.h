@@ -0,0 +1,86 @@
+#ifndef TRACEFILE_H_
+#define TRACEFILE_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define TRACE_FILE_MAGIC		"TPGPTRC"	// 7 characters and the terminating zero
+#define TRACE_FILE_VERSION		1
+#define TRACE_FILE_NAME_LENGTH	64			// relay names and fingerprints, zero padded
+
+/*
+Binary trace file: a sequence of traces, one per measured relay, each a
+TraceFileHeader followed by three columns of sampleCount doubles (time,
+throughput and goodput in KBps). The header is a multiple of 8 bytes, so every
+column of a mapped file is aligned and can be read in place.
+*/
+struct TraceFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	char middleman[TRACE_FILE_NAME_LENGTH];
+	char exit[TRACE_FILE_NAME_LENGTH];
+	char fingerprint[TRACE_FILE_NAME_LENGTH];
+	double interval;	// in seconds
+	double startTime;	// wall clock time of the first interval's start
+	uint64_t sampleCount;
+};
+
+/*
+Collects the samples of one trace in memory and appends the whole trace with a
+single write when it ends. A writer is used by one thread; writers opened on
+the same file in append mode, one per measurement worker, never interleave
+their traces.
+*/
+class TraceFileWriter
+{
+private:
+	int fd;
+	bool inTrace;
+	TraceFileHeader header;
+	vector<double> times;
+	vector<double> throughputs;
+	vector<double> goodputs;
+
+public:
+	TraceFileWriter();
+	~TraceFileWriter();
+
+	int open(const char* fileName, bool truncate = true);
+	void beginTrace(const string& middleman, const string& exit, const string& fingerprint, double interval, double startTime);
+	void add(double time, double throughput, double goodput);
+	int endTrace();
+	int close();
+};
+
+/* Read-only mapping of a binary trace file. */
+class TraceFile
+{
+private:
+	int fd;
+	unsigned char* map;
+	size_t length;
+	vector<const TraceFileHeader*> headers;
+
+public:
+	TraceFile();
+	~TraceFile();
+
+	int open(const char* fileName);
+	int getTraceCount() const;
+	const TraceFileHeader* getHeader(int trace) const;
+	const double* getTimes(int trace) const;
+	const double* getThroughputs(int trace) const;
+	const double* getGoodputs(int trace) const;
+	void close();
+};
+
+bool isTraceFile(const char* fileName);
+
+#endif /* TRACEFILE_H_ */
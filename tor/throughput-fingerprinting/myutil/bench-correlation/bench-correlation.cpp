@@ -0,0 +1,153 @@
+//============================================================================
+// Name        : bench-correlation.cpp
+// Author      :
+// Version     :
+// Copyright   :
+// Description : Times pearsonCorrelation() against the R round trip and
+//               checks that the two agree
+//============================================================================
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include "../correlation.h"
+#include "../R.h"
+#include "bench-correlation.h"
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+	int sampleCount = (argc > 1) ? atoi(argv[1]) : DEFAULT_SAMPLE_COUNT;
+	int seriesCount = (argc > 2) ? atoi(argv[2]) : DEFAULT_SERIES_COUNT;
+	int rCallCount = (argc > 3) ? atoi(argv[3]) : DEFAULT_R_CALL_COUNT;
+
+	if((sampleCount < 2) || (seriesCount < 1) || (rCallCount < 0))
+	{
+		fprintf(stderr, "USAGE: %s [samples per series (>= 2)] [series pairs (>= 1)] [R calls (>= 0)]\n", argv[0]);
+		exit(1);
+	}
+
+	srandom(1);
+
+	vector<double> x((size_t)sampleCount * seriesCount), y((size_t)sampleCount * seriesCount);
+	for(int s = 0; s < seriesCount; s++)
+	{
+		fillSeries(&x[(size_t)s * sampleCount], &y[(size_t)s * sampleCount], sampleCount);
+	}
+
+	vector<double> native(seriesCount);
+	double maxReferenceError = 0.0;
+	for(int s = 0; s < seriesCount; s++)
+	{
+		native[s] = pearsonCorrelation(&x[(size_t)s * sampleCount], &y[(size_t)s * sampleCount], sampleCount);
+		maxReferenceError = max(maxReferenceError, fabs(native[s] - referenceCorrelation(&x[(size_t)s * sampleCount], &y[(size_t)s * sampleCount], sampleCount)));
+	}
+
+	double sum = 0.0;
+	double start = getTime();
+	for(int round = 0; round < NATIVE_ROUND_COUNT; round++)
+	{
+		for(int s = 0; s < seriesCount; s++)
+		{
+			sum += pearsonCorrelation(&x[(size_t)s * sampleCount], &y[(size_t)s * sampleCount], sampleCount);
+		}
+	}
+	double nativeSeconds = (getTime() - start) / ((double)NATIVE_ROUND_COUNT * seriesCount);
+
+	printf("Samples per series %d Series pairs %d Kernel %s\n", sampleCount, seriesCount, getCorrelationKernelName());
+	printf("pearsonCorrelation    %12.3f us/call %12.0f calls/s (checksum %f)\n", nativeSeconds * 1e6, 1.0 / nativeSeconds, sum);
+	printf("Max difference from long double reference %g\n", maxReferenceError);
+
+	bool agree = (maxReferenceError <= CORRELATION_TOLERANCE);
+
+	int rCalls = 0;
+	double maxRError = 0.0;
+	start = getTime();
+	for(int i = 0; i < rCallCount; i++)
+	{
+		int s = i % seriesCount;
+		double r = calculateCorrelationR(&x[(size_t)s * sampleCount], &y[(size_t)s * sampleCount], sampleCount);
+		if(r == CORRELATION_ERROR)
+		{
+			break;
+		}
+
+		maxRError = max(maxRError, fabs(native[s] - r));
+		rCalls++;
+	}
+	double rSeconds = getTime() - start;
+
+	if(rCalls == 0)
+	{
+		printf("calculateCorrelationR unavailable (is R installed?); comparison with R skipped\n");
+	}
+	else
+	{
+		rSeconds /= rCalls;
+		printf("calculateCorrelationR %12.3f us/call %12.1f calls/s (%d calls)\n", rSeconds * 1e6, 1.0 / rSeconds, rCalls);
+		printf("Max difference from R %g Speedup %.0fx\n", maxRError, rSeconds / nativeSeconds);
+
+		agree = agree && (maxRError <= CORRELATION_TOLERANCE);
+	}
+
+	if(!agree)
+	{
+		fprintf(stderr, "[BENCH-CORRELATION] Results differ by more than %g.\n", CORRELATION_TOLERANCE);
+		return EXIT_FAILURE;
+	}
+
+	printf("Results agree within %g\n", CORRELATION_TOLERANCE);
+
+	return EXIT_SUCCESS;
+}
+
+double getTime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+/*
+Fills a pair of throughput-like series (KBps) that share a common component.
+The values are rounded to six decimals because calculateCorrelationR() hands
+R the samples printed with %f; both paths then see the same numbers.
+*/
+void fillSeries(double* x, double* y, int n)
+{
+	for(int i = 0; i < n; i++)
+	{
+		double common = 100.0 * random() / RAND_MAX;
+		x[i] = floor((common + 50.0 * random() / RAND_MAX) * 1e6 + 0.5) / 1e6;
+		y[i] = floor((common + 50.0 * random() / RAND_MAX) * 1e6 + 0.5) / 1e6;
+	}
+}
+
+/* Two-pass Pearson correlation in long double, used as the in-process reference. */
+double referenceCorrelation(const double* x, const double* y, int n)
+{
+	long double meanX = 0.0, meanY = 0.0;
+	for(int i = 0; i < n; i++)
+	{
+		meanX += x[i];
+		meanY += y[i];
+	}
+	meanX /= n;
+	meanY /= n;
+
+	long double sxy = 0.0, sxx = 0.0, syy = 0.0;
+	for(int i = 0; i < n; i++)
+	{
+		sxy += (x[i] - meanX) * (y[i] - meanY);
+		sxx += (x[i] - meanX) * (x[i] - meanX);
+		syy += (y[i] - meanY) * (y[i] - meanY);
+	}
+
+	return (double)(sxy / sqrtl(sxx * syy));
+}
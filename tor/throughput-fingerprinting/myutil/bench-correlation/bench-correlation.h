@@ -0,0 +1,17 @@
+#ifndef BENCH_CORRELATION_H_
+#define BENCH_CORRELATION_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#define DEFAULT_SAMPLE_COUNT	3600
+#define DEFAULT_SERIES_COUNT	200
+#define DEFAULT_R_CALL_COUNT	5
+#define NATIVE_ROUND_COUNT		50
+#define CORRELATION_TOLERANCE	1e-6 // R prints cor() with 7 significant digits
+
+double getTime();
+void fillSeries(double* x, double* y, int n);
+double referenceCorrelation(const double* x, const double* y, int n);
+
+#endif /* BENCH_CORRELATION_H_ */
@@ -0,0 +1,134 @@
+//============================================================================
+// Name        : bench-packet.cpp
+// Author      :
+// Version     :
+// Copyright   :
+// Description : Measures the packets/sec of PacketView against Packet and
+//               checks that non-IPv4 frames are rejected
+//============================================================================
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include "../Packet.h"
+#include "bench-packet.h"
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+	int frameLength = (argc > 1) ? atoi(argv[1]) : DEFAULT_FRAME_LENGTH;
+	long packetCount = (argc > 2) ? atol(argv[2]) : DEFAULT_PACKET_COUNT;
+
+	if((frameLength < MIN_FRAME_LENGTH) || (packetCount < 1))
+	{
+		fprintf(stderr, "USAGE: %s [frame length (>= %d)] [packets (>= 1)]\n", argv[0], MIN_FRAME_LENGTH);
+		exit(1);
+	}
+
+	vector<unsigned char> frames((size_t)frameLength * FRAME_COUNT);
+	for(int i = 0; i < FRAME_COUNT; i++)
+	{
+		buildFrame(&frames[(size_t)i * frameLength], frameLength, FRAME_IPV4, i);
+	}
+
+	bool passed = true;
+
+	const char* names[] = { "IPv4", "IPv6", "VLAN", "IP version 6 in IPv4 frame" };
+	vector<unsigned char> frame(frameLength);
+	for(int kind = FRAME_IPV4; kind <= FRAME_BAD_IP_V; kind++)
+	{
+		buildFrame(&frame[0], frameLength, kind, 0);
+		PacketView view(&frame[0], frameLength, frameLength);
+
+		bool expected = (kind == FRAME_IPV4);
+		printf("%-28s %s\n", names[kind], view.isValid() ? "accepted" : "rejected");
+		if(view.isValid() != expected)
+		{
+			fprintf(stderr, "[BENCH-PACKET] %s frame was %s.\n", names[kind], view.isValid() ? "accepted" : "rejected");
+			passed = false;
+		}
+	}
+
+	long copySum = 0;
+	double start = getTime();
+	for(long i = 0; i < packetCount; i++)
+	{
+		Packet packet(&frames[(size_t)(i % FRAME_COUNT) * frameLength], frameLength);
+		copySum += packet.getPayloadLength();
+	}
+	double copySeconds = getTime() - start;
+
+	long viewSum = 0;
+	start = getTime();
+	for(long i = 0; i < packetCount; i++)
+	{
+		PacketView view(&frames[(size_t)(i % FRAME_COUNT) * frameLength], frameLength, frameLength);
+		viewSum += view.getPayloadLength();
+	}
+	double viewSeconds = getTime() - start;
+
+	printf("Frame length %d Packets %ld\n", frameLength, packetCount);
+	printf("Packet     %10.1f Mpps (payload bytes %ld)\n", packetCount / copySeconds / 1e6, copySum);
+	printf("PacketView %10.1f Mpps (payload bytes %ld)\n", packetCount / viewSeconds / 1e6, viewSum);
+
+	if(copySum != viewSum)
+	{
+		fprintf(stderr, "[BENCH-PACKET] Payload byte counts differ.\n");
+		passed = false;
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+double getTime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+/*
+Builds a TCP frame of the given length. FRAME_IPV6 and FRAME_VLAN change only
+the ethertype and FRAME_BAD_IP_V only the IP version, so the rest of the headers
+stay plausible and only the ethertype and version checks can reject them.
+*/
+void buildFrame(unsigned char* frame, int length, int kind, int index)
+{
+	memset(frame, 0, length);
+
+	struct hdr_ethernet* eth = (struct hdr_ethernet*)frame;
+	if(kind == FRAME_IPV6)
+	{
+		eth->ether_type = htons(ETHERTYPE_IPV6);
+	}
+	else if(kind == FRAME_VLAN)
+	{
+		eth->ether_type = htons(ETHERTYPE_VLAN);
+	}
+	else
+	{
+		eth->ether_type = htons(ETHERTYPE_IP);
+	}
+
+	struct hdr_ip* ip = (struct hdr_ip*)(frame + ETHERNET_HEADER_LEN);
+	ip->ip_vhl = (kind == FRAME_BAD_IP_V) ? 0x65 : 0x45;
+	ip->ip_len = htons(length - ETHERNET_HEADER_LEN);
+	ip->ip_ttl = 64;
+	ip->ip_p = IPPROTO_TCP;
+	ip->ip_src.s_addr = htonl(0x7f000101 + (index % 8));
+	ip->ip_dst.s_addr = htonl(0x7f000001);
+
+	struct hdr_tcp* tcp = (struct hdr_tcp*)(frame + ETHERNET_HEADER_LEN + 20);
+	tcp->tcp_sport = htons(9001 + (index % 8));
+	tcp->tcp_dport = htons(40000 + index);
+	tcp->tcp_off_rsvd = 0x50;
+	tcp->tcp_flags = TCP_ACK;
+}
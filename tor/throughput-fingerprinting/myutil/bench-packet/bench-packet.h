@@ -0,0 +1,20 @@
+#ifndef BENCH_PACKET_H_
+#define BENCH_PACKET_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#define DEFAULT_FRAME_LENGTH	1514
+#define DEFAULT_PACKET_COUNT	20000000
+#define FRAME_COUNT				64
+#define MIN_FRAME_LENGTH		54 // Ethernet + IP + TCP headers without options
+
+#define FRAME_IPV4		0
+#define FRAME_IPV6		1
+#define FRAME_VLAN		2
+#define FRAME_BAD_IP_V	3
+
+double getTime();
+void buildFrame(unsigned char* frame, int length, int kind, int index);
+
+#endif /* BENCH_PACKET_H_ */
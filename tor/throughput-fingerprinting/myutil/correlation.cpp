@@ -0,0 +1,1016 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "thread.h"
+#include "fft.h"
+#include "correlation.h"
+
+using namespace std;
+
+#define MATRIX_TILE_ROWS		64	/* must be a multiple of 2 */
+#define MATRIX_TILE_COLS		64	/* must be a multiple of 4 */
+#define MATRIX_BLOCK_LENGTH		512	/* must be a multiple of 4 */
+
+/*
+Pearson's r is computed in two passes, the same way R's cor() does it: the
+first pass finds the means, the second accumulates the centered co-moments.
+Both passes are available as a scalar loop and as SSE2/AVX2 loops; the widest
+one supported by the running CPU is picked once at first use.
+*/
+
+static void sumScalar(const double* x, const double* y, int n, double* sx, double* sy)
+{
+	double a = 0, b = 0;
+
+	for(int i = 0; i < n; i++)
+	{
+		a += x[i];
+		b += y[i];
+	}
+
+	*sx = a;
+	*sy = b;
+}
+
+static void comomentScalar(const double* x, const double* y, int n, double mx, double my, double* sxx, double* syy, double* sxy)
+{
+	double a = 0, b = 0, c = 0;
+
+	for(int i = 0; i < n; i++)
+	{
+		double dx = x[i] - mx;
+		double dy = y[i] - my;
+
+		a += dx * dx;
+		b += dy * dy;
+		c += dx * dy;
+	}
+
+	*sxx = a;
+	*syy = b;
+	*sxy = c;
+}
+
+static double dotScalar(const double* x, const double* y, int n)
+{
+	double d = 0;
+
+	for(int i = 0; i < n; i++)
+	{
+		d += x[i] * y[i];
+	}
+
+	return d;
+}
+
+/* Dot products of two rows of x against four rows of y (acc is row-major 2 x 4). */
+static void dot2x4Scalar(const double* x, const double* y, int ld, int len, double* acc)
+{
+	for(int i = 0; i < 2; i++)
+	{
+		for(int j = 0; j < 4; j++)
+		{
+			const double* a = x + i * ld;
+			const double* b = y + j * ld;
+			double d = 0;
+
+			for(int k = 0; k < len; k++)
+			{
+				d += a[k] * b[k];
+			}
+
+			acc[i * 4 + j] = d;
+		}
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static inline double horizontalSum(__m128d v)
+{
+	return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+__attribute__((target("sse2")))
+static void sumSSE2(const double* x, const double* y, int n, double* sx, double* sy)
+{
+	__m128d a = _mm_setzero_pd();
+	__m128d b = _mm_setzero_pd();
+	int i = 0;
+
+	for(; i + 2 <= n; i += 2)
+	{
+		a = _mm_add_pd(a, _mm_loadu_pd(x + i));
+		b = _mm_add_pd(b, _mm_loadu_pd(y + i));
+	}
+
+	double ta, tb;
+	sumScalar(x + i, y + i, n - i, &ta, &tb);
+
+	*sx = horizontalSum(a) + ta;
+	*sy = horizontalSum(b) + tb;
+}
+
+__attribute__((target("sse2")))
+static void comomentSSE2(const double* x, const double* y, int n, double mx, double my, double* sxx, double* syy, double* sxy)
+{
+	__m128d vmx = _mm_set1_pd(mx);
+	__m128d vmy = _mm_set1_pd(my);
+	__m128d a = _mm_setzero_pd();
+	__m128d b = _mm_setzero_pd();
+	__m128d c = _mm_setzero_pd();
+	int i = 0;
+
+	for(; i + 2 <= n; i += 2)
+	{
+		__m128d dx = _mm_sub_pd(_mm_loadu_pd(x + i), vmx);
+		__m128d dy = _mm_sub_pd(_mm_loadu_pd(y + i), vmy);
+
+		a = _mm_add_pd(a, _mm_mul_pd(dx, dx));
+		b = _mm_add_pd(b, _mm_mul_pd(dy, dy));
+		c = _mm_add_pd(c, _mm_mul_pd(dx, dy));
+	}
+
+	double ta, tb, tc;
+	comomentScalar(x + i, y + i, n - i, mx, my, &ta, &tb, &tc);
+
+	*sxx = horizontalSum(a) + ta;
+	*syy = horizontalSum(b) + tb;
+	*sxy = horizontalSum(c) + tc;
+}
+
+__attribute__((target("sse2")))
+static double dotSSE2(const double* x, const double* y, int n)
+{
+	__m128d a = _mm_setzero_pd();
+	int i = 0;
+
+	for(; i + 2 <= n; i += 2)
+	{
+		a = _mm_add_pd(a, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+	}
+
+	return horizontalSum(a) + dotScalar(x + i, y + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void dot2x4SSE2(const double* x, const double* y, int ld, int len, double* acc)
+{
+	__m128d c[8];
+
+	for(int i = 0; i < 8; i++)
+	{
+		c[i] = _mm_setzero_pd();
+	}
+
+	for(int k = 0; k < len; k += 2)
+	{
+		__m128d a0 = _mm_load_pd(x + k);
+		__m128d a1 = _mm_load_pd(x + ld + k);
+
+		for(int j = 0; j < 4; j++)
+		{
+			__m128d b = _mm_load_pd(y + j * ld + k);
+
+			c[j] = _mm_add_pd(c[j], _mm_mul_pd(a0, b));
+			c[4 + j] = _mm_add_pd(c[4 + j], _mm_mul_pd(a1, b));
+		}
+	}
+
+	for(int i = 0; i < 8; i++)
+	{
+		acc[i] = horizontalSum(c[i]);
+	}
+}
+
+__attribute__((target("avx2")))
+static inline double horizontalSum256(__m256d v)
+{
+	__m128d lo = _mm256_castpd256_pd128(v);
+	__m128d hi = _mm256_extractf128_pd(v, 1);
+	lo = _mm_add_pd(lo, hi);
+
+	return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx2")))
+static void sumAVX2(const double* x, const double* y, int n, double* sx, double* sy)
+{
+	__m256d a = _mm256_setzero_pd();
+	__m256d b = _mm256_setzero_pd();
+	int i = 0;
+
+	for(; i + 4 <= n; i += 4)
+	{
+		a = _mm256_add_pd(a, _mm256_loadu_pd(x + i));
+		b = _mm256_add_pd(b, _mm256_loadu_pd(y + i));
+	}
+
+	double ta, tb;
+	sumScalar(x + i, y + i, n - i, &ta, &tb);
+
+	*sx = horizontalSum256(a) + ta;
+	*sy = horizontalSum256(b) + tb;
+}
+
+__attribute__((target("avx2")))
+static void comomentAVX2(const double* x, const double* y, int n, double mx, double my, double* sxx, double* syy, double* sxy)
+{
+	__m256d vmx = _mm256_set1_pd(mx);
+	__m256d vmy = _mm256_set1_pd(my);
+	__m256d a = _mm256_setzero_pd();
+	__m256d b = _mm256_setzero_pd();
+	__m256d c = _mm256_setzero_pd();
+	int i = 0;
+
+	for(; i + 4 <= n; i += 4)
+	{
+		__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + i), vmx);
+		__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + i), vmy);
+
+		a = _mm256_add_pd(a, _mm256_mul_pd(dx, dx));
+		b = _mm256_add_pd(b, _mm256_mul_pd(dy, dy));
+		c = _mm256_add_pd(c, _mm256_mul_pd(dx, dy));
+	}
+
+	double ta, tb, tc;
+	comomentScalar(x + i, y + i, n - i, mx, my, &ta, &tb, &tc);
+
+	*sxx = horizontalSum256(a) + ta;
+	*syy = horizontalSum256(b) + tb;
+	*sxy = horizontalSum256(c) + tc;
+}
+
+__attribute__((target("avx2")))
+static double dotAVX2(const double* x, const double* y, int n)
+{
+	__m256d a = _mm256_setzero_pd();
+	__m256d b = _mm256_setzero_pd();
+	int i = 0;
+
+	for(; i + 8 <= n; i += 8)
+	{
+		a = _mm256_add_pd(a, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+		b = _mm256_add_pd(b, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4)));
+	}
+
+	return horizontalSum256(_mm256_add_pd(a, b)) + dotScalar(x + i, y + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void dot2x4AVX2(const double* x, const double* y, int ld, int len, double* acc)
+{
+	__m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd(), c02 = _mm256_setzero_pd(), c03 = _mm256_setzero_pd();
+	__m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd(), c12 = _mm256_setzero_pd(), c13 = _mm256_setzero_pd();
+
+	for(int k = 0; k < len; k += 4)
+	{
+		__m256d a0 = _mm256_load_pd(x + k);
+		__m256d a1 = _mm256_load_pd(x + ld + k);
+		__m256d b;
+
+		b = _mm256_load_pd(y + k);
+		c00 = _mm256_add_pd(c00, _mm256_mul_pd(a0, b));
+		c10 = _mm256_add_pd(c10, _mm256_mul_pd(a1, b));
+
+		b = _mm256_load_pd(y + ld + k);
+		c01 = _mm256_add_pd(c01, _mm256_mul_pd(a0, b));
+		c11 = _mm256_add_pd(c11, _mm256_mul_pd(a1, b));
+
+		b = _mm256_load_pd(y + 2 * ld + k);
+		c02 = _mm256_add_pd(c02, _mm256_mul_pd(a0, b));
+		c12 = _mm256_add_pd(c12, _mm256_mul_pd(a1, b));
+
+		b = _mm256_load_pd(y + 3 * ld + k);
+		c03 = _mm256_add_pd(c03, _mm256_mul_pd(a0, b));
+		c13 = _mm256_add_pd(c13, _mm256_mul_pd(a1, b));
+	}
+
+	acc[0] = horizontalSum256(c00);
+	acc[1] = horizontalSum256(c01);
+	acc[2] = horizontalSum256(c02);
+	acc[3] = horizontalSum256(c03);
+	acc[4] = horizontalSum256(c10);
+	acc[5] = horizontalSum256(c11);
+	acc[6] = horizontalSum256(c12);
+	acc[7] = horizontalSum256(c13);
+}
+
+#endif
+
+static int detectCorrelationKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("avx2"))
+	{
+		return CORRELATION_KERNEL_AVX2;
+	}
+
+	if(__builtin_cpu_supports("sse2"))
+	{
+		return CORRELATION_KERNEL_SSE2;
+	}
+#endif
+
+	return CORRELATION_KERNEL_SCALAR;
+}
+
+/* Returns the kernel used by pearsonCorrelation on this CPU. */
+int getCorrelationKernel()
+{
+	static const int kernel = detectCorrelationKernel();
+
+	return kernel;
+}
+
+const char* getCorrelationKernelName()
+{
+	switch(getCorrelationKernel())
+	{
+	case CORRELATION_KERNEL_AVX2:
+		return "AVX2";
+	case CORRELATION_KERNEL_SSE2:
+		return "SSE2";
+	default:
+		return "scalar";
+	}
+}
+
+/* Computes Pearson's product-moment correlation coefficient of x and y. */
+double pearsonCorrelation(const double* x, const double* y, int n)
+{
+	if(n < 2)
+	{
+		fprintf(stderr, "[pearsonCorrelation] Insufficient data. Number of elements at each data set must be >= 2.\n");
+		return CORRELATION_ERROR;
+	}
+
+	double sx, sy, sxx, syy, sxy;
+
+	switch(getCorrelationKernel())
+	{
+#if defined(__x86_64__) || defined(__i386__)
+	case CORRELATION_KERNEL_AVX2:
+		sumAVX2(x, y, n, &sx, &sy);
+		comomentAVX2(x, y, n, sx / n, sy / n, &sxx, &syy, &sxy);
+		break;
+	case CORRELATION_KERNEL_SSE2:
+		sumSSE2(x, y, n, &sx, &sy);
+		comomentSSE2(x, y, n, sx / n, sy / n, &sxx, &syy, &sxy);
+		break;
+#endif
+	default:
+		sumScalar(x, y, n, &sx, &sy);
+		comomentScalar(x, y, n, sx / n, sy / n, &sxx, &syy, &sxy);
+		break;
+	}
+
+	if((sxx <= 0) || (syy <= 0))
+	{
+		fprintf(stderr, "[pearsonCorrelation] The standard deviation is zero.\n");
+		return CORRELATION_ERROR;
+	}
+
+	double r = sxy / sqrt(sxx * syy);
+
+	// clamp rounding noise the same way R does
+	if(r > 1.0)
+	{
+		r = 1.0;
+	}
+	else if(r < -1.0)
+	{
+		r = -1.0;
+	}
+
+	return r;
+}
+
+/* Returns the dot product of x and y using the widest available kernel. */
+double dotProduct(const double* x, const double* y, int n)
+{
+	switch(getCorrelationKernel())
+	{
+#if defined(__x86_64__) || defined(__i386__)
+	case CORRELATION_KERNEL_AVX2:
+		return dotAVX2(x, y, n);
+	case CORRELATION_KERNEL_SSE2:
+		return dotSSE2(x, y, n);
+#endif
+	default:
+		return dotScalar(x, y, n);
+	}
+}
+
+/*
+The correlation matrix is evaluated as a GEMM on z-normalized rows: every
+series is centered and scaled to unit norm once, after which each entry of
+the result is a plain dot product. Rows are padded with zeros (length to a
+multiple of 4, x to a multiple of 2 rows, y to a multiple of 4 rows) so the
+2 x 4 micro-kernel never needs an edge case. The output is cut into tiles
+that worker threads pull from a shared counter; inside a tile the dot
+products are accumulated over blocks of MATRIX_BLOCK_LENGTH samples so the
+rows being reused stay in cache.
+*/
+
+struct CorrelationMatrixJob
+{
+	const double* x;
+	const double* y;
+	const bool* xValid;
+	const bool* yValid;
+	int ld;
+	int m;
+	int nSeries;
+	int tileRowCount;
+	int tileColCount;
+	int tileCount;
+	int nextTile;
+	double* r;
+};
+
+/* Centers v and scales it to unit norm into out (zero padded up to ld). Returns false for a constant series. */
+bool zNormalize(const double* v, int n, double* out, int ld)
+{
+	double mean = 0;
+	for(int i = 0; i < n; i++)
+	{
+		mean += v[i];
+	}
+	mean /= n;
+
+	double ss = 0;
+	for(int i = 0; i < n; i++)
+	{
+		out[i] = v[i] - mean;
+		ss += out[i] * out[i];
+	}
+
+	memset(out + n, 0, (ld - n) * sizeof(double));
+
+	if(ss <= 0)
+	{
+		memset(out, 0, n * sizeof(double));
+		return false;
+	}
+
+	double scale = 1.0 / sqrt(ss);
+	for(int i = 0; i < n; i++)
+	{
+		out[i] *= scale;
+	}
+
+	return true;
+}
+
+static void computeCorrelationTile(CorrelationMatrixJob* job, int tile)
+{
+	void (*kernel)(const double*, const double*, int, int, double*);
+
+	switch(getCorrelationKernel())
+	{
+#if defined(__x86_64__) || defined(__i386__)
+	case CORRELATION_KERNEL_AVX2:
+		kernel = dot2x4AVX2;
+		break;
+	case CORRELATION_KERNEL_SSE2:
+		kernel = dot2x4SSE2;
+		break;
+#endif
+	default:
+		kernel = dot2x4Scalar;
+		break;
+	}
+
+	int i0 = (tile / job->tileColCount) * MATRIX_TILE_ROWS;
+	int j0 = (tile % job->tileColCount) * MATRIX_TILE_COLS;
+	int i1 = i0 + MATRIX_TILE_ROWS;
+	int j1 = j0 + MATRIX_TILE_COLS;
+
+	if(i1 > job->m)
+	{
+		i1 = job->m + (job->m & 1);
+	}
+
+	if(j1 > job->nSeries)
+	{
+		j1 = job->nSeries + ((4 - (job->nSeries & 3)) & 3);
+	}
+
+	double sum[MATRIX_TILE_ROWS * MATRIX_TILE_COLS];
+	double acc[8];
+	int ld = job->ld;
+
+	memset(sum, 0, sizeof(sum));
+
+	for(int k = 0; k < ld; k += MATRIX_BLOCK_LENGTH)
+	{
+		int len = ((ld - k) < MATRIX_BLOCK_LENGTH) ? (ld - k) : MATRIX_BLOCK_LENGTH;
+
+		for(int i = i0; i < i1; i += 2)
+		{
+			for(int j = j0; j < j1; j += 4)
+			{
+				kernel(job->x + (size_t)i * ld + k, job->y + (size_t)j * ld + k, ld, len, acc);
+
+				double* s = &sum[(i - i0) * MATRIX_TILE_COLS + (j - j0)];
+				for(int a = 0; a < 4; a++)
+				{
+					s[a] += acc[a];
+					s[MATRIX_TILE_COLS + a] += acc[4 + a];
+				}
+			}
+		}
+	}
+
+	for(int i = i0; (i < i1) && (i < job->m); i++)
+	{
+		for(int j = j0; (j < j1) && (j < job->nSeries); j++)
+		{
+			double r = sum[(i - i0) * MATRIX_TILE_COLS + (j - j0)];
+
+			if((job->xValid[i] == false) || (job->yValid[j] == false))
+			{
+				r = CORRELATION_ERROR;
+			}
+			else if(r > 1.0)
+			{
+				r = 1.0;
+			}
+			else if(r < -1.0)
+			{
+				r = -1.0;
+			}
+
+			job->r[(size_t)i * job->nSeries + j] = r;
+		}
+	}
+}
+
+static void* correlationMatrixThreadFunction(void* arg)
+{
+	CorrelationMatrixJob* job = (CorrelationMatrixJob*)arg;
+
+	while(1)
+	{
+		int tile = __sync_fetch_and_add(&job->nextTile, 1);
+		if(tile >= job->tileCount)
+		{
+			break;
+		}
+
+		computeCorrelationTile(job, tile);
+	}
+
+	return NULL;
+}
+
+/*
+Computes the m x nSeries matrix of Pearson correlation coefficients between
+the series x[0..m-1] and y[0..nSeries-1], each of length n, into r (row-major,
+r[i * nSeries + j] = cor(x[i], y[j])). Pairs involving a constant series get
+CORRELATION_ERROR. threadCount <= 0 uses one thread per online CPU.
+Returns 0 on success and -1 on error.
+*/
+int calculateCorrelationMatrix(const double* const* x, int m, const double* const* y, int nSeries, int n, double* r, int threadCount)
+{
+	if(n < 2)
+	{
+		fprintf(stderr, "[calculateCorrelationMatrix] Insufficient data. Number of elements at each data set must be >= 2.\n");
+		return -1;
+	}
+
+	if((m <= 0) || (nSeries <= 0))
+	{
+		return 0;
+	}
+
+	int ld = (n + 3) & ~3;
+	int mPad = m + (m & 1);
+	int nPad = (nSeries + 3) & ~3;
+
+	double* xNorm = NULL;
+	double* yNorm = NULL;
+
+	if((posix_memalign((void**)&xNorm, 32, (size_t)mPad * ld * sizeof(double)) != 0)
+			|| (posix_memalign((void**)&yNorm, 32, (size_t)nPad * ld * sizeof(double)) != 0))
+	{
+		fprintf(stderr, "[calculateCorrelationMatrix] Memory allocation error.\n");
+		free(xNorm);
+		return -1;
+	}
+
+	bool* xValid = new bool[m];
+	bool* yValid = new bool[nSeries];
+
+	for(int i = 0; i < m; i++)
+	{
+		xValid[i] = zNormalize(x[i], n, xNorm + (size_t)i * ld, ld);
+	}
+
+	for(int j = 0; j < nSeries; j++)
+	{
+		yValid[j] = zNormalize(y[j], n, yNorm + (size_t)j * ld, ld);
+	}
+
+	memset(xNorm + (size_t)m * ld, 0, (size_t)(mPad - m) * ld * sizeof(double));
+	memset(yNorm + (size_t)nSeries * ld, 0, (size_t)(nPad - nSeries) * ld * sizeof(double));
+
+	CorrelationMatrixJob job;
+	job.x = xNorm;
+	job.y = yNorm;
+	job.xValid = xValid;
+	job.yValid = yValid;
+	job.ld = ld;
+	job.m = m;
+	job.nSeries = nSeries;
+	job.tileRowCount = (m + MATRIX_TILE_ROWS - 1) / MATRIX_TILE_ROWS;
+	job.tileColCount = (nSeries + MATRIX_TILE_COLS - 1) / MATRIX_TILE_COLS;
+	job.tileCount = job.tileRowCount * job.tileColCount;
+	job.nextTile = 0;
+	job.r = r;
+
+	if(threadCount <= 0)
+	{
+		threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	if(threadCount > job.tileCount)
+	{
+		threadCount = job.tileCount;
+	}
+
+	if(threadCount <= 1)
+	{
+		correlationMatrixThreadFunction(&job);
+	}
+	else
+	{
+		pthread_t* threads = new pthread_t[threadCount - 1];
+
+		for(int t = 0; t < threadCount - 1; t++)
+		{
+			createThread(&threads[t], correlationMatrixThreadFunction, &job, PTHREAD_CREATE_JOINABLE);
+		}
+
+		correlationMatrixThreadFunction(&job); // the calling thread is one of the workers
+
+		for(int t = 0; t < threadCount - 1; t++)
+		{
+			pthread_join(threads[t], NULL);
+		}
+
+		delete [] threads;
+	}
+
+	delete [] xValid;
+	delete [] yValid;
+	free(xNorm);
+	free(yNorm);
+
+	return 0;
+}
+
+/*
+Computes the Pearson correlation between x[i] and y[i + lag] over the
+overlapping samples for every lag in [-maxLag, maxLag] into r, where
+r[maxLag + lag] holds the coefficient for lag (a positive lag means y trails
+x). All cross products come from one FFT-based circular correlation of the
+zero-padded series, so the cost is O(n log n) regardless of maxLag; the
+per-lag means and variances come from prefix sums. Lags whose overlap is a
+constant series get CORRELATION_ERROR. Returns 0 on success and -1 on error.
+*/
+int crossCorrelation(const double* x, const double* y, int n, int maxLag, double* r)
+{
+	if(n < 2)
+	{
+		fprintf(stderr, "[crossCorrelation] Insufficient data. Number of elements at each data set must be >= 2.\n");
+		return -1;
+	}
+
+	if((maxLag < 0) || (maxLag > n - 2))
+	{
+		fprintf(stderr, "[crossCorrelation] Invalid maximum lag %d. Must be in [0, %d].\n", maxLag, n - 2);
+		return -1;
+	}
+
+	// center both series first so that the sums below do not cancel catastrophically
+	double mx = 0, my = 0;
+	for(int i = 0; i < n; i++)
+	{
+		mx += x[i];
+		my += y[i];
+	}
+	mx /= n;
+	my /= n;
+
+	int len = nextPowerOfTwo(2 * n);
+	vector< complex<double> > fx(len), fy(len);
+
+	vector<double> px(n + 1, 0), pxx(n + 1, 0), py(n + 1, 0), pyy(n + 1, 0);
+
+	for(int i = 0; i < n; i++)
+	{
+		double a = x[i] - mx;
+		double b = y[i] - my;
+
+		fx[i] = a;
+		fy[i] = b;
+
+		px[i + 1] = px[i] + a;
+		pxx[i + 1] = pxx[i] + a * a;
+		py[i + 1] = py[i] + b;
+		pyy[i + 1] = pyy[i] + b * b;
+	}
+
+	fft(&fx[0], len, false);
+	fft(&fy[0], len, false);
+
+	for(int k = 0; k < len; k++)
+	{
+		fx[k] = conj(fx[k]) * fy[k];
+	}
+
+	fft(&fx[0], len, true); // fx[lag mod len] = sum over i of x[i] * y[i + lag]
+
+	for(int lag = -maxLag; lag <= maxLag; lag++)
+	{
+		int m = n - ((lag >= 0) ? lag : -lag);
+		int x0 = (lag >= 0) ? 0 : -lag;
+		int y0 = (lag >= 0) ? lag : 0;
+
+		double sx = px[x0 + m] - px[x0];
+		double sxx = pxx[x0 + m] - pxx[x0];
+		double sy = py[y0 + m] - py[y0];
+		double syy = pyy[y0 + m] - pyy[y0];
+		double sxy = fx[(lag >= 0) ? lag : (len + lag)].real();
+
+		double vx = sxx - sx * sx / m;
+		double vy = syy - sy * sy / m;
+		double c = sxy - sx * sy / m;
+
+		if((vx <= 0) || (vy <= 0))
+		{
+			r[maxLag + lag] = CORRELATION_ERROR;
+			continue;
+		}
+
+		double v = c / sqrt(vx * vy);
+
+		if(v > 1.0)
+		{
+			v = 1.0;
+		}
+		else if(v < -1.0)
+		{
+			v = -1.0;
+		}
+
+		r[maxLag + lag] = v;
+	}
+
+	return 0;
+}
+
+/* Returns the highest lagged correlation within [-maxLag, maxLag] and stores its lag in bestLag. */
+double laggedCorrelation(const double* x, const double* y, int n, int maxLag, int* bestLag)
+{
+	vector<double> r(2 * ((maxLag > 0) ? maxLag : 0) + 1);
+
+	if(crossCorrelation(x, y, n, maxLag, &r[0]) == -1)
+	{
+		return CORRELATION_ERROR;
+	}
+
+	double best = CORRELATION_ERROR;
+	int lag = 0;
+
+	for(int i = -maxLag; i <= maxLag; i++)
+	{
+		double v = r[maxLag + i];
+
+		// prefer the smallest absolute lag among equal coefficients
+		if((v > best) || ((v == best) && (abs(i) < abs(lag))))
+		{
+			best = v;
+			lag = i;
+		}
+	}
+
+	if(bestLag != NULL)
+	{
+		*bestLag = lag;
+	}
+
+	return best;
+}
+
+struct RankOrder
+{
+	const double* v;
+
+	RankOrder(const double* values) : v(values) {}
+
+	bool operator()(int a, int b) const
+	{
+		return v[a] < v[b];
+	}
+};
+
+/* Ranks x into rank (1-based), giving tied values the average of their ranks like R's rank(). */
+void rankAverage(const double* x, int n, double* rank)
+{
+	vector<int> order(n);
+	for(int i = 0; i < n; i++)
+	{
+		order[i] = i;
+	}
+
+	sort(order.begin(), order.end(), RankOrder(x));
+
+	for(int i = 0; i < n; )
+	{
+		int j = i + 1;
+
+		while((j < n) && (x[order[j]] == x[order[i]]))
+		{
+			++j;
+		}
+
+		double r = (i + 1 + j) / 2.0; // average of ranks i + 1 .. j
+
+		for(int k = i; k < j; k++)
+		{
+			rank[order[k]] = r;
+		}
+
+		i = j;
+	}
+}
+
+/* Computes Spearman's rank correlation coefficient (Pearson's r on average ranks, as R does). */
+double spearmanCorrelation(const double* x, const double* y, int n)
+{
+	if(n < 2)
+	{
+		fprintf(stderr, "[spearmanCorrelation] Insufficient data. Number of elements at each data set must be >= 2.\n");
+		return CORRELATION_ERROR;
+	}
+
+	vector<double> rx(n), ry(n);
+
+	rankAverage(x, n, &rx[0]);
+	rankAverage(y, n, &ry[0]);
+
+	return pearsonCorrelation(&rx[0], &ry[0], n);
+}
+
+struct PairOrder
+{
+	const double* x;
+	const double* y;
+
+	PairOrder(const double* a, const double* b) : x(a), y(b) {}
+
+	bool operator()(int a, int b) const
+	{
+		return (x[a] < x[b]) || ((x[a] == x[b]) && (y[a] < y[b]));
+	}
+};
+
+/* Number of pairs within runs of equal values of v over the index list idx (which must be grouped by value). */
+static long long countTiedPairs(const double* v, const int* idx, int n)
+{
+	long long ties = 0;
+
+	for(int i = 0; i < n; )
+	{
+		int j = i + 1;
+
+		while((j < n) && (v[idx[j]] == v[idx[i]]))
+		{
+			++j;
+		}
+
+		ties += (long long)(j - i) * (j - i - 1) / 2;
+		i = j;
+	}
+
+	return ties;
+}
+
+/* Stable merge sort of idx by y[idx[.]] that returns the number of inversions (swaps) it had to undo. */
+static long long mergeSortCountingSwaps(const double* y, int* idx, int* tmp, int n)
+{
+	if(n < 2)
+	{
+		return 0;
+	}
+
+	int half = n / 2;
+	long long swaps = mergeSortCountingSwaps(y, idx, tmp, half) + mergeSortCountingSwaps(y, idx + half, tmp, n - half);
+
+	int i = 0, j = half, k = 0;
+
+	while((i < half) && (j < n))
+	{
+		if(y[idx[j]] < y[idx[i]])
+		{
+			swaps += half - i; // idx[j] jumps over every remaining element of the left half
+			tmp[k++] = idx[j++];
+		}
+		else
+		{
+			tmp[k++] = idx[i++];
+		}
+	}
+
+	while(i < half)
+	{
+		tmp[k++] = idx[i++];
+	}
+
+	while(j < n)
+	{
+		tmp[k++] = idx[j++];
+	}
+
+	memcpy(idx, tmp, n * sizeof(int));
+
+	return swaps;
+}
+
+/*
+Computes Kendall's tau-b, which is what R's cor(method = "kendall") returns
+in the presence of ties, in O(n log n) with Knight's algorithm: sort the
+pairs by (x, y), count ties in x and joint ties, then merge sort by y while
+counting the swaps, which equal the number of discordant pairs.
+*/
+double kendallCorrelation(const double* x, const double* y, int n)
+{
+	if(n < 2)
+	{
+		fprintf(stderr, "[kendallCorrelation] Insufficient data. Number of elements at each data set must be >= 2.\n");
+		return CORRELATION_ERROR;
+	}
+
+	vector<int> idx(n), tmp(n);
+	for(int i = 0; i < n; i++)
+	{
+		idx[i] = i;
+	}
+
+	sort(idx.begin(), idx.end(), PairOrder(x, y));
+
+	long long n0 = (long long)n * (n - 1) / 2;
+	long long n1 = countTiedPairs(x, &idx[0], n); // pairs tied in x
+	long long n3 = 0; // pairs tied in both x and y
+
+	for(int i = 0; i < n; )
+	{
+		int j = i + 1;
+
+		while((j < n) && (x[idx[j]] == x[idx[i]]) && (y[idx[j]] == y[idx[i]]))
+		{
+			++j;
+		}
+
+		n3 += (long long)(j - i) * (j - i - 1) / 2;
+		i = j;
+	}
+
+	long long swaps = mergeSortCountingSwaps(y, &idx[0], &tmp[0], n);
+	long long n2 = countTiedPairs(y, &idx[0], n); // pairs tied in y
+
+	if((n0 == n1) || (n0 == n2))
+	{
+		fprintf(stderr, "[kendallCorrelation] The standard deviation is zero.\n");
+		return CORRELATION_ERROR;
+	}
+
+	double s = (double)(n0 - n1 - n2 + n3) - 2.0 * (double)swaps;
+	double tau = s / sqrt((double)(n0 - n1) * (double)(n0 - n2));
+
+	if(tau > 1.0)
+	{
+		tau = 1.0;
+	}
+	else if(tau < -1.0)
+	{
+		tau = -1.0;
+	}
+
+	return tau;
+}
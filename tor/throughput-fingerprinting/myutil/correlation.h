@@ -0,0 +1,27 @@
+#ifndef CORRELATION_H_
+#define CORRELATION_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#define CORRELATION_ERROR -2.0
+
+#define CORRELATION_KERNEL_SCALAR	0
+#define CORRELATION_KERNEL_SSE2		1
+#define CORRELATION_KERNEL_AVX2		2
+
+double pearsonCorrelation(const double* x, const double* y, int n);
+double dotProduct(const double* x, const double* y, int n);
+bool zNormalize(const double* v, int n, double* out, int ld);
+int calculateCorrelationMatrix(const double* const* x, int m, const double* const* y, int nSeries, int n, double* r, int threadCount);
+int crossCorrelation(const double* x, const double* y, int n, int maxLag, double* r);
+double laggedCorrelation(const double* x, const double* y, int n, int maxLag, int* bestLag);
+
+void rankAverage(const double* x, int n, double* rank);
+double spearmanCorrelation(const double* x, const double* y, int n);
+double kendallCorrelation(const double* x, const double* y, int n);
+
+int getCorrelationKernel();
+const char* getCorrelationKernelName();
+
+#endif /* CORRELATION_H_ */
@@ -0,0 +1,340 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "correlation.h"
+#include "dtw.h"
+
+using namespace std;
+
+/*
+Dynamic time warping with a Sakoe-Chiba band of +/- window samples, squared
+point costs and the usual pruning of the UCR suite: the LB_Keogh lower bound
+of a candidate against the query envelope rules out most candidates, and the
+per-sample LB_Keogh terms of a survivor bound the cost still to come while
+its DTW matrix is filled, so the computation is abandoned as soon as it can
+no longer beat the best distance so far. All distances are squared.
+*/
+
+#define LB_KEOGH_ABANDON_STRIDE 64
+
+/* Computes the running min/max of x over [i - window, i + window] in O(n) (Lemire's streaming algorithm). */
+void computeEnvelope(const double* x, int n, int window, double* lower, double* upper)
+{
+	vector<int> minQueue(n), maxQueue(n);
+	int minHead = 0, minTail = 0, maxHead = 0, maxTail = 0;
+
+	for(int i = 0; i < n + window; i++)
+	{
+		if(i < n)
+		{
+			while((minTail > minHead) && (x[minQueue[minTail - 1]] >= x[i]))
+			{
+				--minTail;
+			}
+			minQueue[minTail++] = i;
+
+			while((maxTail > maxHead) && (x[maxQueue[maxTail - 1]] <= x[i]))
+			{
+				--maxTail;
+			}
+			maxQueue[maxTail++] = i;
+		}
+
+		int j = i - window; // the window centered at j is now complete
+		if(j < 0)
+		{
+			continue;
+		}
+
+		while(minQueue[minHead] < j - window)
+		{
+			++minHead;
+		}
+
+		while(maxQueue[maxHead] < j - window)
+		{
+			++maxHead;
+		}
+
+		lower[j] = x[minQueue[minHead]];
+		upper[j] = x[maxQueue[maxHead]];
+	}
+}
+
+static double lbKeoghScalar(const double* c, const double* lower, const double* upper, int n, double bestSoFar, double* contribution)
+{
+	double lb = 0;
+
+	for(int i = 0; i < n; i++)
+	{
+		double d = 0;
+
+		if(c[i] > upper[i])
+		{
+			d = c[i] - upper[i];
+		}
+		else if(c[i] < lower[i])
+		{
+			d = lower[i] - c[i];
+		}
+
+		contribution[i] = d * d;
+		lb += d * d;
+
+		if(((i % LB_KEOGH_ABANDON_STRIDE) == 0) && (lb >= bestSoFar))
+		{
+			return lb;
+		}
+	}
+
+	return lb;
+}
+
+static void dtwRowScalar(double xi, const double* y, const double* prev, int count, double* dist, double* diagUp)
+{
+	for(int j = 0; j < count; j++)
+	{
+		double d = xi - y[j];
+
+		dist[j] = d * d;
+		diagUp[j] = (prev[j] < prev[j + 1]) ? prev[j] : prev[j + 1];
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+static double lbKeoghSSE2(const double* c, const double* lower, const double* upper, int n, double bestSoFar, double* contribution)
+{
+	__m128d zero = _mm_setzero_pd();
+	__m128d acc = _mm_setzero_pd();
+	int i = 0;
+
+	while(i + 2 <= n)
+	{
+		int end = i + LB_KEOGH_ABANDON_STRIDE;
+		if(end > n)
+		{
+			end = n;
+		}
+
+		for(; i + 2 <= end; i += 2)
+		{
+			__m128d v = _mm_loadu_pd(c + i);
+			__m128d d = _mm_add_pd(_mm_max_pd(_mm_sub_pd(v, _mm_loadu_pd(upper + i)), zero), _mm_max_pd(_mm_sub_pd(_mm_loadu_pd(lower + i), v), zero));
+			d = _mm_mul_pd(d, d);
+
+			_mm_storeu_pd(contribution + i, d);
+			acc = _mm_add_pd(acc, d);
+		}
+
+		double lb = _mm_cvtsd_f64(_mm_add_sd(acc, _mm_unpackhi_pd(acc, acc)));
+		if(lb >= bestSoFar)
+		{
+			return lb;
+		}
+	}
+
+	double lb = _mm_cvtsd_f64(_mm_add_sd(acc, _mm_unpackhi_pd(acc, acc)));
+
+	return lb + lbKeoghScalar(c + i, lower + i, upper + i, n - i, DTW_INFINITY, contribution + i);
+}
+
+__attribute__((target("sse2")))
+static void dtwRowSSE2(double xi, const double* y, const double* prev, int count, double* dist, double* diagUp)
+{
+	__m128d vx = _mm_set1_pd(xi);
+	int j = 0;
+
+	for(; j + 2 <= count; j += 2)
+	{
+		__m128d d = _mm_sub_pd(vx, _mm_loadu_pd(y + j));
+
+		_mm_storeu_pd(dist + j, _mm_mul_pd(d, d));
+		_mm_storeu_pd(diagUp + j, _mm_min_pd(_mm_loadu_pd(prev + j), _mm_loadu_pd(prev + j + 1)));
+	}
+
+	dtwRowScalar(xi, y + j, prev + j, count - j, dist + j, diagUp + j);
+}
+
+__attribute__((target("avx2")))
+static double lbKeoghAVX2(const double* c, const double* lower, const double* upper, int n, double bestSoFar, double* contribution)
+{
+	__m256d zero = _mm256_setzero_pd();
+	__m256d acc = _mm256_setzero_pd();
+	int i = 0;
+
+	while(i + 4 <= n)
+	{
+		int end = i + LB_KEOGH_ABANDON_STRIDE;
+		if(end > n)
+		{
+			end = n;
+		}
+
+		for(; i + 4 <= end; i += 4)
+		{
+			__m256d v = _mm256_loadu_pd(c + i);
+			__m256d d = _mm256_add_pd(_mm256_max_pd(_mm256_sub_pd(v, _mm256_loadu_pd(upper + i)), zero), _mm256_max_pd(_mm256_sub_pd(_mm256_loadu_pd(lower + i), v), zero));
+			d = _mm256_mul_pd(d, d);
+
+			_mm256_storeu_pd(contribution + i, d);
+			acc = _mm256_add_pd(acc, d);
+		}
+
+		__m128d h = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+		double lb = _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+		if(lb >= bestSoFar)
+		{
+			return lb;
+		}
+	}
+
+	__m128d h = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+	double lb = _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+
+	return lb + lbKeoghScalar(c + i, lower + i, upper + i, n - i, DTW_INFINITY, contribution + i);
+}
+
+__attribute__((target("avx2")))
+static void dtwRowAVX2(double xi, const double* y, const double* prev, int count, double* dist, double* diagUp)
+{
+	__m256d vx = _mm256_set1_pd(xi);
+	int j = 0;
+
+	for(; j + 4 <= count; j += 4)
+	{
+		__m256d d = _mm256_sub_pd(vx, _mm256_loadu_pd(y + j));
+
+		_mm256_storeu_pd(dist + j, _mm256_mul_pd(d, d));
+		_mm256_storeu_pd(diagUp + j, _mm256_min_pd(_mm256_loadu_pd(prev + j), _mm256_loadu_pd(prev + j + 1)));
+	}
+
+	dtwRowScalar(xi, y + j, prev + j, count - j, dist + j, diagUp + j);
+}
+
+#endif
+
+/*
+LB_Keogh lower bound of the squared DTW distance between candidate c and the
+series whose envelope is (lower, upper). The per-sample terms are stored in
+contribution. The sum is abandoned (and a partial value >= bestSoFar is
+returned) once it reaches bestSoFar.
+*/
+double lbKeogh(const double* c, const double* lower, const double* upper, int n, double bestSoFar, double* contribution)
+{
+	switch(getCorrelationKernel())
+	{
+#if defined(__x86_64__) || defined(__i386__)
+	case CORRELATION_KERNEL_AVX2:
+		return lbKeoghAVX2(c, lower, upper, n, bestSoFar, contribution);
+	case CORRELATION_KERNEL_SSE2:
+		return lbKeoghSSE2(c, lower, upper, n, bestSoFar, contribution);
+#endif
+	default:
+		return lbKeoghScalar(c, lower, upper, n, bestSoFar, contribution);
+	}
+}
+
+/* Turns LB_Keogh terms into suffix sums: cumulativeBound[i] = sum of contribution[i..n-1], cumulativeBound[n] = 0. */
+void cumulateBound(const double* contribution, int n, double* cumulativeBound)
+{
+	cumulativeBound[n] = 0;
+
+	for(int i = n - 1; i >= 0; i--)
+	{
+		cumulativeBound[i] = cumulativeBound[i + 1] + contribution[i];
+	}
+}
+
+/*
+Squared DTW distance between x and y (both of length n) within a band of
++/- window samples. cumulativeBound (n + 1 entries, from cumulateBound() on
+the LB_Keogh terms of y against the envelope of x) may be NULL. Returns
+DTW_INFINITY if the distance is certain to be >= bestSoFar.
+*/
+double dtwDistance(const double* x, const double* y, int n, int window, double bestSoFar, const double* cumulativeBound)
+{
+	if(window < 0)
+	{
+		window = 0;
+	}
+
+	if(window > n - 1)
+	{
+		window = n - 1;
+	}
+
+	void (*row)(double, const double*, const double*, int, double*, double*);
+
+	switch(getCorrelationKernel())
+	{
+#if defined(__x86_64__) || defined(__i386__)
+	case CORRELATION_KERNEL_AVX2:
+		row = dtwRowAVX2;
+		break;
+	case CORRELATION_KERNEL_SSE2:
+		row = dtwRowSSE2;
+		break;
+#endif
+	default:
+		row = dtwRowScalar;
+		break;
+	}
+
+	// cost rows are shifted by one: index k holds column k - 1, index 0 is the boundary column
+	vector<double> prev(n + 1, DTW_INFINITY), cur(n + 1, DTW_INFINITY);
+	vector<double> dist(2 * window + 1), diagUp(2 * window + 1);
+
+	prev[0] = 0;
+
+	for(int i = 0; i < n; i++)
+	{
+		int jLow = (i - window > 0) ? (i - window) : 0;
+		int jHigh = (i + window < n - 1) ? (i + window) : (n - 1);
+		int count = jHigh - jLow + 1;
+
+		// the point costs and min(diagonal, up) do not depend on each other; only the left neighbor is serial
+		row(x[i], y + jLow, &prev[jLow], count, &dist[0], &diagUp[0]);
+
+		double left = DTW_INFINITY;
+		double rowMin = DTW_INFINITY;
+
+		cur[jLow] = DTW_INFINITY;
+
+		for(int j = 0; j < count; j++)
+		{
+			double m = (diagUp[j] < left) ? diagUp[j] : left;
+
+			left = dist[j] + m;
+			cur[jLow + j + 1] = left;
+
+			if(left < rowMin)
+			{
+				rowMin = left;
+			}
+		}
+
+		// columns beyond i + window have not been reached yet; their LB_Keogh terms are still to be paid
+		double remaining = 0;
+		if((cumulativeBound != NULL) && (i + window + 1 < n))
+		{
+			remaining = cumulativeBound[i + window + 1];
+		}
+
+		if(rowMin + remaining >= bestSoFar)
+		{
+			return DTW_INFINITY;
+		}
+
+		prev.swap(cur);
+	}
+
+	return prev[n];
+}
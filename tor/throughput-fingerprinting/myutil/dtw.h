@@ -0,0 +1,15 @@
+#ifndef DTW_H_
+#define DTW_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <cmath>
+
+#define DTW_INFINITY HUGE_VAL
+
+void computeEnvelope(const double* x, int n, int window, double* lower, double* upper);
+double lbKeogh(const double* c, const double* lower, const double* upper, int n, double bestSoFar, double* contribution);
+void cumulateBound(const double* contribution, int n, double* cumulativeBound);
+double dtwDistance(const double* x, const double* y, int n, int window, double bestSoFar, const double* cumulativeBound);
+
+#endif /* DTW_H_ */
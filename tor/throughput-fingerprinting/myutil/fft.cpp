@@ -0,0 +1,75 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include "fft.h"
+
+using namespace std;
+
+/* Returns the smallest power of two that is >= n. */
+int nextPowerOfTwo(int n)
+{
+	int p = 1;
+
+	while(p < n)
+	{
+		p <<= 1;
+	}
+
+	return p;
+}
+
+/* In-place iterative radix-2 FFT; n must be a power of two. The inverse transform is scaled by 1/n. */
+void fft(complex<double>* a, int n, bool inverse)
+{
+	// bit-reversal permutation
+	for(int i = 1, j = 0; i < n; i++)
+	{
+		int bit = n >> 1;
+
+		for(; j & bit; bit >>= 1)
+		{
+			j ^= bit;
+		}
+
+		j ^= bit;
+
+		if(i < j)
+		{
+			swap(a[i], a[j]);
+		}
+	}
+
+	// twiddle factors are computed directly rather than by repeated multiplication to keep long transforms accurate
+	vector< complex<double> > roots(n / 2 + 1);
+	for(int k = 0; k < n / 2; k++)
+	{
+		roots[k] = polar(1.0, 2 * M_PI * k / n * (inverse ? 1 : -1));
+	}
+
+	for(int len = 2; len <= n; len <<= 1)
+	{
+		int stride = n / len;
+
+		for(int i = 0; i < n; i += len)
+		{
+			for(int j = 0; j < len / 2; j++)
+			{
+				complex<double> u = a[i + j];
+				complex<double> v = a[i + j + len / 2] * roots[j * stride];
+
+				a[i + j] = u + v;
+				a[i + j + len / 2] = u - v;
+			}
+		}
+	}
+
+	if(inverse)
+	{
+		for(int i = 0; i < n; i++)
+		{
+			a[i] /= n;
+		}
+	}
+}
@@ -0,0 +1,11 @@
+#ifndef FFT_H_
+#define FFT_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <complex>
+
+int nextPowerOfTwo(int n);
+void fft(std::complex<double>* a, int n, bool inverse);
+
+#endif /* FFT_H_ */
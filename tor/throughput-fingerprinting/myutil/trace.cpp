@@ -0,0 +1,259 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include "trace.h"
+#include "TraceFile.h"
+
+using namespace std;
+
+/*
+Parses one line of a throughput trace written by tor-app-client or
+tor-node-throughput-calc, i.e. "... Time <t> Throughput(KBps) <tp> Goodput(KBps) <gp> ...".
+The relay fields (Middleman, Exit, MiddlemanFP) are filled in when present.
+Returns false for lines without a throughput value (log messages).
+*/
+static bool parseTraceLine(char* line, TraceSample& sample, string& middleman, string& exit, string& fingerprint)
+{
+	bool hasThroughput = false;
+
+	sample.time = 0;
+	sample.throughput = 0;
+	sample.goodput = 0;
+
+	// tokenized in place with strtok_r; StringTokenizer is too slow for multi-million line files
+	char* savePtr;
+	char* token = strtok_r(line, " \r\n", &savePtr);
+
+	while(token != NULL)
+	{
+		char* value = strtok_r(NULL, " \r\n", &savePtr);
+		if(value == NULL)
+		{
+			break;
+		}
+
+		if(strcmp(token, "Time") == 0)
+		{
+			sample.time = atof(value);
+		}
+		else if(strcmp(token, "Throughput(KBps)") == 0)
+		{
+			sample.throughput = atof(value);
+			hasThroughput = true;
+		}
+		else if(strcmp(token, "Goodput(KBps)") == 0)
+		{
+			sample.goodput = atof(value);
+		}
+		else if(strcmp(token, "Middleman") == 0)
+		{
+			middleman = value;
+		}
+		else if(strcmp(token, "Exit") == 0)
+		{
+			exit = value;
+		}
+		else if(strcmp(token, "MiddlemanFP") == 0)
+		{
+			fingerprint = value;
+		}
+		else
+		{
+			// not a key we know; treat the value as the next key
+			token = value;
+			continue;
+		}
+
+		token = strtok_r(NULL, " \r\n", &savePtr);
+	}
+
+	return hasThroughput;
+}
+
+/*
+Appends the samples of trace in a binary trace file to samples.
+*/
+static void appendSamples(const TraceFile& traceFile, int trace, vector<TraceSample>& samples)
+{
+	const double* times = traceFile.getTimes(trace);
+	const double* throughputs = traceFile.getThroughputs(trace);
+	const double* goodputs = traceFile.getGoodputs(trace);
+	int sampleCount = traceFile.getHeader(trace)->sampleCount;
+
+	samples.reserve(samples.size() + sampleCount);
+	for(int i = 0; i < sampleCount; i++)
+	{
+		TraceSample sample;
+		sample.time = times[i];
+		sample.throughput = throughputs[i];
+		sample.goodput = goodputs[i];
+
+		samples.push_back(sample);
+	}
+}
+
+/*
+Reads a single throughput trace, text or binary (TraceFile.h). Lines without a
+throughput value are skipped and every trace of a binary file is read. Returns
+the number of samples appended to samples, or -1 on error.
+*/
+int readTraceFile(const string& fileName, vector<TraceSample>& samples)
+{
+	if(isTraceFile(fileName.c_str()) == true)
+	{
+		TraceFile traceFile;
+		if(traceFile.open(fileName.c_str()) == -1)
+		{
+			return -1;
+		}
+
+		int first = samples.size();
+		for(int i = 0; i < traceFile.getTraceCount(); i++)
+		{
+			appendSamples(traceFile, i, samples);
+		}
+
+		return samples.size() - first;
+	}
+
+	FILE* inFile = fopen(fileName.c_str(), "r");
+	if(inFile == NULL)
+	{
+		fprintf(stderr, "[readTraceFile] Cannot open file %s for input.\n", fileName.c_str());
+		return -1;
+	}
+
+	char buffer[MAX_BUFFER_SIZE];
+	int count = 0;
+
+	while(fgets(buffer, MAX_BUFFER_SIZE, inFile) != NULL)
+	{
+		TraceSample sample;
+		string middleman, exit, fingerprint;
+
+		if(parseTraceLine(buffer, sample, middleman, exit, fingerprint) == true)
+		{
+			samples.push_back(sample);
+			++count;
+		}
+	}
+
+	if(ferror(inFile) != 0)
+	{
+		fprintf(stderr, "[readTraceFile] Error in reading input file %s.\n", fileName.c_str());
+		fclose(inFile);
+		return -1;
+	}
+
+	fclose(inFile);
+
+	return count;
+}
+
+/*
+Reads the per-interval output of tor-node-throughput-calc, all-tp-gp-data.txt
+or its binary form all-tp-gp-data.bin, and splits it into one trace per
+(middleman, exit) pair, in order of first appearance. Returns the number of
+traces appended to traces, or -1 on error.
+*/
+int readRelayTraceFile(const string& fileName, vector<RelayTrace>& traces)
+{
+	map<string, int> traceIndex;
+	int first = traces.size();
+
+	if(isTraceFile(fileName.c_str()) == true)
+	{
+		TraceFile traceFile;
+		if(traceFile.open(fileName.c_str()) == -1)
+		{
+			return -1;
+		}
+
+		for(int i = 0; i < traceFile.getTraceCount(); i++)
+		{
+			const TraceFileHeader* header = traceFile.getHeader(i);
+			string middleman = header->middleman;
+			string exit = header->exit;
+			string fingerprint = header->fingerprint;
+
+			string key = ((fingerprint.size() > 0) ? fingerprint : middleman) + " " + exit;
+
+			map<string, int>::iterator it = traceIndex.find(key);
+			if(it == traceIndex.end())
+			{
+				RelayTrace trace;
+				trace.middleman = middleman;
+				trace.exit = exit;
+				trace.fingerprint = fingerprint;
+
+				traces.push_back(trace);
+				it = traceIndex.insert(make_pair(key, (int)traces.size() - 1)).first;
+			}
+
+			appendSamples(traceFile, i, traces[it->second].samples);
+		}
+
+		return traces.size() - first;
+	}
+
+	FILE* inFile = fopen(fileName.c_str(), "r");
+	if(inFile == NULL)
+	{
+		fprintf(stderr, "[readRelayTraceFile] Cannot open file %s for input.\n", fileName.c_str());
+		return -1;
+	}
+
+	char buffer[MAX_BUFFER_SIZE];
+	string currentKey;
+	int current = -1;
+
+	while(fgets(buffer, MAX_BUFFER_SIZE, inFile) != NULL)
+	{
+		TraceSample sample;
+		string middleman, exit, fingerprint;
+
+		if(parseTraceLine(buffer, sample, middleman, exit, fingerprint) == false)
+		{
+			continue;
+		}
+
+		string key = ((fingerprint.size() > 0) ? fingerprint : middleman) + " " + exit;
+
+		// consecutive lines almost always belong to the same relay
+		if((current == -1) || (key.compare(currentKey) != 0))
+		{
+			map<string, int>::iterator it = traceIndex.find(key);
+			if(it == traceIndex.end())
+			{
+				RelayTrace trace;
+				trace.middleman = middleman;
+				trace.exit = exit;
+				trace.fingerprint = fingerprint;
+
+				traces.push_back(trace);
+				it = traceIndex.insert(make_pair(key, (int)traces.size() - 1)).first;
+			}
+
+			current = it->second;
+			currentKey = key;
+		}
+
+		traces[current].samples.push_back(sample);
+	}
+
+	if(ferror(inFile) != 0)
+	{
+		fprintf(stderr, "[readRelayTraceFile] Error in reading input file %s.\n", fileName.c_str());
+		fclose(inFile);
+		return -1;
+	}
+
+	fclose(inFile);
+
+	return traces.size() - first;
+}
@@ -0,0 +1,31 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define MAX_BUFFER_SIZE 4096
+
+struct TraceSample
+{
+	double time;
+	double throughput;	// KBps
+	double goodput;		// KBps
+};
+
+struct RelayTrace
+{
+	string middleman;
+	string exit;
+	string fingerprint;
+	vector<TraceSample> samples;
+};
+
+int readTraceFile(const string& fileName, vector<TraceSample>& samples);
+int readRelayTraceFile(const string& fileName, vector<RelayTrace>& traces);
+
+#endif /* TRACE_H_ */
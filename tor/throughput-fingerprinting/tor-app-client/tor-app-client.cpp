@@ -12,12 +12,23 @@
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include <cmath>
+#include <sys/time.h>
+#include <time.h>
 #include <signal.h>
+#include <poll.h>
+#include <cerrno>
 #include <pcap.h>
 #include "../myutil/net.h"
 #include "../myutil/thread.h"
 #include "../myutil/socks.h"
 #include "../myutil/Packet.h"
+#include "../myutil/PacketRing.h"
+#include "../myutil/IntervalBinner.h"
+#include "../myutil/IntervalTimer.h"
+#include "../myutil/TraceFile.h"
+#include "../myutil/trace.h"
+#include "../myutil/CorrelationAccumulator.h"
 #include "tor-app-client.h"
 
 using namespace std;
@@ -29,14 +40,12 @@ static double secCounter = 0;
 static double measurementInterval = 0;
 static double measurementOffset = 0;
 
-static double pcapBytesReceived = 0;
-static double tcpBytesReceived = 0;
+static IntervalBinner* binner = NULL;	// throughput and goodput bins keyed on packet and recv timestamps
 
-static pthread_mutex_t pcapMutex;
-static pthread_mutex_t tcpMutex;
 static pthread_mutex_t fileMutex;
 
 static FILE* outFile = NULL;
+static TraceFileWriter* traceWriter = NULL;	// binary output in place of outFile
 
 static string guardNodeIPAddress = "";
 static string guardNodePort = "";
@@ -46,11 +55,69 @@ static struct bpf_program fp;	/* The compiled filter */
 
 static bool exitFlag = false;
 
+static int snapLength = BUFSIZ;		// PACKET_HEADER_SNAPLEN with -H
+static int captureBackend = CAPTURE_BACKEND_PCAP;
+static string captureDevice = "";	// pcap_lookupdev() when empty
+static PacketRing packetRing;
+static int64_t nextStatisticsBin = 1;	// the capture thread samples its statistics as this bin starts
+static struct pcap_stat lastStatistics;	// pcap_stats() counts are cumulative
+
+static string offlineFileName = "";	// capture file to replay instead of measuring live (-r)
+static bool replayStarted = false;
+static double replayLastTime = 0;
+
+static vector<TraceSample> vReferenceTrace;			// optional series to correlate against while measuring
+static CorrelationAccumulator referenceCorrelation;
+static unsigned int intervalCount = 0;
+
 int main(int argc, char** argv)
 {
+	int opt;
+
+	while((opt = getopt(argc, argv, "BHb:i:r:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'B':
+			traceWriter = new TraceFileWriter();
+			break;
+		case 'H':
+			snapLength = PACKET_HEADER_SNAPLEN;
+			break;
+		case 'b':
+			if(strcmp(optarg, "pcap") == 0)
+			{
+				captureBackend = CAPTURE_BACKEND_PCAP;
+			}
+			else if(strcmp(optarg, "ring") == 0)
+			{
+				captureBackend = CAPTURE_BACKEND_RING;
+			}
+			else
+			{
+				fprintf(stderr, "[TOR-APP-CLIENT] Invalid capture backend %s. Must be pcap or ring. Terminating process.\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'i':
+			captureDevice = optarg;
+			break;
+		case 'r':
+			offlineFileName = optarg;
+			break;
+		default:
+			exit(1);
+		}
+	}
+
+	// positional arguments start at argv[1] from here on
+	argv[optind - 1] = argv[0];
+	argc -= optind - 1;
+	argv += optind - 1;
+
 	if(argc < 12)
 	{
-		fprintf(stderr, "USAGE: %s <SOCKS IP address> <SOCKS port> <server IP address> <server port> <end host ID> <character> <duration (>= 0) (in seconds)> <measurement interval (> 0) (in seconds)> <measurement offset (>= 0) (in seconds)> <guard node IP address> <guard node port>\n", argv[0]);
+		fprintf(stderr, "USAGE: %s [-B (binary output)] [-H (capture headers only)] [-b <capture backend (pcap|ring)>] [-i <capture device>] [-r <capture file to replay>] <SOCKS IP address> <SOCKS port> <server IP address> <server port> <end host ID> <character> <duration (>= 0) (in seconds)> <measurement interval (> 0) (in seconds)> <measurement offset (>= 0) (in seconds)> <guard node IP address> <guard node port> [reference trace file]\n", argv[0]);
 		exit(1);
 	}
 
@@ -78,10 +145,32 @@ int main(int argc, char** argv)
 	guardNodeIPAddress = argv[10];
 	guardNodePort = argv[11];
 
-	createMutex(&pcapMutex);
-	createMutex(&tcpMutex);
+	if(argc > 12)
+	{
+		if(readTraceFile(argv[12], vReferenceTrace) <= 0)
+		{
+			fprintf(stderr, "[TOR-APP-CLIENT] Cannot read reference trace file %s. Terminating process.\n", argv[12]);
+			exit(1);
+		}
+		fprintf(stdout, "[TOR-APP-CLIENT] Read %u samples from reference trace file %s.\n", (unsigned int)vReferenceTrace.size(), argv[12]);
+	}
+
 	createMutex(&fileMutex);
 
+	double monitorPeriod = (measurementInterval > MONITOR_MIN_PERIOD) ? measurementInterval : MONITOR_MIN_PERIOD;
+	binner = new IntervalBinner(measurementInterval, (int)ceil((monitorPeriod + BIN_LAG) / measurementInterval) + 2, BIN_SERIES_COUNT);
+
+	if(offlineFileName.empty() == false)
+	{
+		openOutputFile(atoi(argv[5]), argv[6]);
+
+		replayTrace();
+
+		closeOutputFile();
+
+		return EXIT_SUCCESS;
+	}
+
 	tcpSocket = createSocket(SOCK_STREAM);
 
 	struct sigaction act;
@@ -192,14 +281,13 @@ int main(int argc, char** argv)
 	}
 	fprintf(stdout, "[TOR-APP-CLIENT] Sent client character to server.\n");
 
-	char fileName[MAX_BUFFER_SIZE];
-	snprintf(fileName, MAX_BUFFER_SIZE - 1, "client-%d-%s.txt", atoi(argv[5]), argv[6]);
+	openOutputFile(atoi(argv[5]), argv[6]);
 
-	outFile = fopen(fileName, "w");
-	if(outFile == NULL)
+	binner->start(getTime());
+
+	if(traceWriter != NULL)
 	{
-		fprintf(stderr, "[TOR-APP-CLIENT] Cannot open output file. Terminating process.\n");
-		exit(1);
+		traceWriter->beginTrace("", "", "", binner->getBinWidth(), binner->getOrigin());
 	}
 
 	pthread_t pcapThread;
@@ -227,9 +315,7 @@ int main(int argc, char** argv)
 				break;
 			}
 
-			pthread_mutex_lock(&tcpMutex);
-			tcpBytesReceived += res;
-			pthread_mutex_unlock(&tcpMutex);
+			binner->add(BIN_SERIES_TCP, getTime(), res);
 
 			// data[res - 1] = '\0';
 			// fprintf(stdout, "%s", data);
@@ -239,11 +325,7 @@ int main(int argc, char** argv)
 	close(tcpSocket);
 
 	pthread_mutex_lock(&fileMutex);
-	if(outFile != NULL)
-	{
-		fclose(outFile);
-		outFile = NULL;
-	}
+	closeOutputFile();
 	pthread_mutex_unlock(&fileMutex);
 
 	return EXIT_SUCCESS;
@@ -257,7 +339,12 @@ void* pcapThreadFunction(void* arg)
 	bpf_u_int32 net;				/* Our IP */
 
 	/* Define the device */
-	dev = pcap_lookupdev(errbuf);
+	dev = (char*)captureDevice.c_str();
+	if (captureDevice.empty())
+	{
+		dev = pcap_lookupdev(errbuf);
+	}
+
 	if (dev == NULL)
 	{
 		fprintf(stderr, "[pcapThreadFunction] Couldn't find default device: %s. Terminating process.\n", errbuf);
@@ -271,19 +358,23 @@ void* pcapThreadFunction(void* arg)
 		exit(1);
 	}
 
-	/* Open the session in non-promiscuous mode */
-	handle = pcap_open_live(dev, BUFSIZ, 0, 1000, errbuf);
+	/* Open the session in non-promiscuous mode; the ring backend only needs a handle to compile the filter */
+	if (captureBackend == CAPTURE_BACKEND_RING)
+	{
+		handle = pcap_open_dead(DLT_EN10MB, snapLength);
+	}
+	else
+	{
+		handle = pcap_open_live(dev, snapLength, 0, 1000, errbuf);
+	}
+
 	if (handle == NULL)
 	{
 		fprintf(stderr, "[pcapThreadFunction] Couldn't open device %s: %s. Terminating process.\n", dev, errbuf);
 		exit(1);
 	}
 
-	// char filter_exp[] = "host 128.174.240.149 and src port 22";	/* The filter expression */
-	string filter_exp = "host ";
-	filter_exp += guardNodeIPAddress;
-	filter_exp += " and src port ";
-	filter_exp += guardNodePort;
+	string filter_exp = getFilterExpression();
 
 	/* Compile and apply the filter */
 	if (pcap_compile(handle, &fp, (char*)filter_exp.c_str(), 0, net) == -1)
@@ -292,15 +383,68 @@ void* pcapThreadFunction(void* arg)
 		exit(1);
 	}
 
+	if (captureBackend == CAPTURE_BACKEND_RING)
+	{
+		if (packetRing.open(dev, snapLength, (const struct sock_filter*)fp.bf_insns, fp.bf_len, PACKET_RING_DEFAULT_BLOCK_SIZE, PACKET_RING_DEFAULT_BLOCK_COUNT) == -1)
+		{
+			fprintf(stderr, "[pcapThreadFunction] Couldn't open packet ring on device %s. Terminating process.\n", dev);
+			exit(1);
+		}
+
+		while (exitFlag == false)
+		{
+			if (packetRing.dispatch(got_frame, NULL, getStatisticsTimeout(getTime())) == -1)
+			{
+				fprintf(stderr, "[pcapThreadFunction] Packet ring capture failed. Terminating process.\n");
+				exit(1);
+			}
+
+			sampleCaptureStatistics(getTime());
+		}
+
+		packetRing.close();
+		pcap_freecode(&fp);
+		pcap_close(handle);
+
+		pthread_exit(NULL);
+	}
+
 	if (pcap_setfilter(handle, &fp) == -1)
 	{
 		fprintf(stderr, "[pcapThreadFunction] Couldn't install filter %s: %s. Terminating process.\n", filter_exp.c_str(), pcap_geterr(handle));
 		exit(1);
 	}
 
+	memset(&lastStatistics, 0, sizeof(lastStatistics));
+
+	/* The capture thread waits for packets itself, so it can sample the statistics when no packet arrives */
+	if (pcap_setnonblock(handle, 1, errbuf) == -1)
+	{
+		fprintf(stderr, "[pcapThreadFunction] Couldn't set device %s non-blocking: %s. Terminating process.\n", dev, errbuf);
+		exit(1);
+	}
+
+	struct pollfd pfd;
+	pfd.fd = pcap_get_selectable_fd(handle);
+	pfd.events = POLLIN;
+
 	/* Start packet capture */
+	while (exitFlag == false)
+	{
+		if ((poll(&pfd, 1, getStatisticsTimeout(getTime())) == -1) && (errno != EINTR))
+		{
+			fprintf(stderr, "[pcapThreadFunction] Couldn't wait for packets: %s. Terminating process.\n", strerror(errno));
+			exit(1);
+		}
+
+		if (pcap_dispatch(handle, -1, got_packet, NULL) == -1)
+		{
+			fprintf(stderr, "[pcapThreadFunction] Packet capture failed: %s. Terminating process.\n", pcap_geterr(handle));
+			exit(1);
+		}
 
-	pcap_loop(handle, -1, got_packet, NULL);
+		sampleCaptureStatistics(getTime());
+	}
 
 	/* And close the session */
 	pcap_freecode(&fp);
@@ -311,101 +455,291 @@ void* pcapThreadFunction(void* arg)
 
 void got_packet(unsigned char* args, const struct pcap_pkthdr* header, const unsigned char* packet)
 {
-	if(exitFlag == true)
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	double ts = header->ts.tv_sec + header->ts.tv_usec / 1000000.0;
+
+	PacketView p(packet, header->caplen, header->len);
+
+	//	fprintf(stdout, "Got packet, length: %d\n", p.getPayloadLength());
+
+	binner->add(BIN_SERIES_PCAP, ts, p.getPayloadLength());
+	binner->add(BIN_SERIES_CALLBACK, ts, getElapsedNanoseconds(&start));
+}
+
+void got_frame(void* arg, const struct timeval* ts, const unsigned char* frame, int captureLength, int length)
+{
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	double packetTime = ts->tv_sec + ts->tv_usec / 1000000.0;
+
+	PacketView p(frame, captureLength, length);
+
+	binner->add(BIN_SERIES_PCAP, packetTime, p.getPayloadLength());
+	binner->add(BIN_SERIES_CALLBACK, packetTime, getElapsedNanoseconds(&start));
+}
+
+/* Returns the milliseconds until the next statistics sample is due, at most CAPTURE_POLL_TIMEOUT. */
+int getStatisticsTimeout(double now)
+{
+	double due = binner->getOrigin() + nextStatisticsBin * binner->getBinWidth();
+	int timeout = (int)ceil((due - now) * 1000);
+
+	if (timeout < 0)
 	{
-		pcap_freecode(&fp);
-		pcap_close(handle);
+		return 0;
+	}
 
-		pthread_exit(NULL);
+	return (timeout < CAPTURE_POLL_TIMEOUT) ? timeout : CAPTURE_POLL_TIMEOUT;
+}
+
+/*
+Once now has passed the end of a bin, adds the packets received and dropped
+since the previous sample to the bin that just ended. Samples fall on the bin
+grid, not on packet arrivals, so a bin without packets still gets its drops;
+when the capture thread was late, the bins it missed are added to the last one.
+Only the capture thread calls it, so the capture handle is never used
+concurrently.
+*/
+void sampleCaptureStatistics(double now)
+{
+	int64_t bin = (int64_t)floor((now - binner->getOrigin()) / binner->getBinWidth());
+	if (bin < nextStatisticsBin)
+	{
+		return;
 	}
-	else
+
+	nextStatisticsBin = bin + 1;
+
+	// The middle of the bin that ended, clear of rounding at its edges
+	double ts = binner->getOrigin() + (bin - 0.5) * binner->getBinWidth();
+
+	if (captureBackend == CAPTURE_BACKEND_RING)
 	{
-		Packet p(packet, header->len);
+		unsigned int packets, drops;
+		if (packetRing.getStatistics(&packets, &drops) == -1)
+		{
+			return;
+		}
 
-		//	fprintf(stdout, "Got packet, length: %d\n", p.getPayloadLength());
+		binner->add(BIN_SERIES_RECEIVED, ts, packets);
+		binner->add(BIN_SERIES_DROPPED, ts, drops);
+		return;
+	}
 
-		pthread_mutex_lock(&pcapMutex);
-		pcapBytesReceived += p.getPayloadLength();
-		pthread_mutex_unlock(&pcapMutex);
+	struct pcap_stat stats;
+	if (pcap_stats(handle, &stats) == -1)
+	{
+		fprintf(stderr, "[sampleCaptureStatistics] Couldn't read capture statistics: %s.\n", pcap_geterr(handle));
+		return;
 	}
+
+	// Unsigned differences stay correct when the 32-bit counters wrap
+	binner->add(BIN_SERIES_RECEIVED, ts, stats.ps_recv - lastStatistics.ps_recv);
+	binner->add(BIN_SERIES_DROPPED, ts, stats.ps_drop - lastStatistics.ps_drop);
+	binner->add(BIN_SERIES_IFDROPPED, ts, stats.ps_ifdrop - lastStatistics.ps_ifdrop);
+
+	lastStatistics = stats;
 }
 
-void* tpgpMonitorThreadFunction(void* arg)
+/* Returns the CLOCK_MONOTONIC nanoseconds since start. */
+uint64_t getElapsedNanoseconds(const struct timespec* start)
 {
-	while(1)
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)(now.tv_sec - start->tv_sec) * 1000000000ULL + now.tv_nsec - start->tv_nsec;
+}
+
+/* Returns the filter that selects the guard-to-client packets, e.g. "host 128.174.240.149 and src port 22". */
+string getFilterExpression()
+{
+	string filter_exp = "host ";
+	filter_exp += guardNodeIPAddress;
+	filter_exp += " and src port ";
+	filter_exp += guardNodePort;
+
+	return filter_exp;
+}
+
+/*
+Regenerates the throughput series from a capture file as fast as it can be read.
+Bins start at the first matching packet and are closed by the timestamps of the
+packets that follow, so the result does not depend on the replay speed. No
+payload is received, so goodput is reported as 0.
+*/
+void replayTrace()
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+
+	handle = pcap_open_offline(offlineFileName.c_str(), errbuf);
+	if (handle == NULL)
 	{
-		if(exitFlag == true)
-		{
-			break;
-		}
+		fprintf(stderr, "[replayTrace] Couldn't open capture file %s: %s. Terminating process.\n", offlineFileName.c_str(), errbuf);
+		exit(1);
+	}
 
-		if((duration != 0) && (secCounter >= duration))
-		{
-			exitFlag = true;
-			break;
-		}
+	string filter_exp = getFilterExpression();
+
+	if (pcap_compile(handle, &fp, (char*)filter_exp.c_str(), 0, PCAP_NETMASK_UNKNOWN) == -1)
+	{
+		fprintf(stderr, "[replayTrace] Couldn't parse filter %s: %s. Terminating process.\n", filter_exp.c_str(), pcap_geterr(handle));
+		exit(1);
+	}
+
+	if (pcap_setfilter(handle, &fp) == -1)
+	{
+		fprintf(stderr, "[replayTrace] Couldn't install filter %s: %s. Terminating process.\n", filter_exp.c_str(), pcap_geterr(handle));
+		exit(1);
+	}
+
+	replayStarted = false;
+
+	if (pcap_loop(handle, -1, replay_packet, NULL) == -1)
+	{
+		fprintf(stderr, "[replayTrace] Error in reading capture file %s: %s. Terminating process.\n", offlineFileName.c_str(), pcap_geterr(handle));
+		exit(1);
+	}
+
+	// Report the bins up to and including the one holding the last packet
+	int64_t index;
+	uint64_t bytes[BIN_SERIES_COUNT];
 
-		unsigned int n = 0;
+	while (replayStarted && ((duration == 0) || (secCounter < duration)) && binner->next(replayLastTime + binner->getBinWidth(), 0, &index, bytes))
+	{
+		reportInterval(index, bytes);
+	}
 
-		if((unsigned int)measurementInterval != 0)
+	pcap_freecode(&fp);
+	pcap_close(handle);
+}
+
+void replay_packet(unsigned char* args, const struct pcap_pkthdr* header, const unsigned char* packet)
+{
+	double ts = header->ts.tv_sec + header->ts.tv_usec / 1000000.0;
+
+	if (replayStarted == false)
+	{
+		binner->start(ts);
+
+		if (traceWriter != NULL)
 		{
-			n = sleep((unsigned int)measurementInterval);
+			traceWriter->beginTrace("", "", "", binner->getBinWidth(), ts);
 		}
+		replayStarted = true;
+	}
 
-		if(((unsigned int)measurementInterval != 0) && (n == (unsigned int)measurementInterval))
-		{
-			fprintf(stdout, "---------- [tpgpMonitorThreadFunction] Interrupted while sleeping.\n");
+	replayLastTime = ts;
 
-			pthread_mutex_lock(&pcapMutex);
-			pcapBytesReceived = 0;
-			pthread_mutex_unlock(&pcapMutex);
+	// Packets are in time order, so every bin that ends before this one is complete
+	int64_t index;
+	uint64_t bytes[BIN_SERIES_COUNT];
 
-			pthread_mutex_lock(&tcpMutex);
-			tcpBytesReceived = 0;
-			pthread_mutex_unlock(&tcpMutex);
+	while (binner->next(ts, 0, &index, bytes))
+	{
+		reportInterval(index, bytes);
 
-			continue;
-		}
-		else
+		if ((duration != 0) && (secCounter >= duration))
 		{
-			// fprintf(stdout, "++++++++++ [tpgpMonitorThreadFunction] Had a good sleep.\n");
+			pcap_breakloop(handle);
+			return;
 		}
+	}
 
-		secCounter += ((unsigned int)measurementInterval - n);
+	PacketView p(packet, header->caplen, header->len);
 
-		unsigned long usecInterval = (unsigned long)((measurementInterval - (unsigned int)measurementInterval) * 1000000);
+	binner->add(BIN_SERIES_PCAP, ts, p.getPayloadLength());
+}
 
-		if((usecInterval == 0) && ((unsigned int)measurementInterval == 0))
+/* Prints and stores the throughput and goodput of one completed bin. */
+void reportInterval(int64_t index, const uint64_t* bytes)
+{
+	double binWidth = binner->getBinWidth();
+
+	secCounter = (index + 1) * binWidth;
+
+	double tp = (bytes[BIN_SERIES_PCAP] / binWidth) / 1024; // KBps
+	double gp = (bytes[BIN_SERIES_TCP] / binWidth) / 1024; // KBps
+
+	// Capture health; intervals in which the kernel or the interface dropped packets are flagged
+	char health[MAX_BUFFER_SIZE] = "";
+	if(offlineFileName.empty())
+	{
+		snprintf(health, MAX_BUFFER_SIZE - 1, " Received %llu Dropped %llu IfDropped %llu CallbackTime(ms) %f%s", (unsigned long long)bytes[BIN_SERIES_RECEIVED], (unsigned long long)bytes[BIN_SERIES_DROPPED], (unsigned long long)bytes[BIN_SERIES_IFDROPPED], bytes[BIN_SERIES_CALLBACK] / 1000000.0, ((bytes[BIN_SERIES_DROPPED] + bytes[BIN_SERIES_IFDROPPED]) > 0) ? " CaptureDrops" : "");
+	}
+
+	if(intervalCount < vReferenceTrace.size())
+	{
+		referenceCorrelation.add(tp, vReferenceTrace[intervalCount].throughput);
+		fprintf(stdout, "Time %f Throughput(KBps) %f Goodput(KBps) %f Correlation %f%s\n", (secCounter + measurementOffset), tp, gp, referenceCorrelation.getCorrelation(), health);
+	}
+	else
+	{
+		fprintf(stdout, "Time %f Throughput(KBps) %f Goodput(KBps) %f%s\n", (secCounter + measurementOffset), tp, gp, health);
+	}
+
+	++intervalCount;
+
+	pthread_mutex_lock(&fileMutex);
+	if(traceWriter != NULL)
+	{
+		traceWriter->add(secCounter + measurementOffset, tp, gp);
+	}
+	else if(outFile != NULL)
+	{
+		fprintf(outFile, "Time %f Throughput(KBps) %f Goodput(KBps) %f%s\n", (secCounter + measurementOffset), tp, gp, health);
+		// fflush(outFile);
+	}
+	pthread_mutex_unlock(&fileMutex);
+}
+
+void* tpgpMonitorThreadFunction(void* arg)
+{
+	double binWidth = binner->getBinWidth();
+	double monitorPeriod = (binWidth > MONITOR_MIN_PERIOD) ? binWidth : MONITOR_MIN_PERIOD;
+
+	uint64_t bytes[BIN_SERIES_COUNT];
+	int64_t index;
+
+	IntervalTimer timer;
+	if(timer.start(monitorPeriod) == -1)
+	{
+		fprintf(stderr, "[tpgpMonitorThreadFunction] Cannot start the monitor timer. Terminating process.\n");
+		exit(1);
+	}
+
+	while(1)
+	{
+		if(exitFlag == true)
 		{
-			usecInterval = 1;
-			measurementInterval = 1.0 / 1000000.0; // set it to 1 us
+			break;
 		}
 
-		if(usecInterval != 0)
+		if((duration != 0) && (secCounter >= duration))
 		{
-			usleep(usecInterval);
-			secCounter += (measurementInterval - (unsigned int)measurementInterval);
+			exitFlag = true;
+			break;
 		}
 
-		pthread_mutex_lock(&pcapMutex);
-		double tp = ((pcapBytesReceived / (measurementInterval - n)) * 1) / 1024; // KBps
-		pcapBytesReceived = 0;
-		pthread_mutex_unlock(&pcapMutex);
-
-		pthread_mutex_lock(&tcpMutex);
-		double gp = ((tcpBytesReceived / (measurementInterval - n)) * 1) / 1024; // KBps
-		tcpBytesReceived = 0;
-		pthread_mutex_unlock(&tcpMutex);
+		// Only paces the output; the bins themselves are keyed on packet timestamps
+		int64_t ticks = timer.wait();
+		if(ticks == -1)
+		{
+			exitFlag = true;
+			break;
+		}
 
-		fprintf(stdout, "Time %f Throughput(KBps) %f Goodput(KBps) %f\n", (secCounter + measurementOffset), tp, gp);
+		if(ticks > 1)
+		{
+			fprintf(stderr, "[tpgpMonitorThreadFunction] Missed %lld monitor ticks.\n", (long long)(ticks - 1));
+		}
 
-		pthread_mutex_lock(&fileMutex);
-		if(outFile != NULL)
+		while(((duration == 0) || (secCounter < duration)) && binner->next(getTime(), BIN_LAG, &index, bytes))
 		{
-			fprintf(outFile, "Time %f Throughput(KBps) %f Goodput(KBps) %f\n", (secCounter + measurementOffset), tp, gp);
-			// fflush(outFile);
+			reportInterval(index, bytes);
 		}
-		pthread_mutex_unlock(&fileMutex);
 	}
 
 	if(tcpSocket != -1)
@@ -414,27 +748,71 @@ void* tpgpMonitorThreadFunction(void* arg)
 	}
 
 	pthread_mutex_lock(&fileMutex);
-	if(outFile != NULL)
+	closeOutputFile();
+	pthread_mutex_unlock(&fileMutex);
+
+	if(binner->getLateBytes() > 0)
 	{
-		fclose(outFile);
-		outFile = NULL;
+		fprintf(stdout, "[tpgpMonitorThreadFunction] %llu bytes arrived after their interval was reported.\n", (unsigned long long)binner->getLateBytes());
 	}
-	pthread_mutex_unlock(&fileMutex);
 
 	exit(0);
 
 	pthread_exit(NULL); // program will never reach here
 }
 
-void signalHandler(int sig)
+/* Opens client-<end host ID>-<character>.txt, or .bin for binary output. */
+void openOutputFile(int endHostId, const char* character)
 {
-	close(tcpSocket);
+	char fileName[MAX_BUFFER_SIZE];
+	snprintf(fileName, MAX_BUFFER_SIZE - 1, "client-%d-%s.%s", endHostId, character, (traceWriter != NULL) ? "bin" : "txt");
+
+	if(traceWriter != NULL)
+	{
+		if(traceWriter->open(fileName) == -1)
+		{
+			fprintf(stderr, "[TOR-APP-CLIENT] Cannot open output file. Terminating process.\n");
+			exit(1);
+		}
+		return;
+	}
+
+	outFile = fopen(fileName, "w");
+	if(outFile == NULL)
+	{
+		fprintf(stderr, "[TOR-APP-CLIENT] Cannot open output file. Terminating process.\n");
+		exit(1);
+	}
+}
+
+void closeOutputFile()
+{
+	if(traceWriter != NULL)
+	{
+		traceWriter->close();
+	}
 
 	if(outFile != NULL)
 	{
 		fclose(outFile);
 		outFile = NULL;
 	}
+}
+
+void signalHandler(int sig)
+{
+	close(tcpSocket);
+
+	closeOutputFile();
 
 	exit(0);
 }
+
+/* Returns the wall clock time in seconds, the clock pcap timestamps use. */
+double getTime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
@@ -3,15 +3,49 @@
 
 #include <sys/types.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <string>
 #include <pcap.h>
 
+using namespace std;
+
 #define MAX_BUFFER_SIZE 4096
 
+#define CAPTURE_BACKEND_PCAP	0
+#define CAPTURE_BACKEND_RING	1
+
+#define BIN_SERIES_PCAP			0
+#define BIN_SERIES_TCP			1
+#define BIN_SERIES_RECEIVED		2	// packets the capture saw, dropped ones included
+#define BIN_SERIES_DROPPED		3	// packets the kernel dropped for lack of buffer space
+#define BIN_SERIES_IFDROPPED	4	// packets the interface dropped
+#define BIN_SERIES_CALLBACK		5	// nanoseconds spent in the capture callbacks
+#define BIN_SERIES_COUNT		6
+
+#define BIN_LAG				0.2	// in seconds, how long an interval stays open for late timestamps
+#define MONITOR_MIN_PERIOD	0.1	// in seconds
+#define CAPTURE_POLL_TIMEOUT	1000	// in milliseconds, longest wait of the capture thread for packets
+
 void* pcapThreadFunction(void* arg);
 void got_packet(unsigned char* args, const struct pcap_pkthdr* header, const unsigned char* packet);
+void got_frame(void* arg, const struct timeval* ts, const unsigned char* frame, int captureLength, int length);
+int getStatisticsTimeout(double now);
+void sampleCaptureStatistics(double now);
+uint64_t getElapsedNanoseconds(const struct timespec* start);
+string getFilterExpression();
+
+void replayTrace();
+void replay_packet(unsigned char* args, const struct pcap_pkthdr* header, const unsigned char* packet);
+
+void reportInterval(int64_t index, const uint64_t* bytes);
 
 void* tpgpMonitorThreadFunction(void* arg);
 
+void openOutputFile(int endHostId, const char* character);
+void closeOutputFile();
+
 void signalHandler(int sig);
 
+double getTime();
+
 #endif /* TOR_APP_CLIENT_H_ */
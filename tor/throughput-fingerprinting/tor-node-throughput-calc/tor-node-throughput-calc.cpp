@@ -12,35 +12,56 @@
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include <cmath>
+#include <sys/time.h>
+#include <time.h>
 #include <vector>
 #include <signal.h>
-#include <sys/wait.h>
+#include <cerrno>
+#include <poll.h>
 #include <pcap.h>
 #include "../myutil/net.h"
 #include "../myutil/thread.h"
 #include "../myutil/socks.h"
-#include "../myutil/StringTokenizer.h"
 #include "../myutil/Packet.h"
+#include "../myutil/PacketRing.h"
+#include "../myutil/IntervalBinner.h"
+#include "../myutil/IntervalTimer.h"
+#include "../myutil/TraceFile.h"
+#include "../myutil/TorControlClient.h"
+#include "../myutil/CircuitTable.h"
+#include "../myutil/RelayTable.h"
+#include "../myutil/FlowTable.h"
+#include "../myutil/trace.h"
+#include "../myutil/CorrelationAccumulator.h"
 #include "tor-node-throughput-calc.h"
 
 using namespace std;
 
-static int torControlSocket = -1;
+static TorControlClient torControl;	// pipelined control connection, kept by the parent
 static int clientSocket = -1;
 
 static double duration = 0;
-static double secCounter = 0;
 static double measurementInterval = 0;
 
-static double pcapBytesReceived = 0;
-static double tcpBytesReceived = 0;
+static FlowTable* flowTable = NULL;		// middleman flows demultiplexed from the one live capture or the replayed file
+static int activeFlows[MAX_PROBE_SLOTS];	// flows being measured, indexed by probe slot; read by the capture thread
+static int probeCount = 1;				// probes measuring at once (-k)
+static int prebuildDepth = 1;			// circuits built ahead of the measurements (-p)
+
+static pthread_mutex_t filterMutex;
+static pthread_cond_t filterCond;		// signals installedFilterGeneration changes
+static string captureFilterExpression = CAPTURE_FILTER_IDLE;	// of the registered flows, built by updateCaptureFilter()
+static int captureFilterGeneration = 0;	// counts the filters built
+static int installedFilterGeneration = -1;	// the last one the capture thread installed
+static int filterPipe[2];				// wakes the capture thread up when the filter changes or the capture ends
 
-static pthread_mutex_t pcapMutex;
-static pthread_mutex_t tcpMutex;
 static pthread_mutex_t fileMutex;
 
 static FILE *allDataFile = NULL;
 static FILE *tpgpFile = NULL;
+static TraceFileWriter* traceWriter = NULL;	// binary per-interval output; allDataFile then keeps only the log lines
+static string traceFileName = "./Output/all-tp-gp-data.bin";
 
 static string serverIPAddress = "";
 static unsigned short int serverPort = 0;
@@ -61,10 +82,31 @@ static string middlemanNodeFingerprint = "";
 static pcap_t* handle;			// Session handle
 static struct bpf_program fp;	// The compiled filter
 
-static bool exitFlag = false;
+static bool exitFlag = false;	// ends the capture thread after the last measurement
+
+static int snapLength = BUFSIZ;		// PACKET_HEADER_SNAPLEN with -H
+static int captureBackend = CAPTURE_BACKEND_PCAP;
+static string captureDevice = "";	// pcap_lookupdev() when empty
+static PacketRing packetRing;
+static StatisticsSampler statisticsSamplers[MAX_PROBE_SLOTS];	// indexed by probe slot; only the capture thread uses them
+static uint64_t captureReceived = 0;		// capture totals since the capture started
+static uint64_t captureDropped = 0;
+static uint64_t captureIfDropped = 0;
+static struct pcap_stat lastStatistics;	// pcap_stats() counts are cumulative
+
+static string offlineFileName = "";	// capture file to replay instead of measuring live (-r)
+static vector<ReplayFlow> replayFlows;	// indexed by flow; relays of the replay
 
 static int circuitId = 0;
 
+static Probe probes[MAX_PROBE_SLOTS];		// slots of runProbes(); CIRC events update the circuit status
+static CircuitTable circuitTable;			// Tor's circuits, kept up to date from the CIRC events
+static int newStreamId = -1;					// from the latest STREAM NEW event
+
+static vector<TraceSample> vReferenceTrace;			// optional series to correlate against while measuring
+
+static MeasurementWorker workers[MAX_CONCURRENT_PROBES];	// one per measurement slot (-k)
+
 #define BASIC_TOR_COMMAND_COUNT 8
 
 static const string basicTorCommand[BASIC_TOR_COMMAND_COUNT] = {
@@ -80,9 +122,68 @@ static const string basicTorCommand[BASIC_TOR_COMMAND_COUNT] = {
 
 int main(int argc, char** argv)
 {
+	int opt;
+
+	while((opt = getopt(argc, argv, "BHb:i:k:p:r:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'B':
+			traceWriter = new TraceFileWriter();
+			break;
+		case 'H':
+			snapLength = PACKET_HEADER_SNAPLEN;
+			break;
+		case 'b':
+			if(strcmp(optarg, "pcap") == 0)
+			{
+				captureBackend = CAPTURE_BACKEND_PCAP;
+			}
+			else if(strcmp(optarg, "ring") == 0)
+			{
+				captureBackend = CAPTURE_BACKEND_RING;
+			}
+			else
+			{
+				fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Invalid capture backend %s. Must be pcap or ring. Terminating process.\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'i':
+			captureDevice = optarg;
+			break;
+		case 'k':
+			probeCount = atoi(optarg);
+			if((probeCount < 1) || (probeCount > MAX_CONCURRENT_PROBES))
+			{
+				fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Invalid number of concurrent probes %s. Must be 1-%d. Terminating process.\n", optarg, MAX_CONCURRENT_PROBES);
+				exit(1);
+			}
+			break;
+		case 'p':
+			prebuildDepth = atoi(optarg);
+			if((prebuildDepth < 0) || (prebuildDepth > MAX_PREBUILD_DEPTH))
+			{
+				fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Invalid number of prebuilt circuits %s. Must be 0-%d. Terminating process.\n", optarg, MAX_PREBUILD_DEPTH);
+				exit(1);
+			}
+			break;
+		case 'r':
+			offlineFileName = optarg;
+			break;
+		default:
+			exit(1);
+		}
+	}
+
+	// positional arguments start at argv[1] from here on
+	argv[optind - 1] = argv[0];
+	argc -= optind - 1;
+	argv += optind - 1;
+
 	if(argc < 10)
 	{
-		fprintf(stderr, "USAGE: %s <server IP address> <server port> <duration (> 0) (in seconds)> <measurement interval (> 0) (in seconds)> <guard node name> <guard node fingerprint> <exit node name> <exit node fingerprint> <tor node info file name>\n", argv[0]);
+		fprintf(stderr, "USAGE: %s [-B (binary interval output)] [-H (capture headers only)] [-b <capture backend (pcap|ring)>] [-i <capture device>] [-k <concurrent probes (1-%d)>] [-p <circuits built ahead (0-%d)>] [-r <capture file to replay>] <server IP address> <server port> <duration (> 0) (in seconds)> <measurement interval (> 0) (in seconds)> <guard node name> <guard node fingerprint> <exit node name> <exit node fingerprint> <tor node info file name or Tor cached consensus> [reference trace file]\n", argv[0], MAX_CONCURRENT_PROBES, MAX_PREBUILD_DEPTH);
 		exit(1);
 	}
 
@@ -114,6 +215,15 @@ int main(int argc, char** argv)
 		exit(1);
 	}
 
+	if(traceWriter != NULL)
+	{
+		if(traceWriter->open(traceFileName.c_str()) == -1)
+		{
+			fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Cannot open file %s for output. Terminating process.\n", traceFileName.c_str());
+			exit(1);
+		}
+	}
+
 	string tpgpFileName = "./Output/node-tp-gp.txt";
 	tpgpFile = fopen(tpgpFileName.c_str(), "w");
 	if(tpgpFile == NULL)
@@ -130,181 +240,116 @@ int main(int argc, char** argv)
 	exitNodeFingerprint = argv[8];
 	torNodeInfoFileName = argv[9];
 
-	createMutex(&pcapMutex);
-	createMutex(&tcpMutex);
+	if(argc > 10)
+	{
+		if(readTraceFile(argv[10], vReferenceTrace) <= 0)
+		{
+			fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Cannot read reference trace file %s. Terminating process.\n", argv[10]);
+			exit(1);
+		}
+		fprintf(stdout, "[TOR-NODE-TP-GP-CALC] Read %u samples from reference trace file %s.\n", (unsigned int)vReferenceTrace.size(), argv[10]);
+	}
+
 	createMutex(&fileMutex);
 
-	// Read and parse data from input file
-	FILE *inFile = fopen(torNodeInfoFileName.c_str(), "r");
-	if(inFile == NULL)
+	double monitorPeriod = (measurementInterval > MONITOR_MIN_PERIOD) ? measurementInterval : MONITOR_MIN_PERIOD;
+	int binCount = (int)ceil((monitorPeriod + BIN_LAG) / measurementInterval) + 2;
+
+	// The relays to measure, from a node info file or from Tor's cached consensus
+	RelayTable relayTable;
+	if(relayTable.load(torNodeInfoFileName.c_str()) == -1)
 	{
-		fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Cannot open file %s for input. Terminating process.\n", torNodeInfoFileName.c_str());
+		fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Cannot read relays from input file %s. Terminating process.\n", torNodeInfoFileName.c_str());
 		exit(1);
 	}
 
-	char buffer[MAX_BUFFER_SIZE];
-	vector<string> vNodeInfo;
+	fprintf(stdout, "[TOR-NODE-TP-GP-CALC] Completed reading input file %s. [Relays: %d]\n\n", torNodeInfoFileName.c_str(), relayTable.getRelayCount());
 
-	memset(buffer, 0, MAX_BUFFER_SIZE);
+	TorControlReply reply;
+	int res;
+	pthread_t pcapThread;
 
-	while(!feof(inFile))
+	// A replay needs no circuits
+	if(offlineFileName.empty())
 	{
-		char *s;
-
-		do
+		// Create connection with the Tor control server
+		res = torControl.open(TOR_CONTROL_IP_ADDRESS, TOR_CONTROL_PORT);
+		if(res == -1)
 		{
-			s = fgets(buffer, MAX_BUFFER_SIZE, inFile);
-			if(s == NULL)
-			{
-				break;
-			}
-
-			if(strchr(buffer, '\r') != NULL)
-			{
-				*(strchr(buffer, '\r')) = '\0';
-			}
-
-			if(strchr(buffer, '\n') != NULL)
-			{
-				*(strchr(buffer, '\n')) = '\0';
-			}
-		}while(strlen(buffer) == 0);
+			fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Cannot connect to Tor control server. Terminating process.\n");
+			exit(1);
+		}
+		torControl.setEventHandler(handleTorEvent, NULL);
+		fprintf(stdout, "[TOR-NODE-TP-GP-CALC] Connected to Tor control server.\n");
 
-		if(s == NULL)
+		// Send the basic commands first
+		for(int i = 0; i < BASIC_TOR_COMMAND_COUNT; i++)
 		{
-			if(feof(inFile) != 0)
+			res = sendTorCommand(basicTorCommand[i], &reply);
+			if(res == -1)
 			{
-				break;
-			}
-			else if(ferror(inFile) != 0)
-			{
-				fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Error in reading input file %s. Terminating process.\n", torNodeInfoFileName.c_str());
+				fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Failed to send command [%s] to Tor control server. Terminating process.\n", basicTorCommand[i].c_str());
 				exit(1);
 			}
 			else
 			{
-				fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Unknown error in reading input file %s. Terminating process.\n", torNodeInfoFileName.c_str());
-				exit(1);
+				fprintf(stdout, "[TOR-NODE-TP-GP-CALC] Sent command [%s] to Tor control server.\n", basicTorCommand[i].c_str());
 			}
 		}
+		fprintf(stdout, "[TOR-NODE-TP-GP-CALC] Sent all the basic commands to Tor control server.\n");
 
-		string strNodeInfo = buffer;
-		vNodeInfo.push_back(strNodeInfo);
-	}
-
-	fclose(inFile);
-
-	fprintf(stdout, "[TOR-NODE-TP-GP-CALC] Completed reading input file %s.\n\n", torNodeInfoFileName.c_str());
-
-	// Create connection with the Tor control server
-	torControlSocket = createSocket(SOCK_STREAM);
-
-	struct sockaddr_in serverAddress = createSocketAddress(TOR_CONTROL_IP_ADDRESS, TOR_CONTROL_PORT);
-	int res;
-
-	res = connect(torControlSocket, (struct sockaddr*)&serverAddress, sizeof(serverAddress));
-	if(res == -1)
-	{
-		fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Cannot connect to Tor control server. Terminating process.\n");
-		exit(1);
-	}
-	fprintf(stdout, "[TOR-NODE-TP-GP-CALC] Connected to Tor control server.\n");
-
-	char recvBuffer[MAX_BUFFER_SIZE];
-
-	// Send the basic commands first
-	for(int i = 0; i < BASIC_TOR_COMMAND_COUNT; i++)
-	{
-		res = sendTorCommand(torControlSocket, basicTorCommand[i], recvBuffer);
+		// The circuit table and the probes learn from CIRC events how the circuits change
+		res = sendTorCommand("setevents circ\n", &reply);
 		if(res == -1)
 		{
-			fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Failed to send command [%s] to Tor control server. Terminating process.\n", basicTorCommand[i].c_str());
-			exit(1);
-		}
-		else
-		{
-			fprintf(stdout, "[TOR-NODE-TP-GP-CALC] Sent command [%s] to Tor control server.\n", basicTorCommand[i].c_str());
-		}
-	}
-	fprintf(stdout, "[TOR-NODE-TP-GP-CALC] Sent all the basic commands to Tor control server.\n");
-
-	// Measure throughput of each Tor node
-	for(unsigned int i = 1; i <= vNodeInfo.size(); i++)
-	{
-		string strNodeInfo = vNodeInfo[i - 1];
-		StringTokenizer st(strNodeInfo, " \r\n");
-		if(st.countTokens() < 9)
-		{
-			fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Unknown data format at input file %s. Terminating process.\n", torNodeInfoFileName.c_str());
+			fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Failed to send command [%s] to Tor control server. Terminating process.\n", "setevents circ\n");
 			exit(1);
 		}
 
-		middlemanNodeName = st.nextToken(); // 1st token (nickname)
-		middlemanNodeIPAddress = st.nextToken(); // 2nd token (IP address)
-		middlemanNodePort = (unsigned short int)atoi(st.nextToken().c_str()); // 3rd token (ORPort)
+		closeAllTorCircuits();
 
-		st.nextToken(); // Skip the 4th token (SOCKSPort)
-		st.nextToken(); // Skip the 5th token (DirPort)
+		// One capture serves every middleman; each measurement registers its flow in flowTable
+		flowTable = new FlowTable(FLOW_TABLE_SIZE, FLOW_KEY_SOURCE, measurementInterval, binCount, BIN_SERIES_COUNT);
 
-		middlemanNodeFingerprint = st.nextToken(); // 6th token (fingerprint);
-
-		if(middlemanNodeName.compare(exitNodeName) == 0)
-		{
-			fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Skipping the middleman node that is also the exit node. [Middleman: %s] [Exit: %s]\n\n", i, middlemanNodeName.c_str(), exitNodeName.c_str());
-			continue;
-		}
-/*
-		if(middlemanNodeName.compare("Unnamed") == 0)
+		for(int k = 0; k < MAX_PROBE_SLOTS; k++)
 		{
-			fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Skipping Unnamed middleman node. [Middleman: %s] [Exit: %s]\n\n", i, middlemanNodeName.c_str(), exitNodeName.c_str());
-			continue;
+			activeFlows[k] = -1;
+			statisticsSamplers[k].flow = -1;
 		}
-*/
-		fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Testing new circuit. [Middleman: %s] [Exit: %s]\n", i, middlemanNodeName.c_str(), exitNodeName.c_str());
-
-		int res = createTorCircuit();
-		if(res == 0) // No circuit was created
-		{
-			fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Circuit creation error. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
-			fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Circuit skipped. [Middleman: %s] [Exit: %s]\n\n", i, middlemanNodeName.c_str(), exitNodeName.c_str());
 
-			pthread_mutex_lock(&fileMutex);
-			fprintf(allDataFile, "[TOR-NODE-TP-GP-CALC] Circuit creation error. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
-			fflush(allDataFile);
-			fprintf(tpgpFile, "[TOR-NODE-TP-GP-CALC] Circuit creation error. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
-			fflush(tpgpFile);
-			pthread_mutex_unlock(&fileMutex);
+		createMutex(&filterMutex);
+		pthread_cond_init(&filterCond, NULL);
 
-			continue;
-		}
-		else
+		if(pipe(filterPipe) == -1)
 		{
-			fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Circuit creation successful. [Middleman: %s] [Exit: %s]\n", i, middlemanNodeName.c_str(), exitNodeName.c_str());
+			fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Cannot create the filter pipe: %s. Terminating process.\n", strerror(errno));
+			exit(1);
 		}
 
-		// Wait for the circuit to set up completely
-		fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Waiting for the circuit to set up completely ...\n", i);
-		sleep(CIRCUIT_SETUP_DELAY);
+		createThread(&pcapThread, pcapThreadFunction, NULL, PTHREAD_CREATE_JOINABLE);
+	}
+
+	// Measure throughput of each Tor node
+	if(offlineFileName.empty() == false)
+	{
+		// Every relay's flow is demultiplexed from one pass over the capture file
+		flowTable = new FlowTable((relayTable.getRelayCount() > 0) ? relayTable.getRelayCount() : 1, FLOW_KEY_SOURCE, measurementInterval, binCount, BIN_SERIES_COUNT);
 
-		// Create child process
-		pid_t childProcessId = fork();
-		if(childProcessId == 0) // This is the child process
-		{
-			measureTPandGP();
-			exit(0);
-		}
-		else // This is the parent process
+		replayTPandGP(relayTable);
+	}
+	else
+	{
+		runProbes(relayTable);
+
+		// No flow is left to capture
+		__atomic_store_n(&exitFlag, true, __ATOMIC_RELEASE);
+		if(write(filterPipe[1], "q", 1) == -1)
 		{
-			// Wait for the child process to finish its job and terminate
-			pid_t id = wait((int*)0);
-			if(id != childProcessId)
-			{
-				fprintf(stderr, "[TOR-NODE-TP-GP-CALC] [%u] Child process management error. [Found: %d] [Expected: %d]. Terminating process.\n", i, id, childProcessId);
-				exit(1);
-			}
+			fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Cannot wake up the capture thread: %s. Terminating process.\n", strerror(errno));
+			exit(1);
 		}
 
-		fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Circuit test completed. [Middleman: %s] [Exit: %s]\n\n", i, middlemanNodeName.c_str(), exitNodeName.c_str());
+		pthread_join(pcapThread, NULL);
 	}
 
 	// Clean up and exit from program
@@ -320,750 +365,1733 @@ int main(int argc, char** argv)
 		fclose(tpgpFile);
 		tpgpFile = NULL;
 	}
+
+	if(traceWriter != NULL)
+	{
+		traceWriter->close();
+	}
 	pthread_mutex_unlock(&fileMutex);
 
+	if(offlineFileName.empty() == false)
+	{
+		return EXIT_SUCCESS;
+	}
+
 	// Terminate Tor control session
 	fprintf(stdout, "[TOR-NODE-TP-GP-CALC] Terminating Tor control session ...\n");
 
-	res = sendTorCommand(torControlSocket, "quit\n", recvBuffer);
+	res = sendTorCommand("quit\n", &reply);
 	if(res == -1)
 	{
 		fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Failed to send command [%s] to Tor control server. Terminating process.\n", "quit\n");
 		exit(1);
 	}
 
-	close(torControlSocket);
+	torControl.close();
 
 	fprintf(stdout, "[TOR-NODE-TP-GP-CALC] Terminated Tor control session.\n");
 
 	return EXIT_SUCCESS;
 }
 
-int createTorCircuit()
+/* Makes relay the middleman of probe. */
+void setProbeRelay(Probe* probe, const RelayEntry& relay)
 {
-	char recvBuffer[MAX_BUFFER_SIZE];
-	int retVal = 0;
-	int res;
+	probe->name = relay.nickname;
+	probe->ipAddress = getIPAddress(relay.address);
+	probe->port = relay.orPort;
+	probe->fingerprint = relay.fingerprint;
+	probe->flags = relay.flags;
+}
 
-	// Close all the existing circuits
-	res = sendTorCommand(torControlSocket, "getinfo circuit-status\n", recvBuffer);
-	if(res == -1)
+/* Makes probe the middleman the circuit, stream and report functions work on. */
+void selectProbe(const Probe* probe)
+{
+	middlemanNodeName = probe->name;
+	middlemanNodeIPAddress = probe->ipAddress;
+	middlemanNodePort = probe->port;
+	middlemanNodeFingerprint = probe->fingerprint;
+	circuitId = probe->circuitId;
+}
+
+/*
+Measures the middlemen with up to probeCount probes measuring at once. Each probe
+extends its own circuit and, once a CIRC event reports it BUILT and a measurement
+slot is free, attaches its stream and hands the transfer to a measurement worker. Up to
+prebuildDepth circuits are built ahead of the measurements, so a finished
+measurement is followed by the next one without waiting for a circuit. A circuit
+that fails, is not built within CIRCUIT_BUILD_TIMEOUT or closes while waiting is
+skipped. The one capture tells the probes apart by their middleman's flow, so K
+probes measure close to K middlemen per duration until the guard or the local link
+saturates.
+*/
+void runProbes(const RelayTable& relays)
+{
+	int slotCount = probeCount + prebuildDepth;
+	int next = 0;
+	int activeCount = 0;
+	int measuringCount = 0;
+
+	for(int k = 0; k < MAX_PROBE_SLOTS; k++)
 	{
-		fprintf(stderr, "[createTorCircuit] Failed to send command [%s] to Tor control server. Terminating process.\n", "getinfo circuit-status\n");
-		exit(1);
+		probes[k].state = PROBE_FREE;
+		probes[k].slot = k;
 	}
 
-	StringTokenizer st1(recvBuffer, "\r\n");
-	while(st1.hasMoreTokens() == true)
+	startWorkers();
+
+	while((next < relays.getRelayCount()) || (activeCount > 0))
 	{
-		string line = st1.nextToken();
-		if(line.compare("250 OK") == 0)
-		{
-			continue;
-		}
+		bool progress = false;
 
-		StringTokenizer st2(line, " ");
-		string circuitId = st2.nextToken();
-		if(circuitId.find("250-circuit-status=") != string::npos)
+		// Collect the measurements that have finished
+		for(int k = 0; k < slotCount; k++)
 		{
-			StringTokenizer st3(circuitId, "=");
-			if(st3.countTokens() > 1)
+			if((probes[k].state == PROBE_MEASURING) && collectWorker(&workers[probes[k].worker]))
 			{
-				st3.nextToken(); // Ignore the 1st token (250-circuit-status)
+				finishProbe(&probes[k]);
+				--activeCount;
+				--measuringCount;
+				progress = true;
 			}
-			circuitId = st3.nextToken();
 		}
 
-		string command = "closecircuit ";
-		command += circuitId;
-		command += "\n";
-
-		res = sendTorCommand(torControlSocket, command, recvBuffer);
-		if(res == -1)
+		// Give up on the circuits that failed, are late or died while waiting
+		double now = getTime();
+		for(int k = 0; k < slotCount; k++)
 		{
-			fprintf(stderr, "[createTorCircuit] Failed to send command [%s] to Tor control server. Terminating process.\n", command.c_str());
-			exit(1);
-		}
-	}
-	fprintf(stdout, "[createTorCircuit] Closed all existing circuits.\n");
+			if(probes[k].state != PROBE_SETUP)
+			{
+				continue;
+			}
 
-	// Create/extend the new circuit (CIRCUIT_CREATION_COUNT times)
-	for(int i = 0; i < CIRCUIT_CREATION_COUNT; i++)
-	{
-		string command = "extendcircuit 0 ";
-		command += guardNodeName;
-		// command += guardNodeFingerprint;
-		command += ",";
-		command += middlemanNodeFingerprint;
-		command += ",";
-		command += exitNodeName;
-		// command += exitNodeFingerprint;
-		command += "\n";
+			if(probes[k].circuitStatus == CIRCUIT_STATUS_FAILED)
+			{
+				abandonProbe(&probes[k], "Circuit failed before it was built");
+			}
+			else if(probes[k].circuitStatus == CIRCUIT_STATUS_CLOSED)
+			{
+				abandonProbe(&probes[k], "Circuit closed before it was used");
+			}
+			else if((probes[k].circuitStatus == CIRCUIT_STATUS_LAUNCHED) && (now >= probes[k].buildDeadline))
+			{
+				abandonProbe(&probes[k], "Circuit was not built in time");
+			}
+			else
+			{
+				continue;
+			}
 
-		res = sendTorCommand(torControlSocket, command, recvBuffer);
-		if(res == -1)
-		{
-			fprintf(stderr, "[createTorCircuit] Failed to send command [%s] to Tor control server. Terminating process.\n", command.c_str());
-			exit(1);
+			--activeCount;
+			progress = true;
 		}
 
-		if(strstr(recvBuffer, "250 EXTENDED") == NULL)
+		// Measure over the built circuits in node info file order
+		while(measuringCount < probeCount)
 		{
-			fprintf(stderr, "[createTorCircuit] Failed to create circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
+			Probe* ready = NULL;
+			for(int k = 0; k < slotCount; k++)
+			{
+				if((probes[k].state == PROBE_SETUP) && (probes[k].circuitStatus == CIRCUIT_STATUS_BUILT)
+						&& ((ready == NULL) || (probes[k].index < ready->index)))
+				{
+					ready = &probes[k];
+				}
+			}
+
+			if(ready == NULL)
+			{
+				break;
+			}
+
+			if(startMeasurement(ready) == -1)
+			{
+				--activeCount;
+			}
+			else
+			{
+				++measuringCount;
+			}
+			progress = true;
 		}
-		else
+
+		// Extend circuits through the next middlemen in the free slots
+		for(int k = 0; k < slotCount; k++)
 		{
-			fprintf(stdout, "[createTorCircuit] Circuit created. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
-			++retVal;
+			while((probes[k].state == PROBE_FREE) && (next < relays.getRelayCount()))
+			{
+				++next;
+				if(startProbe(&probes[k], next, relays.getRelay(next - 1)) == 0)
+				{
+					++activeCount;
+				}
+				progress = true;
+			}
 		}
 
-		StringTokenizer st(recvBuffer, " \r\n");
-		if(st.countTokens() < 3)
+		// Wait for a CIRC event, or a while for the workers
+		if((progress == false) && (torControl.process(PROBE_POLL_TIMEOUT) == -1))
 		{
-			fprintf(stderr, "[createTorCircuit] Bad response from Tor control server. Failed to read circuit ID. Terminating process. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
+			fprintf(stderr, "[runProbes] Failed to receive events from Tor control server. Terminating process.\n");
 			exit(1);
 		}
-		else
-		{
-			st.nextToken(); // Skip the 1st token ("250")
-			st.nextToken(); // Skip the 2nd token ("EXTENDED")
-			circuitId = atoi(st.nextToken().c_str());
-		}
 	}
 
-	return retVal;
+	stopWorkers();
 }
 
-int verifyTorCircuit()
+/*
+Extends the circuit through relay, the index-th of the relay table.
+Returns 0 when the probe is waiting for its circuit to be built, or -1 when the
+middleman is skipped and the probe stays free.
+*/
+int startProbe(Probe* probe, unsigned int index, const RelayEntry& relay)
 {
-	char recvBuffer[MAX_BUFFER_SIZE];
-	int retVal = 0;
-	int res;
+	setProbeRelay(probe, relay);
+	probe->index = index;
+	probe->circuitId = 0;
+	probe->flow = -1;
+	selectProbe(probe);
 
-	res = sendTorCommand(torControlSocket, "getinfo circuit-status\n", recvBuffer);
-	if(res == -1)
+	if(middlemanNodeName.compare(exitNodeName) == 0)
 	{
-		fprintf(stderr, "[verifyTorCircuit] Failed to send command [%s] to Tor control server. Terminating process.\n", "getinfo circuit-status\n");
-		exit(1);
+		fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Skipping the middleman node that is also the exit node. [Middleman: %s] [Exit: %s]\n\n", index, middlemanNodeName.c_str(), exitNodeName.c_str());
+		return -1;
 	}
 
-	string str1 = "BUILT ";
-	str1 += guardNodeName;
-	str1 += ",";
-	str1 += middlemanNodeName;
-	str1 += ",";
-	str1 += exitNodeName;
-	str1 += " PURPOSE=GENERAL";
-
-	string str2 = "BUILT ";
-	str2 += guardNodeFingerprint;
-	str2 += ",";
-	str2 += middlemanNodeName;
-	str2 += ",";
-	str2 += exitNodeName;
-	str2 += " PURPOSE=GENERAL";
-
-	string str3 = "BUILT ";
-	str3 += guardNodeName;
-	str3 += ",";
-	str3 += middlemanNodeName;
-	str3 += ",";
-	str3 += exitNodeFingerprint;
-	str3 += " PURPOSE=GENERAL";
-
-	string str4 = "BUILT ";
-	str4 += guardNodeFingerprint;
-	str4 += ",";
-	str4 += middlemanNodeName;
-	str4 += ",";
-	str4 += exitNodeFingerprint;
-	str4 += " PURPOSE=GENERAL";
-
-	string str5 = "BUILT ";
-	str5 += guardNodeName;
-	str5 += ",";
-	str5 += middlemanNodeFingerprint;
-	str5 += ",";
-	str5 += exitNodeName;
-	str5 += " PURPOSE=GENERAL";
-
-	string str6 = "BUILT ";
-	str6 += guardNodeFingerprint;
-	str6 += ",";
-	str6 += middlemanNodeFingerprint;
-	str6 += ",";
-	str6 += exitNodeName;
-	str6 += " PURPOSE=GENERAL";
-
-	string str7 = "BUILT ";
-	str7 += guardNodeName;
-	str7 += ",";
-	str7 += middlemanNodeFingerprint;
-	str7 += ",";
-	str7 += exitNodeFingerprint;
-	str7 += " PURPOSE=GENERAL";
-
-	string str8 = "BUILT ";
-	str8 += guardNodeFingerprint;
-	str8 += ",";
-	str8 += middlemanNodeFingerprint;
-	str8 += ",";
-	str8 += exitNodeFingerprint;
-	str8 += " PURPOSE=GENERAL";
-
-	if((strstr(recvBuffer, str1.c_str()) == NULL)
-			&& (strstr(recvBuffer, str2.c_str()) == NULL)
-			&& (strstr(recvBuffer, str3.c_str()) == NULL)
-			&& (strstr(recvBuffer, str4.c_str()) == NULL)
-			&& (strstr(recvBuffer, str5.c_str()) == NULL)
-			&& (strstr(recvBuffer, str6.c_str()) == NULL)
-			&& (strstr(recvBuffer, str7.c_str()) == NULL)
-			&& (strstr(recvBuffer, str8.c_str()) == NULL))
-	{
-		retVal = -1;
-	}
-	else if(strstr(recvBuffer, ".") != NULL)
-	{
-		retVal = -1;
+	// A consensus also lists relays that clients do not use
+	if((probe->flags & (RELAY_FLAG_RUNNING | RELAY_FLAG_VALID)) != (RELAY_FLAG_RUNNING | RELAY_FLAG_VALID))
+	{
+		fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Skipping the middleman node that is not running and valid. [Middleman: %s] [Exit: %s]\n\n", index, middlemanNodeName.c_str(), exitNodeName.c_str());
+		return -1;
+	}
+/*
+	if(middlemanNodeName.compare("Unnamed") == 0)
+	{
+		fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Skipping Unnamed middleman node. [Middleman: %s] [Exit: %s]\n\n", index, middlemanNodeName.c_str(), exitNodeName.c_str());
+		return -1;
+	}
+*/
+	// Two probes of one middleman would count the same packets
+	for(int k = 0; k < probeCount + prebuildDepth; k++)
+	{
+		if((&probes[k] != probe) && (probes[k].state != PROBE_FREE)
+				&& (probes[k].ipAddress.compare(probe->ipAddress) == 0) && (probes[k].port == probe->port))
+		{
+			fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Skipping the middleman node that is already being measured. [Middleman: %s] [Exit: %s]\n\n", index, middlemanNodeName.c_str(), exitNodeName.c_str());
+			return -1;
+		}
 	}
 
-	return retVal;
-}
-
-int sendTorCommand(int torControlSocket, const string& command, char* recvBuffer)
-{
-	fprintf(stdout, "[sendTorCommand] Command: %s\n", command.c_str());
+	fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Testing new circuit. [Middleman: %s] [Exit: %s]\n", index, middlemanNodeName.c_str(), exitNodeName.c_str());
 
-	int res = send(torControlSocket, command.c_str(), command.size(), 0);
-	if(res == -1)
+	int res = createTorCircuit();
+	if(res == 0) // No circuit was created
 	{
-		return res;
-	}
+		fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Circuit creation error. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
+		fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Circuit skipped. [Middleman: %s] [Exit: %s]\n\n", index, middlemanNodeName.c_str(), exitNodeName.c_str());
 
-	memset(recvBuffer, 0, MAX_BUFFER_SIZE);
-	int n = 0; // Total bytes read
+		pthread_mutex_lock(&fileMutex);
+		fprintf(allDataFile, "[TOR-NODE-TP-GP-CALC] Circuit creation error. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
+		fflush(allDataFile);
+		fprintf(tpgpFile, "[TOR-NODE-TP-GP-CALC] Circuit creation error. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
+		fflush(tpgpFile);
+		pthread_mutex_unlock(&fileMutex);
 
-	do
+		return -1;
+	}
+	else
 	{
-		res = recv(torControlSocket, &recvBuffer[n], MAX_BUFFER_SIZE - n, 0);
-		if(res == -1)
-		{
-			fprintf(stderr, "[sendTorCommand] Failed to receive response from Tor control server.\n");
-			return res;
-		}
+		fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Circuit creation successful. [Middleman: %s] [Exit: %s]\n", index, middlemanNodeName.c_str(), exitNodeName.c_str());
+	}
 
-		fprintf(stdout, "[sendTorCommand] Response: %s\n", recvBuffer);
+	// The other probes carry on while this circuit is built
+	fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Waiting for the circuit to be built ...\n", index);
 
-		n += res;
-	}while((strstr(recvBuffer, "250 OK") == NULL)
-				&& (strstr(recvBuffer, "250 EXTENDED") == NULL)
-				&& (strstr(recvBuffer, "250 closing connection") == NULL)
-				&& (strstr(recvBuffer, "510 Unrecognized command") == NULL)
-				&& (strstr(recvBuffer, "551") == NULL)
-				&& (strstr(recvBuffer, "552 No such router") == NULL)
-				&& (strstr(recvBuffer, "552 Unknown circuit") == NULL));
+	probe->circuitId = circuitId;
+	probe->circuitStatus = CIRCUIT_STATUS_LAUNCHED;
+	probe->buildDeadline = getTime() + CIRCUIT_BUILD_TIMEOUT;
+	probe->state = PROBE_SETUP;
 
-	return n;
+	return 0;
 }
 
-void measureTPandGP()
+/*
+Attaches the probe's stream to its circuit and hands it to an idle measurement
+worker. Returns 0 when the worker measures, or -1 when the circuit was skipped and
+the probe is free again.
+*/
+int startMeasurement(Probe* probe)
 {
-	char recvBuffer[MAX_BUFFER_SIZE];
-	int res;
+	selectProbe(probe);
 
-	// Turn on "setevents stream"
-	res = sendTorCommand(torControlSocket, "setevents stream\n", recvBuffer);
-	if(res == -1)
+	probe->flow = flowTable->registerFlow(createFlowKey(inet_addr(middlemanNodeIPAddress.c_str()), middlemanNodePort, 0, 0));
+	if(probe->flow == -1)
 	{
-		fprintf(stderr, "[measureTPandGP] Failed to send command [%s] to Tor control server. Terminating process.\n", "setevents stream\n");
+		fprintf(stderr, "[TOR-NODE-TP-GP-CALC] [%u] Cannot register the middleman flow. Terminating process.\n", probe->index);
 		exit(1);
 	}
 
-	clientSocket = createSocket(SOCK_STREAM);
-
-	struct sockaddr_in socksServerAddress = createSocketAddress(SOCKS_SERVER_IP_ADDRESS, SOCKS_SERVER_PORT);
+	// The capture lets the flow's packets in before its stream exists
+	updateCaptureFilter();
 
-	res = connect(clientSocket, (struct sockaddr*)&socksServerAddress, sizeof(socksServerAddress));
-	if(res == -1)
+	if(attachStream(probe) == -1)
 	{
-		fprintf(stderr, "[measureTPandGP] Cannot connect to SOCKS server. Terminating process.\n");
-		exit(1);
+		finishProbe(probe);
+		return -1;
 	}
-	fprintf(stdout, "[measureTPandGP] Connected to SOCKS server.\n");
 
-	// Perform handshake with the SOCKS server
-	SocksAuthMethodRequest samReq = createSocksAuthMethodRequest(0x05, 1, SOCKS_AUTH_METHOD_NONE);
-	res = send(clientSocket, (void*)&samReq, sizeof(samReq), 0);
-	if(res == -1)
+	__atomic_store_n(&activeFlows[probe->slot], probe->flow, __ATOMIC_RELEASE);
+
+	// runProbes() never has more probes measuring than workers
+	int w;
+	for(w = 0; w < probeCount; w++)
 	{
-		fprintf(stderr, "[measureTPandGP] Failed to send SOCKS authentication method request. Terminating process.\n");
-		exit(1);
+		pthread_mutex_lock(&workers[w].mutex);
+		bool idle = (workers[w].state == WORKER_IDLE);
+		pthread_mutex_unlock(&workers[w].mutex);
+
+		if(idle == true)
+		{
+			break;
+		}
 	}
-	fprintf(stdout, "[measureTPandGP] Sent authentication method request to SOCKS server.\n");
 
-	SocksAuthMethodResponse samRes;
-	res = recv(clientSocket, (void*)&samRes, sizeof(samRes), 0);
-	if(res == -1)
+	if(w == probeCount)
 	{
-		fprintf(stderr, "[measureTPandGP] Failed to receive SOCKS authentication method response. Terminating process.\n");
+		fprintf(stderr, "[TOR-NODE-TP-GP-CALC] [%u] No measurement worker is idle. Terminating process.\n", probe->index);
 		exit(1);
 	}
-	else
+
+	// The worker owns the stream now
+	MeasurementWorker* worker = &workers[w];
+
+	pthread_mutex_lock(&worker->mutex);
+	worker->clientSocket = clientSocket;
+	worker->flow = probe->flow;
+	worker->measurement.middlemanName = probe->name;
+	worker->measurement.middlemanFingerprint = probe->fingerprint;
+	worker->state = WORKER_MEASURING;
+	pthread_cond_broadcast(&worker->cond);
+	pthread_mutex_unlock(&worker->mutex);
+
+	clientSocket = -1;
+
+	probe->worker = w;
+	probe->state = PROBE_MEASURING;
+
+	return 0;
+}
+
+/* Skips the middleman of a probe whose circuit was never built. */
+void abandonProbe(Probe* probe, const char* reason)
+{
+	selectProbe(probe);
+
+	fprintf(stderr, "[TOR-NODE-TP-GP-CALC] %s. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", reason, middlemanNodeName.c_str(), exitNodeName.c_str());
+
+	pthread_mutex_lock(&fileMutex);
+	fprintf(allDataFile, "[TOR-NODE-TP-GP-CALC] %s. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", reason, middlemanNodeName.c_str(), exitNodeName.c_str());
+	fflush(allDataFile);
+	fprintf(tpgpFile, "[TOR-NODE-TP-GP-CALC] %s. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", reason, middlemanNodeName.c_str(), exitNodeName.c_str());
+	fflush(tpgpFile);
+	pthread_mutex_unlock(&fileMutex);
+
+	finishProbe(probe);
+}
+
+/* Releases the probe's flow and circuit once its measurement is over or skipped. */
+void finishProbe(Probe* probe)
+{
+	selectProbe(probe);
+
+	if(probe->flow != -1)
 	{
-		fprintf(stdout, "[measureTPandGP] Received authentication method response from SOCKS server.\n");
+		__atomic_store_n(&activeFlows[probe->slot], -1, __ATOMIC_RELEASE);
+		flowTable->unregisterFlow(probe->flow);
+		probe->flow = -1;
 
-		if(samRes.method == SOCKS_AUTH_METHOD_UNACCEPTABLE)
+		updateCaptureFilter();
+	}
+
+	char buffer[MAX_BUFFER_SIZE];
+	snprintf(buffer, MAX_BUFFER_SIZE - 1, "closecircuit %d\n", probe->circuitId);
+	string command = buffer;
+
+	// Nothing waits for the circuit to go away
+	if(queueTorCommand(command) == -1)
+	{
+		fprintf(stderr, "[TOR-NODE-TP-GP-CALC] Failed to send command [%s] to Tor control server. Terminating process.\n", command.c_str());
+		exit(1);
+	}
+
+	fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Circuit test completed. [Middleman: %s] [Exit: %s]\n\n", probe->index, middlemanNodeName.c_str(), exitNodeName.c_str());
+
+	probe->state = PROBE_FREE;
+}
+
+/*
+Rebuilds the capture filter from the flows of the probes, e.g. "tcp and ((src
+host 128.174.240.149 and src port 9001) or ...)", so the kernel passes only the
+middlemen being measured, and waits until the capture thread has installed it.
+*/
+void updateCaptureFilter()
+{
+	char buffer[MAX_BUFFER_SIZE];
+	string filter_exp = "";
+
+	for(int k = 0; k < probeCount + prebuildDepth; k++)
+	{
+		if(probes[k].flow != -1)
 		{
-			fprintf(stderr, "[measureTPandGP] SOCKS authentication method unacceptable. Terminating process.\n");
-			exit(1);
+			snprintf(buffer, MAX_BUFFER_SIZE - 1, "%s(src host %s and src port %u)", filter_exp.empty() ? "" : " or ", probes[k].ipAddress.c_str(), probes[k].port);
+			filter_exp += buffer;
 		}
 	}
-	fprintf(stdout, "[measureTPandGP] Authentication completed with SOCKS server.\n");
 
-	SocksConnRequest scReq = createSocksConnRequest(0x05, SOCKS_CMD_TCP_CONN, SOCKS_ADDR_TYPE_IPV4, serverIPAddress.c_str(), serverPort);
-	res = send(clientSocket, (void*)&scReq, sizeof(scReq), 0);
+	filter_exp = filter_exp.empty() ? CAPTURE_FILTER_IDLE : "tcp and (" + filter_exp + ")";
+
+	pthread_mutex_lock(&filterMutex);
+	captureFilterExpression = filter_exp;
+	int generation = ++captureFilterGeneration;
+	pthread_mutex_unlock(&filterMutex);
+
+	if(write(filterPipe[1], "f", 1) == -1)
+	{
+		fprintf(stderr, "[updateCaptureFilter] Cannot wake up the capture thread: %s. Terminating process.\n", strerror(errno));
+		exit(1);
+	}
+
+	pthread_mutex_lock(&filterMutex);
+	while(installedFilterGeneration < generation)
+	{
+		pthread_cond_wait(&filterCond, &filterMutex);
+	}
+	pthread_mutex_unlock(&filterMutex);
+}
+
+/* Closes every circuit Tor has open, so that streams can only use ours. */
+void closeAllTorCircuits()
+{
+	TorControlReply reply;
+	int res;
+
+	// Close all the existing circuits
+	res = sendTorCommand("getinfo circuit-status\n", &reply);
 	if(res == -1)
 	{
-		fprintf(stderr, "[measureTPandGP] Failed to send SOCKS connection request. Terminating process.\n");
+		fprintf(stderr, "[closeAllTorCircuits] Failed to send command [%s] to Tor control server. Terminating process.\n", "getinfo circuit-status\n");
 		exit(1);
 	}
-	fprintf(stdout, "[measureTPandGP] Sent connection request to SOCKS server.\n");
 
-	// Read stream ID and attach the stream to the circuit
-	memset(recvBuffer, 0, MAX_BUFFER_SIZE);
-	int n = 0; // Total bytes read
+	// CIRC events keep the table up to date from here on
+	if(circuitTable.load(reply.lines) == -1)
+	{
+		fprintf(stderr, "[closeAllTorCircuits] Failed to parse the circuit status. Terminating process.\n");
+		exit(1);
+	}
 
-	do
+	vector<int> ids;
+	circuitTable.getIds(ids);
+
+	for(unsigned int i = 0; i < ids.size(); i++)
 	{
-		res = recv(torControlSocket, &recvBuffer[n], MAX_BUFFER_SIZE - n, 0);
+		char buffer[MAX_BUFFER_SIZE];
+		snprintf(buffer, MAX_BUFFER_SIZE - 1, "closecircuit %d\n", ids[i]);
+		string command = buffer;
+
+		// Pipelined; the replies are collected below
+		res = queueTorCommand(command);
 		if(res == -1)
 		{
-			fprintf(stderr, "[measureTPandGP] Failed to receive response from Tor control server. Terminating process.\n");
+			fprintf(stderr, "[closeAllTorCircuits] Failed to send command [%s] to Tor control server. Terminating process.\n", command.c_str());
 			exit(1);
 		}
 
-		fprintf(stdout, "[measureTPandGP] %s\n", recvBuffer);
-
-		n += res;
-	}while((strstr(recvBuffer, "250 OK") == NULL)
-				&& (strstr(recvBuffer, "250 EXTENDED") == NULL)
-				&& (strstr(recvBuffer, "250 closing connection") == NULL)
-				&& (strstr(recvBuffer, "510 Unrecognized command") == NULL)
-				&& (strstr(recvBuffer, "552 No such router") == NULL)
-				&& (strstr(recvBuffer, "552 Unknown circuit") == NULL)
-				&& (strstr(recvBuffer, "650 STREAM") == NULL));
+		// A circuit that closed meanwhile gets no CLOSED event from this command
+		circuitTable.remove(ids[i]);
+	}
 
-	StringTokenizer st(recvBuffer, " \r\n");
-	if(st.countTokens() < 6)
+	while(torControl.getPendingCount() > 0)
 	{
-		fprintf(stderr, "[measureTPandGP] Bad response from Tor control server. Failed to read stream ID. Terminating process.\n");
-		exit(1);
+		if(torControl.process(-1) == -1)
+		{
+			fprintf(stderr, "[closeAllTorCircuits] Failed to receive response from Tor control server. Terminating process.\n");
+			exit(1);
+		}
 	}
-	else
+	fprintf(stdout, "[closeAllTorCircuits] Closed all existing circuits.\n");
+}
+
+int createTorCircuit()
+{
+	TorControlReply reply;
+	int retVal = 0;
+	int res;
+
+	// Create/extend the new circuit (CIRCUIT_CREATION_COUNT times)
+	for(int i = 0; i < CIRCUIT_CREATION_COUNT; i++)
 	{
-		st.nextToken(); // Skip the 1st token ("650")
-		st.nextToken(); // Skip the 2nd token ("STREAM")
-		int streamId = atoi(st.nextToken().c_str());
+		string command = "extendcircuit 0 ";
+		command += guardNodeName;
+		// command += guardNodeFingerprint;
+		command += ",";
+		command += middlemanNodeFingerprint;
+		command += ",";
+		command += exitNodeName;
+		// command += exitNodeFingerprint;
+		command += "\n";
 
-		// Turn off "setevents stream"
-		res = sendTorCommand(torControlSocket, "setevents\n", recvBuffer);
+		res = sendTorCommand(command, &reply);
 		if(res == -1)
 		{
-			fprintf(stderr, "[measureTPandGP] Failed to send command [%s] to Tor control server. Terminating process.\n", "setevents\n");
+			fprintf(stderr, "[createTorCircuit] Failed to send command [%s] to Tor control server. Terminating process.\n", command.c_str());
 			exit(1);
 		}
 
-		// Attach the stream to the circuit
-		char buffer[MAX_BUFFER_SIZE];
-		snprintf(buffer, MAX_BUFFER_SIZE - 1, "attachstream %d %d\n", streamId, circuitId);
-		string command = buffer;
-		res = sendTorCommand(torControlSocket, command, recvBuffer);
-		if(res == -1)
+		if((res != 250) || (reply.lines[0].compare(0, 9, "EXTENDED ") != 0))
 		{
-			fprintf(stderr, "[measureTPandGP] Failed to send command [%s] to Tor control server. Terminating process.\n", command.c_str());
-			exit(1);
+			fprintf(stderr, "[createTorCircuit] Failed to create circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
+		}
+		else
+		{
+			fprintf(stdout, "[createTorCircuit] Circuit created. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
+			circuitId = atoi(reply.lines[0].c_str() + 9); // "EXTENDED <circuit ID>"
+			++retVal;
 		}
+	}
+
+	return retVal;
+}
 
-		if(strstr(recvBuffer, "250 OK") == NULL)
+/*
+Checks in the circuit table that circuitId is built for general use over the
+selected guard, middleman and exit. Returns 0 when it is, -1 otherwise.
+*/
+int verifyTorCircuit()
+{
+	const CircuitInfo* circuit = circuitTable.find(circuitId);
+	if(circuit == NULL)
+	{
+		fprintf(stdout, "[verifyTorCircuit] Circuit %d is not open.\n", circuitId);
+		return -1;
+	}
+
+	if((circuit->state != CIRCUIT_STATE_BUILT) || (circuit->purpose.compare("GENERAL") != 0))
+	{
+		fprintf(stdout, "[verifyTorCircuit] Circuit %d is not built for general use.\n", circuitId);
+		return -1;
+	}
+
+	if((circuit->path.size() != 3)
+			|| (matchCircuitHop(circuit->path[0], guardNodeName, guardNodeFingerprint) == false)
+			|| (matchCircuitHop(circuit->path[1], middlemanNodeName, middlemanNodeFingerprint) == false)
+			|| (matchCircuitHop(circuit->path[2], exitNodeName, exitNodeFingerprint) == false))
+	{
+		fprintf(stdout, "[verifyTorCircuit] Circuit %d does not go through the selected relays.\n", circuitId);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+Sends command and waits for its reply; the events that arrive meanwhile go to
+handleTorEvent(). Returns the status code of the reply, or -1 on error.
+*/
+int sendTorCommand(const string& command, TorControlReply* reply)
+{
+	fprintf(stdout, "[sendTorCommand] Command: %s\n", command.c_str());
+
+	int res = torControl.execute(command, reply);
+	if(res == -1)
+	{
+		fprintf(stderr, "[sendTorCommand] Failed to receive response from Tor control server.\n");
+		return res;
+	}
+
+	for(unsigned int i = 0; i < reply->lines.size(); i++)
+	{
+		fprintf(stdout, "[sendTorCommand] Response: %d %s\n", reply->status, reply->lines[i].c_str());
+	}
+
+	return res;
+}
+
+/*
+Sends command behind the ones in flight without waiting for its reply. Returns 0
+on success and -1 on error.
+*/
+int queueTorCommand(const string& command)
+{
+	fprintf(stdout, "[queueTorCommand] Command: %s\n", command.c_str());
+
+	return torControl.send(command, NULL, NULL);
+}
+
+/* Handles the CIRC and STREAM events the control connection is subscribed to. */
+void handleTorEvent(void* arg, const TorControlReply* reply)
+{
+	int id;
+	char status[16];
+	const char* event = reply->lines[0].c_str();
+
+	if(strncmp(event, "CIRC ", 5) == 0)
+	{
+		int state = circuitTable.update(event + 5);
+		if(state != -1)
+		{
+			handleCircuitEvent(atoi(event + 5), state);
+		}
+	}
+	else if((sscanf(event, "STREAM %d %15s", &id, status) == 2) && (strcmp(status, "NEW") == 0))
+	{
+		// Streams of other probes may close meanwhile; only the NEW event is ours
+		newStreamId = id;
+	}
+}
+
+/* Records the CIRCUIT_STATE_* reported for circuit id on the probe waiting for it. */
+void handleCircuitEvent(int id, int state)
+{
+	for(int k = 0; k < probeCount + prebuildDepth; k++)
+	{
+		if((probes[k].state != PROBE_SETUP) || (probes[k].circuitId != id))
+		{
+			continue;
+		}
+
+		if(state == CIRCUIT_STATE_BUILT)
+		{
+			probes[k].circuitStatus = CIRCUIT_STATUS_BUILT;
+		}
+		else if((state == CIRCUIT_STATE_FAILED) || (state == CIRCUIT_STATE_CLOSED))
+		{
+			probes[k].circuitStatus = (probes[k].circuitStatus == CIRCUIT_STATUS_BUILT) ? CIRCUIT_STATUS_CLOSED : CIRCUIT_STATUS_FAILED;
+		}
+		break;
+	}
+}
+
+/*
+Opens the SOCKS connection of the selected probe, attaches its stream to the
+probe's circuit and checks that Tor uses that circuit. Returns 0 with
+clientSocket connected, or -1 when the circuit has to be skipped.
+*/
+int attachStream(const Probe* probe)
+{
+	TorControlReply reply;
+	int res;
+
+	// Turn on "setevents stream"
+	newStreamId = -1;
+	res = sendTorCommand("setevents circ stream\n", &reply);
+	if(res == -1)
+	{
+		fprintf(stderr, "[attachStream] Failed to send command [%s] to Tor control server. Terminating process.\n", "setevents circ stream\n");
+		exit(1);
+	}
+
+	clientSocket = createSocket(SOCK_STREAM);
+
+	struct sockaddr_in socksServerAddress = createSocketAddress(SOCKS_SERVER_IP_ADDRESS, SOCKS_SERVER_PORT);
+
+	res = connect(clientSocket, (struct sockaddr*)&socksServerAddress, sizeof(socksServerAddress));
+	if(res == -1)
+	{
+		fprintf(stderr, "[attachStream] Cannot connect to SOCKS server. Terminating process.\n");
+		exit(1);
+	}
+	fprintf(stdout, "[attachStream] Connected to SOCKS server.\n");
+
+	// Perform handshake with the SOCKS server
+	SocksAuthMethodRequest samReq = createSocksAuthMethodRequest(0x05, 1, SOCKS_AUTH_METHOD_NONE);
+	res = send(clientSocket, (void*)&samReq, sizeof(samReq), 0);
+	if(res == -1)
+	{
+		fprintf(stderr, "[attachStream] Failed to send SOCKS authentication method request. Terminating process.\n");
+		exit(1);
+	}
+	fprintf(stdout, "[attachStream] Sent authentication method request to SOCKS server.\n");
+
+	SocksAuthMethodResponse samRes;
+	res = recv(clientSocket, (void*)&samRes, sizeof(samRes), 0);
+	if(res == -1)
+	{
+		fprintf(stderr, "[attachStream] Failed to receive SOCKS authentication method response. Terminating process.\n");
+		exit(1);
+	}
+	else
+	{
+		fprintf(stdout, "[attachStream] Received authentication method response from SOCKS server.\n");
+
+		if(samRes.method == SOCKS_AUTH_METHOD_UNACCEPTABLE)
 		{
-			fprintf(stderr, "[measureTPandGP] Bad response from Tor control server. Circuit is unknown. Failed to attach stream to circuit. Terminating process.\n");
+			fprintf(stderr, "[attachStream] SOCKS authentication method unacceptable. Terminating process.\n");
 			exit(1);
 		}
-		else
+	}
+	fprintf(stdout, "[attachStream] Authentication completed with SOCKS server.\n");
+
+	SocksConnRequest scReq = createSocksConnRequest(0x05, SOCKS_CMD_TCP_CONN, SOCKS_ADDR_TYPE_IPV4, serverIPAddress.c_str(), serverPort);
+	res = send(clientSocket, (void*)&scReq, sizeof(scReq), 0);
+	if(res == -1)
+	{
+		fprintf(stderr, "[attachStream] Failed to send SOCKS connection request. Terminating process.\n");
+		exit(1);
+	}
+	fprintf(stdout, "[attachStream] Sent connection request to SOCKS server.\n");
+
+	// Read stream ID and attach the stream to the circuit
+	while(newStreamId == -1)
+	{
+		if(torControl.process(-1) == -1)
 		{
-			fprintf(stdout, "[measureTPandGP] Successfully attached stream %d to circuit %d.\n", streamId, circuitId);
+			fprintf(stderr, "[attachStream] Failed to receive response from Tor control server. Terminating process.\n");
+			exit(1);
 		}
 	}
 
+	int streamId = newStreamId;
+
+	// Turn off "setevents stream"
+	res = sendTorCommand("setevents circ\n", &reply);
+	if(res == -1)
+	{
+		fprintf(stderr, "[attachStream] Failed to send command [%s] to Tor control server. Terminating process.\n", "setevents circ\n");
+		exit(1);
+	}
+
+	// A prebuilt circuit may have closed since runProbes() picked it, or while the stream was opened
+	if((probe->circuitStatus != CIRCUIT_STATUS_BUILT) || (circuitTable.find(circuitId) == NULL))
+	{
+		fprintf(stderr, "[attachStream] Circuit %d closed before the stream was attached. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", circuitId, middlemanNodeName.c_str(), exitNodeName.c_str());
+
+		pthread_mutex_lock(&fileMutex);
+		fprintf(allDataFile, "[attachStream] Circuit %d closed before the stream was attached. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", circuitId, middlemanNodeName.c_str(), exitNodeName.c_str());
+		fflush(allDataFile);
+		fprintf(tpgpFile, "[attachStream] Circuit %d closed before the stream was attached. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", circuitId, middlemanNodeName.c_str(), exitNodeName.c_str());
+		fflush(tpgpFile);
+		pthread_mutex_unlock(&fileMutex);
+
+		close(clientSocket);
+		clientSocket = -1;
+		return -1;
+	}
+
+	// Attach the stream to the circuit
+	char buffer[MAX_BUFFER_SIZE];
+	snprintf(buffer, MAX_BUFFER_SIZE - 1, "attachstream %d %d\n", streamId, circuitId);
+	string command = buffer;
+	res = sendTorCommand(command, &reply);
+	if(res == -1)
+	{
+		fprintf(stderr, "[attachStream] Failed to send command [%s] to Tor control server. Terminating process.\n", command.c_str());
+		exit(1);
+	}
+
+	// 552 when the circuit went away after the check above
+	if(res != 250)
+	{
+		fprintf(stderr, "[attachStream] Failed to attach stream %d to circuit %d (status = %d). Skipping this circuit. [Middleman: %s] [Exit: %s]\n", streamId, circuitId, res, middlemanNodeName.c_str(), exitNodeName.c_str());
+
+		pthread_mutex_lock(&fileMutex);
+		fprintf(allDataFile, "[attachStream] Failed to attach stream %d to circuit %d (status = %d). Skipping this circuit. [Middleman: %s] [Exit: %s]\n", streamId, circuitId, res, middlemanNodeName.c_str(), exitNodeName.c_str());
+		fflush(allDataFile);
+		fprintf(tpgpFile, "[attachStream] Failed to attach stream %d to circuit %d (status = %d). Skipping this circuit. [Middleman: %s] [Exit: %s]\n", streamId, circuitId, res, middlemanNodeName.c_str(), exitNodeName.c_str());
+		fflush(tpgpFile);
+		pthread_mutex_unlock(&fileMutex);
+
+		close(clientSocket);
+		clientSocket = -1;
+		return -1;
+	}
+
+	fprintf(stdout, "[attachStream] Successfully attached stream %d to circuit %d.\n", streamId, circuitId);
+
 	SocksConnResponse scRes;
 	res = recv(clientSocket, (void*)&scRes, sizeof(scRes), 0);
 	if(res == -1)
 	{
-		fprintf(stderr, "[measureTPandGP] Failed to receive SOCKS connection response. Terminating process.\n");
+		fprintf(stderr, "[attachStream] Failed to receive SOCKS connection response. Terminating process.\n");
 		exit(1);
 	}
 	else
 	{
-		fprintf(stdout, "[measureTPandGP] Received connection response from SOCKS server.\n");
+		fprintf(stdout, "[attachStream] Received connection response from SOCKS server.\n");
 
 		if(scRes.status != SOCKS_STATUS_REQUEST_GRANTED)
 		{
-			fprintf(stderr, "[measureTPandGP] SOCKS connection error (status = %x). Skipping this circuit. [Middleman: %s] [Exit: %s]\n", scRes.status, middlemanNodeName.c_str(), exitNodeName.c_str());
+			fprintf(stderr, "[attachStream] SOCKS connection error (status = %x). Skipping this circuit. [Middleman: %s] [Exit: %s]\n", scRes.status, middlemanNodeName.c_str(), exitNodeName.c_str());
 
 			pthread_mutex_lock(&fileMutex);
-			fprintf(allDataFile, "[measureTPandGP] SOCKS connection error (status = %x). Skipping this circuit. [Middleman: %s] [Exit: %s]\n", scRes.status, middlemanNodeName.c_str(), exitNodeName.c_str());
+			fprintf(allDataFile, "[attachStream] SOCKS connection error (status = %x). Skipping this circuit. [Middleman: %s] [Exit: %s]\n", scRes.status, middlemanNodeName.c_str(), exitNodeName.c_str());
 			fflush(allDataFile);
-			fprintf(tpgpFile, "[measureTPandGP] SOCKS connection error (status = %x). Skipping this circuit. [Middleman: %s] [Exit: %s]\n", scRes.status, middlemanNodeName.c_str(), exitNodeName.c_str());
+			fprintf(tpgpFile, "[attachStream] SOCKS connection error (status = %x). Skipping this circuit. [Middleman: %s] [Exit: %s]\n", scRes.status, middlemanNodeName.c_str(), exitNodeName.c_str());
 			fflush(tpgpFile);
 			pthread_mutex_unlock(&fileMutex);
 
 			close(clientSocket);
-			return;
+			clientSocket = -1;
+			return -1;
 		}
 	}
-	fprintf(stdout, "[measureTPandGP] Connection successful.\n");
+	fprintf(stdout, "[attachStream] Connection successful.\n");
 
 	// Verify whether we are using the right circuit or not
 	res = verifyTorCircuit();
 	if(res != 0)
 	{
-		fprintf(stdout, "[measureTPandGP] Tor is not using the right circuit. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
+		fprintf(stdout, "[attachStream] Tor is not using the right circuit. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
 
 		pthread_mutex_lock(&fileMutex);
-		fprintf(allDataFile, "[measureTPandGP] Tor is not using the right circuit. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
+		fprintf(allDataFile, "[attachStream] Tor is not using the right circuit. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
 		fflush(allDataFile);
-		fprintf(tpgpFile, "[measureTPandGP] Tor is not using the right circuit. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
+		fprintf(tpgpFile, "[attachStream] Tor is not using the right circuit. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
 		fflush(tpgpFile);
 		pthread_mutex_unlock(&fileMutex);
 
 		close(clientSocket);
-		return;
+		clientSocket = -1;
+		return -1;
 	}
 	else
 	{
-		fprintf(stdout, "[measureTPandGP] Tor is probably using the right circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
+		fprintf(stdout, "[attachStream] Tor is probably using the right circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
 
 		pthread_mutex_lock(&fileMutex);
-		fprintf(allDataFile, "[measureTPandGP] Tor is probably using the right circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
+		fprintf(allDataFile, "[attachStream] Tor is probably using the right circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
 		fflush(allDataFile);
-		fprintf(tpgpFile, "[measureTPandGP] Tor is probably using the right circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
+		fprintf(tpgpFile, "[attachStream] Tor is probably using the right circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
 		fflush(tpgpFile);
 		pthread_mutex_unlock(&fileMutex);
 	}
 
+	return 0;
+}
+
+/*
+Starts one worker per measurement slot. Each keeps its monitor and recv threads,
+its timer and its buffers for the whole run, so a measurement costs no process or
+thread creation.
+*/
+void startWorkers()
+{
+	for(int w = 0; w < probeCount; w++)
+	{
+		MeasurementWorker* worker = &workers[w];
+
+		worker->state = WORKER_IDLE;
+		worker->receiving = false;
+		worker->stopFlag = false;
+		worker->clientSocket = -1;
+		worker->flow = -1;
+		worker->measurement.binner = NULL;
+		worker->measurement.traceWriter = NULL;
+
+		// The workers append whole traces to the file main() created
+		if(traceWriter != NULL)
+		{
+			worker->measurement.traceWriter = new TraceFileWriter();
+			if(worker->measurement.traceWriter->open(traceFileName.c_str(), false) == -1)
+			{
+				fprintf(stderr, "[startWorkers] Cannot open file %s for output. Terminating process.\n", traceFileName.c_str());
+				exit(1);
+			}
+		}
+
+		createMutex(&worker->mutex);
+		pthread_cond_init(&worker->cond, NULL);
+
+		createThread(&worker->monitorThread, monitorThreadFunction, worker, PTHREAD_CREATE_JOINABLE);
+		createThread(&worker->recvThread, recvThreadFunction, worker, PTHREAD_CREATE_JOINABLE);
+	}
+}
+
+/* Lets the idle workers' threads finish and joins them. */
+void stopWorkers()
+{
+	for(int w = 0; w < probeCount; w++)
+	{
+		MeasurementWorker* worker = &workers[w];
+
+		pthread_mutex_lock(&worker->mutex);
+		worker->state = WORKER_QUIT;
+		pthread_cond_broadcast(&worker->cond);
+		pthread_mutex_unlock(&worker->mutex);
+
+		pthread_join(worker->monitorThread, NULL);
+		pthread_join(worker->recvThread, NULL);
+
+		pthread_cond_destroy(&worker->cond);
+		pthread_mutex_destroy(&worker->mutex);
+
+		if(worker->measurement.traceWriter != NULL)
+		{
+			worker->measurement.traceWriter->close();
+			delete worker->measurement.traceWriter;
+			worker->measurement.traceWriter = NULL;
+		}
+	}
+}
+
+/* Returns true, and makes the worker idle again, when its measurement is over. */
+bool collectWorker(MeasurementWorker* worker)
+{
+	bool done = false;
+
+	pthread_mutex_lock(&worker->mutex);
+	if(worker->state == WORKER_DONE)
+	{
+		worker->state = WORKER_IDLE;
+		done = true;
+	}
+	pthread_mutex_unlock(&worker->mutex);
+
+	return done;
+}
+
+/* Runs the measurements startMeasurement() hands to the worker, one at a time. */
+void* monitorThreadFunction(void* arg)
+{
+	MeasurementWorker* worker = (MeasurementWorker*)arg;
+
+	while(true)
+	{
+		pthread_mutex_lock(&worker->mutex);
+		while((worker->state != WORKER_MEASURING) && (worker->state != WORKER_QUIT))
+		{
+			pthread_cond_wait(&worker->cond, &worker->mutex);
+		}
+		int state = worker->state;
+		pthread_mutex_unlock(&worker->mutex);
+
+		if(state == WORKER_QUIT)
+		{
+			break;
+		}
+
+		measureTPandGP(worker);
+
+		pthread_mutex_lock(&worker->mutex);
+		worker->state = WORKER_DONE;
+		pthread_mutex_unlock(&worker->mutex);
+	}
+
+	return NULL;
+}
+
+/* Measures the middleman whose attached stream startMeasurement() gave the worker. */
+void measureTPandGP(MeasurementWorker* worker)
+{
+	Measurement* measurement = &worker->measurement;
+	int res;
+
 	// Now send and recv data
 	unsigned short int endHostID = htons(1);
-	res = send(clientSocket, (void*)&endHostID, sizeof(endHostID), 0);
+	res = send(worker->clientSocket, (void*)&endHostID, sizeof(endHostID), 0);
 	if(res == -1)
 	{
-		fprintf(stderr, "[measureTPandGP] Failed to send end host ID. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
-		close(clientSocket);
+		fprintf(stderr, "[measureTPandGP] Failed to send end host ID. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", measurement->middlemanName.c_str(), exitNodeName.c_str());
+		close(worker->clientSocket);
+		worker->clientSocket = -1;
 		return;
 	}
 	fprintf(stdout, "[measureTPandGP] Sent end host ID to server.\n");
 
-	// Get ready to measure throughput and goodput
-	pcapBytesReceived = 0;
-	tcpBytesReceived = 0;
+	// Get ready to measure throughput and goodput; the capture thread fills this flow's bins
+	measurement->binner = flowTable->getBinner(worker->flow);
+	measurement->binner->start(getTime());
 
-	exitFlag = false;
-	secCounter = 0;
+	if(measurement->traceWriter != NULL)
+	{
+		measurement->traceWriter->beginTrace(measurement->middlemanName, exitNodeName, measurement->middlemanFingerprint, measurement->binner->getBinWidth(), measurement->binner->getOrigin());
+	}
 
-	pthread_t pcapThread;
-	createThread(&pcapThread, pcapThreadFunction, NULL, PTHREAD_CREATE_JOINABLE);
+	resetMeasurement(measurement);
+
+	// The recv thread is already waiting for the stream
+	pthread_mutex_lock(&worker->mutex);
+	worker->stopFlag = false;
+	worker->receiving = true;
+	pthread_cond_broadcast(&worker->cond);
+	pthread_mutex_unlock(&worker->mutex);
+
+	// After this "send" the server will start sending data to the client
+	char c = 'a';
+	res = send(worker->clientSocket, (void*)&c, sizeof(c), 0);
+	if(res == -1)
+	{
+		fprintf(stderr, "[measureTPandGP] Failed to send client character. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", measurement->middlemanName.c_str(), exitNodeName.c_str());
+		stopTransfer(worker);
+		return;
+	}
+	fprintf(stdout, "[measureTPandGP] Sent client character to server.\n");
+
+	double binWidth = measurement->binner->getBinWidth();
+	double monitorPeriod = (binWidth > MONITOR_MIN_PERIOD) ? binWidth : MONITOR_MIN_PERIOD;
+
+	uint64_t bytes[BIN_SERIES_COUNT];
+	int64_t index;
+
+	if(worker->timer.start(monitorPeriod) == -1)
+	{
+		fprintf(stderr, "[measureTPandGP] Cannot start the monitor timer. Terminating process.\n");
+		exit(1);
+	}
+
+	while(__atomic_load_n(&worker->stopFlag, __ATOMIC_ACQUIRE) == false)
+	{
+		if((duration != 0) && (measurement->secCounter >= duration))
+		{
+			break;
+		}
+
+		// Only paces the output; the bins themselves are keyed on packet timestamps
+		int64_t ticks = worker->timer.wait();
+		if(ticks == -1)
+		{
+			break;
+		}
+
+		if(ticks > 1)
+		{
+			fprintf(stderr, "[measureTPandGP] Missed %lld monitor ticks.\n", (long long)(ticks - 1));
+		}
+
+		while(((duration == 0) || (measurement->secCounter < duration)) && measurement->binner->next(getTime(), BIN_LAG, &index, bytes))
+		{
+			reportInterval(measurement, index, bytes);
+		}
+	}
+
+	worker->timer.stop();
+
+	stopTransfer(worker);
+
+	reportSummary(measurement);
+}
+
+/*
+Stops the recv thread cooperatively: shutdown() wakes it from recv() and it goes
+back to waiting for the next stream, after which the socket is closed.
+*/
+void stopTransfer(MeasurementWorker* worker)
+{
+	fprintf(stdout, "[stopTransfer] Stopping data transfer.\n");
+
+	__atomic_store_n(&worker->stopFlag, true, __ATOMIC_RELEASE);
+	shutdown(worker->clientSocket, SHUT_RDWR);
+
+	pthread_mutex_lock(&worker->mutex);
+	while(worker->receiving == true)
+	{
+		pthread_cond_wait(&worker->cond, &worker->mutex);
+	}
+	pthread_mutex_unlock(&worker->mutex);
+
+	close(worker->clientSocket);
+	worker->clientSocket = -1;
+
+	fprintf(stdout, "[stopTransfer] Stopped data transfer.\n");
+}
+
+/* Starts the intervals and averages of a new middleman. */
+void resetMeasurement(Measurement* measurement)
+{
+	measurement->secCounter = 0;
+	measurement->mCount = 0;
+	measurement->tpCumulative = 0.0;
+	measurement->gpCumulative = 0.0;
+	measurement->referenceCorrelation.reset();
+}
+
+/* Prints and stores the throughput and goodput of one completed bin. */
+void reportInterval(Measurement* measurement, int64_t index, const uint64_t* bytes)
+{
+	double binWidth = measurement->binner->getBinWidth();
+
+	measurement->secCounter = (index + 1) * binWidth;
+
+	++measurement->mCount;
+
+	double tp = (bytes[BIN_SERIES_PCAP] / binWidth) / 1024; // KBps
+
+	measurement->tpCumulative += tp;
+
+	double gp = (bytes[BIN_SERIES_TCP] / binWidth) / 1024; // KBps
+
+	measurement->gpCumulative += gp;
+
+	// Capture health; intervals in which the kernel or the interface dropped packets are flagged
+	char health[MAX_BUFFER_SIZE] = "";
+	if(offlineFileName.empty())
+	{
+		snprintf(health, MAX_BUFFER_SIZE - 1, " Received %llu Dropped %llu IfDropped %llu CallbackTime(ms) %f%s", (unsigned long long)bytes[BIN_SERIES_RECEIVED], (unsigned long long)bytes[BIN_SERIES_DROPPED], (unsigned long long)bytes[BIN_SERIES_IFDROPPED], bytes[BIN_SERIES_CALLBACK] / 1000000.0, ((bytes[BIN_SERIES_DROPPED] + bytes[BIN_SERIES_IFDROPPED]) > 0) ? " CaptureDrops" : "");
+	}
+
+	if((unsigned int)(measurement->mCount - 1) < vReferenceTrace.size())
+	{
+		measurement->referenceCorrelation.add(tp, vReferenceTrace[measurement->mCount - 1].throughput);
+		fprintf(stdout, "Middleman %s Exit %s Time %f Throughput(KBps) %f Goodput(KBps) %f MiddlemanFP %s Correlation %f%s\n", measurement->middlemanName.c_str(), exitNodeName.c_str(), measurement->secCounter, tp, gp, measurement->middlemanFingerprint.c_str(), measurement->referenceCorrelation.getCorrelation(), health);
+	}
+	else
+	{
+		fprintf(stdout, "Middleman %s Exit %s Time %f Throughput(KBps) %f Goodput(KBps) %f MiddlemanFP %s%s\n", measurement->middlemanName.c_str(), exitNodeName.c_str(), measurement->secCounter, tp, gp, measurement->middlemanFingerprint.c_str(), health);
+	}
+
+	pthread_mutex_lock(&fileMutex);
+	if(measurement->traceWriter != NULL)
+	{
+		measurement->traceWriter->add(measurement->secCounter, tp, gp);
+	}
+	else if(allDataFile != NULL)
+	{
+		fprintf(allDataFile, "Middleman %s Exit %s Time %f Throughput(KBps) %f Goodput(KBps) %f MiddlemanFP %s%s\n", measurement->middlemanName.c_str(), exitNodeName.c_str(), measurement->secCounter, tp, gp, measurement->middlemanFingerprint.c_str(), health);
+		fflush(allDataFile);
+	}
+	pthread_mutex_unlock(&fileMutex);
+}
+
+/* Prints and stores the averages over the current middleman's intervals. */
+void reportSummary(Measurement* measurement)
+{
+	double tpAvg = measurement->tpCumulative / ((measurement->mCount > 0)?measurement->mCount:1);
+	double gpAvg = measurement->gpCumulative / ((measurement->mCount > 0)?measurement->mCount:1);
+
+	fprintf(stdout, "Middleman %s Exit %s Time %f Throughput(KBps) %f Goodput(KBps) %f MiddlemanFP %s\n", measurement->middlemanName.c_str(), exitNodeName.c_str(), measurement->secCounter, tpAvg, gpAvg, measurement->middlemanFingerprint.c_str());
+
+	pthread_mutex_lock(&fileMutex);
+	if(measurement->traceWriter != NULL)
+	{
+		measurement->traceWriter->endTrace();
+	}
+
+	if(tpgpFile != NULL)
+	{
+		if(measurement->referenceCorrelation.getCount() > 0)
+		{
+			fprintf(tpgpFile, "Middleman %s Exit %s Time %f Throughput(KBps) %f Goodput(KBps) %f MiddlemanFP %s Correlation %f\n", measurement->middlemanName.c_str(), exitNodeName.c_str(), measurement->secCounter, tpAvg, gpAvg, measurement->middlemanFingerprint.c_str(), measurement->referenceCorrelation.getCorrelation());
+		}
+		else
+		{
+			fprintf(tpgpFile, "Middleman %s Exit %s Time %f Throughput(KBps) %f Goodput(KBps) %f MiddlemanFP %s\n", measurement->middlemanName.c_str(), exitNodeName.c_str(), measurement->secCounter, tpAvg, gpAvg, measurement->middlemanFingerprint.c_str());
+		}
+		fflush(tpgpFile);
+	}
+	pthread_mutex_unlock(&fileMutex);
+}
 
-	pthread_t recvThread;
-	createThread(&recvThread, recvThreadFunction, NULL, PTHREAD_CREATE_JOINABLE);
+/*
+Regenerates the series of every relay from a capture file in one pass, as fast
+as it can be read. Each relay's flow is registered in flowTable, as with the
+live capture, and every packet goes to the bins of its flow. A relay's bins
+start at its first packet and are closed by the timestamps of its packets that
+follow, so the result does not depend on the replay speed. No payload is
+received, so goodput is reported as 0.
+*/
+void replayTPandGP(const RelayTable& relays)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	vector<int> flows;	// in relay table order
 
-	usleep(500000); // Sleep for 0.5 sec to let the other threads to initialize
+	ReplayFlow unused;
+	unused.measurement.binner = NULL;
 
-	double tpCumulative = 0.0;
-	double gpCumulative = 0.0;
+	for(unsigned int i = 1; i <= (unsigned int)relays.getRelayCount(); i++)
+	{
+		Probe probe;
+		setProbeRelay(&probe, relays.getRelay(i - 1));
+		selectProbe(&probe);
 
-	int mCount = 0;
+		if(middlemanNodeName.compare(exitNodeName) == 0)
+		{
+			fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Skipping the middleman node that is also the exit node. [Middleman: %s] [Exit: %s]\n\n", i, middlemanNodeName.c_str(), exitNodeName.c_str());
+			continue;
+		}
+
+		int flow = flowTable->registerFlow(createFlowKey(inet_addr(middlemanNodeIPAddress.c_str()), middlemanNodePort, 0, 0));
+		if(flow == -1)
+		{
+			fprintf(stderr, "[replayTPandGP] [%u] Cannot register the middleman flow. Terminating process.\n", i);
+			exit(1);
+		}
+
+		if((size_t)flow >= replayFlows.size())
+		{
+			replayFlows.resize(flow + 1, unused);
+		}
+
+		// Two relays on one address and ORPort would get the same packets
+		ReplayFlow* replay = &replayFlows[flow];
+		if(replay->measurement.binner != NULL)
+		{
+			fprintf(stdout, "[TOR-NODE-TP-GP-CALC] [%u] Skipping the middleman node with the address and ORPort of %s. [Middleman: %s] [Exit: %s]\n\n", i, replay->measurement.middlemanName.c_str(), middlemanNodeName.c_str(), exitNodeName.c_str());
+			continue;
+		}
+
+		replay->started = false;
+		replay->done = false;
+		replay->lastTime = 0;
+		replay->measurement.middlemanName = middlemanNodeName;
+		replay->measurement.middlemanFingerprint = middlemanNodeFingerprint;
+		replay->measurement.binner = flowTable->getBinner(flow);
+		replay->measurement.traceWriter = NULL;
+		resetMeasurement(&replay->measurement);
+
+		flows.push_back(flow);
+	}
+
+	fprintf(stdout, "[TOR-NODE-TP-GP-CALC] Replaying capture file %s. [Relays: %u]\n", offlineFileName.c_str(), (unsigned int)flows.size());
+
+	handle = pcap_open_offline(offlineFileName.c_str(), errbuf);
+	if (handle == NULL)
+	{
+		fprintf(stderr, "[replayTPandGP] Couldn't open capture file %s: %s. Terminating process.\n", offlineFileName.c_str(), errbuf);
+		exit(1);
+	}
+
+	// flowTable picks out the relays; the filter only skips the other protocols
+	string filter_exp = "tcp";
+
+	if (pcap_compile(handle, &fp, (char*)filter_exp.c_str(), 1, PCAP_NETMASK_UNKNOWN) == -1)
+	{
+		fprintf(stderr, "[replayTPandGP] Couldn't parse filter %s: %s. Terminating process.\n", filter_exp.c_str(), pcap_geterr(handle));
+		exit(1);
+	}
 
-	// After this "send" the server will start sending data to the client
-	char c = 'a';
-	res = send(clientSocket, (void*)&c, sizeof(c), 0);
-	if(res == -1)
+	if (pcap_setfilter(handle, &fp) == -1)
 	{
-		fprintf(stderr, "[measureTPandGP] Failed to send client character. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
-		close(clientSocket);
-		return;
+		fprintf(stderr, "[replayTPandGP] Couldn't install filter %s: %s. Terminating process.\n", filter_exp.c_str(), pcap_geterr(handle));
+		exit(1);
 	}
-	fprintf(stdout, "[measureTPandGP] Sent client character to server.\n");
 
-	while(exitFlag == false)
+	if (pcap_loop(handle, -1, replay_packet, NULL) == -1)
 	{
-		if((duration != 0) && (secCounter >= duration))
-		{
-			exitFlag = true;
-			break;
-		}
+		fprintf(stderr, "[replayTPandGP] Error in reading capture file %s: %s. Terminating process.\n", offlineFileName.c_str(), pcap_geterr(handle));
+		exit(1);
+	}
 
-		unsigned int n = 0;
+	pcap_freecode(&fp);
+	pcap_close(handle);
 
-		if((unsigned int)measurementInterval != 0)
-		{
-			n = sleep((unsigned int)measurementInterval);
-		}
+	// Report each relay's bins up to and including the one holding its last packet
+	int matched = 0;
 
-		if(((unsigned int)measurementInterval != 0) && (n == (unsigned int)measurementInterval))
+	for (unsigned int i = 0; i < flows.size(); i++)
+	{
+		ReplayFlow* replay = &replayFlows[flows[i]];
+		if (replay->started == false)
 		{
-			pthread_mutex_lock(&pcapMutex);
-			pcapBytesReceived = 0;
-			pthread_mutex_unlock(&pcapMutex);
-
-			pthread_mutex_lock(&tcpMutex);
-			tcpBytesReceived = 0;
-			pthread_mutex_unlock(&tcpMutex);
-
 			continue;
 		}
 
-		secCounter += ((unsigned int)measurementInterval - n);
+		++matched;
 
-		unsigned long usecInterval = (unsigned long)((measurementInterval - (unsigned int)measurementInterval) * 1000000);
+		Measurement* measurement = &replay->measurement;
+		int64_t index;
+		uint64_t bytes[BIN_SERIES_COUNT];
 
-		if((usecInterval == 0) && ((unsigned int)measurementInterval == 0))
+		while ((measurement->secCounter < duration) && measurement->binner->next(replay->lastTime + measurement->binner->getBinWidth(), 0, &index, bytes))
 		{
-			usecInterval = 1;
-			measurementInterval = 1.0 / 1000000.0; // Set it to 1 us
+			reportInterval(measurement, index, bytes);
 		}
 
-		if(usecInterval != 0)
+		reportSummary(measurement);
+
+		if (measurement->traceWriter != NULL)
 		{
-			usleep(usecInterval);
-			secCounter += (measurementInterval - (unsigned int)measurementInterval);
+			measurement->traceWriter->close();
+			delete measurement->traceWriter;
+			measurement->traceWriter = NULL;
 		}
+	}
 
-		++mCount;
-
-		pthread_mutex_lock(&pcapMutex);
-		double tp = ((pcapBytesReceived / (measurementInterval - n)) * 1) / 1024; // KBps
-		pcapBytesReceived = 0;
-		pthread_mutex_unlock(&pcapMutex);
+	fprintf(stdout, "[TOR-NODE-TP-GP-CALC] Replay completed. [Relays with packets: %d of %u]\n\n", matched, (unsigned int)flows.size());
+}
 
-		tpCumulative += tp;
+void replay_packet(unsigned char* args, const struct pcap_pkthdr* header, const unsigned char* packet)
+{
+	PacketView p(packet, header->caplen, header->len);
+	if (p.isValid() == false)
+	{
+		return;
+	}
 
-		pthread_mutex_lock(&tcpMutex);
-		double gp = ((tcpBytesReceived / (measurementInterval - n)) * 1) / 1024; // KBps
-		tcpBytesReceived = 0;
-		pthread_mutex_unlock(&tcpMutex);
+	int flow = flowTable->lookup(createFlowKey(p.getSourceAddress(), p.getSourcePort(), 0, 0));
+	if ((flow == -1) || replayFlows[flow].done)
+	{
+		return;
+	}
 
-		gpCumulative += gp;
+	ReplayFlow* replay = &replayFlows[flow];
+	Measurement* measurement = &replay->measurement;
+	double ts = header->ts.tv_sec + header->ts.tv_usec / 1000000.0;
 
-		fprintf(stdout, "Middleman %s Exit %s Time %f Throughput(KBps) %f Goodput(KBps) %f MiddlemanFP %s\n", middlemanNodeName.c_str(), exitNodeName.c_str(), secCounter, tp, gp, middlemanNodeFingerprint.c_str());
+	if (replay->started == false)
+	{
+		measurement->binner->start(ts);
+		replay->started = true;
 
-		pthread_mutex_lock(&fileMutex);
-		if(allDataFile != NULL)
+		// Each relay's trace is kept whole in its own writer until its summary
+		if (traceWriter != NULL)
 		{
-			fprintf(allDataFile, "Middleman %s Exit %s Time %f Throughput(KBps) %f Goodput(KBps) %f MiddlemanFP %s\n", middlemanNodeName.c_str(), exitNodeName.c_str(), secCounter, tp, gp, middlemanNodeFingerprint.c_str());
-			fflush(allDataFile);
+			measurement->traceWriter = new TraceFileWriter();
+			if (measurement->traceWriter->open(traceFileName.c_str(), false) == -1)
+			{
+				fprintf(stderr, "[replay_packet] Cannot open file %s for output. Terminating process.\n", traceFileName.c_str());
+				exit(1);
+			}
+
+			measurement->traceWriter->beginTrace(measurement->middlemanName, exitNodeName, measurement->middlemanFingerprint, measurement->binner->getBinWidth(), ts);
 		}
-		pthread_mutex_unlock(&fileMutex);
 	}
 
-	pthread_mutex_lock(&tcpMutex);
-	if(clientSocket != -1)
+	replay->lastTime = ts;
+
+	// The relay's packets are in time order, so every bin that ends before this one is complete
+	int64_t index;
+	uint64_t bytes[BIN_SERIES_COUNT];
+
+	while (measurement->binner->next(ts, 0, &index, bytes))
 	{
-		close(clientSocket);
-		clientSocket = -1;
+		reportInterval(measurement, index, bytes);
+
+		if (measurement->secCounter >= duration)
+		{
+			replay->done = true;
+			return;
+		}
 	}
-	pthread_mutex_unlock(&tcpMutex);
 
-	double tpAvg = tpCumulative / ((mCount > 0)?mCount:1);
-	double gpAvg = gpCumulative / ((mCount > 0)?mCount:1);
+	measurement->binner->add(BIN_SERIES_PCAP, ts, p.getPayloadLength());
+}
 
-	fprintf(stdout, "Middleman %s Exit %s Time %f Throughput(KBps) %f Goodput(KBps) %f MiddlemanFP %s\n", middlemanNodeName.c_str(), exitNodeName.c_str(), secCounter, tpAvg, gpAvg, middlemanNodeFingerprint.c_str());
+void* pcapThreadFunction(void* arg)
+{
+	char* dev;						// The device to sniff on
+	char errbuf[PCAP_ERRBUF_SIZE];	// Error string
+	bpf_u_int32 mask;				// Our netmask
+	bpf_u_int32 net;				// Our IP
 
-	pthread_mutex_lock(&fileMutex);
-	if(tpgpFile != NULL)
+	// Define the device
+	dev = (char*)captureDevice.c_str();
+	if (captureDevice.empty())
 	{
-		fprintf(tpgpFile, "Middleman %s Exit %s Time %f Throughput(KBps) %f Goodput(KBps) %f MiddlemanFP %s\n", middlemanNodeName.c_str(), exitNodeName.c_str(), secCounter, tpAvg, gpAvg, middlemanNodeFingerprint.c_str());
-		fflush(tpgpFile);
+		dev = pcap_lookupdev(errbuf);
 	}
-	pthread_mutex_unlock(&fileMutex);
 
-	// Completed measurement; now clean up
-	fprintf(stdout, "[measureTPandGP] Canceling pcapThread.\n");
-	res = pthread_cancel(pcapThread);
-	if(res != 0)
+	if (dev == NULL)
 	{
-		fprintf(stderr, "[measureTPandGP] Failed to cancel pcapThread.\n");
+		fprintf(stderr, "[pcapThreadFunction] Couldn't find default device: %s. Terminating process.\n", errbuf);
+		exit(1);
 	}
-	else
+
+	// Find the properties for the device
+	if (pcap_lookupnet(dev, &net, &mask, errbuf) == -1)
 	{
-		fprintf(stdout, "[measureTPandGP] Successfully canceled pcapThread.\n");
+		fprintf(stderr, "[pcapThreadFunction] Couldn't get netmask for device %s: %s. Terminating process.\n", dev, errbuf);
+		exit(1);
 	}
 
-	fprintf(stdout, "[measureTPandGP] Canceling recvThread.\n");
-	res = pthread_cancel(recvThread);
-	if(res != 0)
+	// Open the session in non-promiscuous mode; the ring backend only needs a handle to compile the filter
+	if (captureBackend == CAPTURE_BACKEND_RING)
 	{
-		fprintf(stderr, "[measureTPandGP] Failed to cancel recvThread.\n");
+		handle = pcap_open_dead(DLT_EN10MB, snapLength);
 	}
 	else
 	{
-		fprintf(stdout, "[measureTPandGP] Successfully canceled recvThread.\n");
+		handle = pcap_open_live(dev, snapLength, 0, 1000, errbuf);
 	}
 
-	fprintf(stdout, "[measureTPandGP] Waiting for pcapThread to terminate ...\n");
-	res = pthread_join(pcapThread, NULL);
-	if(res != 0)
+	if (handle == NULL)
+	{
+		fprintf(stderr, "[pcapThreadFunction] Couldn't open device %s: %s. Terminating process.\n", dev, errbuf);
+		exit(1);
+	}
+
+	// Compile and apply the filter of the flows registered so far
+	int generation = compileCaptureFilter(net, &fp);
+
+	if (captureBackend == CAPTURE_BACKEND_RING)
 	{
-		fprintf(stderr, "[measureTPandGP] Failed to join pcapThread.\n");
+		if (packetRing.open(dev, snapLength, (const struct sock_filter*)fp.bf_insns, fp.bf_len, PACKET_RING_DEFAULT_BLOCK_SIZE, PACKET_RING_DEFAULT_BLOCK_COUNT) == -1)
+		{
+			fprintf(stderr, "[pcapThreadFunction] Couldn't open packet ring on device %s. Terminating process.\n", dev);
+			exit(1);
+		}
 	}
 	else
 	{
-		fprintf(stdout, "[measureTPandGP] Successfully joined pcapThread.\n");
+		if (pcap_setfilter(handle, &fp) == -1)
+		{
+			fprintf(stderr, "[pcapThreadFunction] Couldn't install filter: %s. Terminating process.\n", pcap_geterr(handle));
+			exit(1);
+		}
+
+		memset(&lastStatistics, 0, sizeof(lastStatistics));
+
+		// The capture thread waits for packets itself, so it can sample the statistics when no packet arrives
+		if (pcap_setnonblock(handle, 1, errbuf) == -1)
+		{
+			fprintf(stderr, "[pcapThreadFunction] Couldn't set device %s non-blocking: %s. Terminating process.\n", dev, errbuf);
+			exit(1);
+		}
 	}
 
-	fprintf(stdout, "[measureTPandGP] Waiting for recvThread to terminate ...\n");
-	res = pthread_join(recvThread, NULL);
-	if(res != 0)
+	confirmCaptureFilter(generation);
+
+	// The capture wakes up for packets, for filter changes and for the statistics samples
+	struct pollfd pfd[2];
+	pfd[0].fd = (captureBackend == CAPTURE_BACKEND_RING) ? packetRing.getDescriptor() : pcap_get_selectable_fd(handle);
+	pfd[0].events = POLLIN;
+	pfd[1].fd = filterPipe[0];
+	pfd[1].events = POLLIN;
+
+	// Start packet capture
+	while (__atomic_load_n(&exitFlag, __ATOMIC_ACQUIRE) == false)
 	{
-		fprintf(stderr, "[measureTPandGP] Failed to join recvThread.\n");
+		pfd[1].revents = 0;
+
+		if ((poll(pfd, 2, getStatisticsTimeout(getTime())) == -1) && (errno != EINTR))
+		{
+			fprintf(stderr, "[pcapThreadFunction] Couldn't wait for packets: %s. Terminating process.\n", strerror(errno));
+			exit(1);
+		}
+
+		if (pfd[1].revents & POLLIN)
+		{
+			installCaptureFilter(net);
+		}
+
+		if (captureBackend == CAPTURE_BACKEND_RING)
+		{
+			if (packetRing.dispatch(got_frame, NULL, 0) == -1)
+			{
+				fprintf(stderr, "[pcapThreadFunction] Packet ring capture failed. Terminating process.\n");
+				exit(1);
+			}
+		}
+		else
+		{
+			if (pcap_dispatch(handle, -1, got_packet, NULL) == -1)
+			{
+				fprintf(stderr, "[pcapThreadFunction] Packet capture failed: %s. Terminating process.\n", pcap_geterr(handle));
+				exit(1);
+			}
+		}
+
+		sampleCaptureStatistics(getTime());
 	}
-	else
+
+	// Close the session
+	packetRing.close();
+	pcap_freecode(&fp);
+	pcap_close(handle);
+
+	pthread_exit(NULL);
+}
+
+/*
+Compiles the filter of the registered flows into program and returns its
+generation. Only the capture thread compiles filters.
+*/
+int compileCaptureFilter(bpf_u_int32 net, struct bpf_program* program)
+{
+	pthread_mutex_lock(&filterMutex);
+	string filter_exp = captureFilterExpression;
+	int generation = captureFilterGeneration;
+	pthread_mutex_unlock(&filterMutex);
+
+	if (pcap_compile(handle, program, (char*)filter_exp.c_str(), 1, net) == -1)
 	{
-		fprintf(stdout, "[measureTPandGP] Successfully joined recvThread.\n");
+		fprintf(stderr, "[compileCaptureFilter] Couldn't parse filter %s: %s. Terminating process.\n", filter_exp.c_str(), pcap_geterr(handle));
+		exit(1);
 	}
+
+	return generation;
 }
 
-void* pcapThreadFunction(void* arg)
+/* Tells updateCaptureFilter() that the filter of generation is in place. */
+void confirmCaptureFilter(int generation)
 {
-	setThreadAsyncCancel();
-
-	char* dev;						// The device to sniff on
-	char errbuf[PCAP_ERRBUF_SIZE];	// Error string
-	bpf_u_int32 mask;				// Our netmask
-	bpf_u_int32 net;				// Our IP
+	pthread_mutex_lock(&filterMutex);
+	installedFilterGeneration = generation;
+	pthread_cond_broadcast(&filterCond);
+	pthread_mutex_unlock(&filterMutex);
+}
 
-	// Define the device
-	dev = pcap_lookupdev(errbuf);
-	if (dev == NULL)
+/* Replaces the filter of the running capture with the one updateCaptureFilter() last built. */
+void installCaptureFilter(bpf_u_int32 net)
+{
+	char wakeups[64];
+	if (read(filterPipe[0], wakeups, sizeof(wakeups)) == -1)
 	{
-		fprintf(stderr, "[pcapThreadFunction] Couldn't find default device: %s. Terminating process.\n", errbuf);
+		fprintf(stderr, "[installCaptureFilter] Couldn't read the filter pipe: %s. Terminating process.\n", strerror(errno));
 		exit(1);
 	}
 
-	// Find the properties for the device
-	if (pcap_lookupnet(dev, &net, &mask, errbuf) == -1)
+	struct bpf_program program;
+	int generation = compileCaptureFilter(net, &program);
+
+	if (captureBackend == CAPTURE_BACKEND_RING)
 	{
-		fprintf(stderr, "[pcapThreadFunction] Couldn't get netmask for device %s: %s. Terminating process.\n", dev, errbuf);
-		exit(1);
+		if (packetRing.setFilter((const struct sock_filter*)program.bf_insns, program.bf_len) == -1)
+		{
+			fprintf(stderr, "[installCaptureFilter] Couldn't install filter on the packet ring. Terminating process.\n");
+			exit(1);
+		}
+	}
+	else
+	{
+		if (pcap_setfilter(handle, &program) == -1)
+		{
+			fprintf(stderr, "[installCaptureFilter] Couldn't install filter: %s. Terminating process.\n", pcap_geterr(handle));
+			exit(1);
+		}
 	}
 
-	// Open the session in non-promiscuous mode
-	handle = pcap_open_live(dev, BUFSIZ, 0, 1000, errbuf);
-	if (handle == NULL)
+	pcap_freecode(&program);
+
+	confirmCaptureFilter(generation);
+}
+
+void got_packet(unsigned char* args, const struct pcap_pkthdr* header, const unsigned char* packet)
+{
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	double ts = header->ts.tv_sec + header->ts.tv_usec / 1000000.0;
+
+	PacketView p(packet, header->caplen, header->len);
+
+	// fprintf(stdout, "Got packet, length: %d\n", p.getPayloadLength());
+
+	if(p.isValid())
 	{
-		fprintf(stderr, "[pcapThreadFunction] Couldn't open device %s: %s. Terminating process.\n", dev, errbuf);
-		exit(1);
+		int flow = flowTable->add(createFlowKey(p.getSourceAddress(), p.getSourcePort(), p.getDestinationAddress(), p.getDestinationPort()), BIN_SERIES_PCAP, ts, p.getPayloadLength());
+		if(flow != -1)
+		{
+			flowTable->getBinner(flow)->add(BIN_SERIES_CALLBACK, ts, getElapsedNanoseconds(&start));
+		}
 	}
+}
 
-	// char filter_exp[] = "host 128.174.240.149 and src port 22";	// The filter expression
-	char buffer[MAX_BUFFER_SIZE];
-	snprintf(buffer, MAX_BUFFER_SIZE - 1, "%u", middlemanNodePort);
+void got_frame(void* arg, const struct timeval* ts, const unsigned char* frame, int captureLength, int length)
+{
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	string filter_exp = "host ";
-	filter_exp += middlemanNodeIPAddress;
-	filter_exp += " and src port ";
-	filter_exp += buffer; // middlemanNodePort
+	double packetTime = ts->tv_sec + ts->tv_usec / 1000000.0;
 
-	// Compile and apply the filter
-	if (pcap_compile(handle, &fp, (char*)filter_exp.c_str(), 0, net) == -1)
+	PacketView p(frame, captureLength, length);
+
+	if(p.isValid())
 	{
-		fprintf(stderr, "[pcapThreadFunction] Couldn't parse filter %s: %s. Terminating process.\n", filter_exp.c_str(), pcap_geterr(handle));
-		exit(1);
+		int flow = flowTable->add(createFlowKey(p.getSourceAddress(), p.getSourcePort(), p.getDestinationAddress(), p.getDestinationPort()), BIN_SERIES_PCAP, packetTime, p.getPayloadLength());
+		if(flow != -1)
+		{
+			flowTable->getBinner(flow)->add(BIN_SERIES_CALLBACK, packetTime, getElapsedNanoseconds(&start));
+		}
 	}
+}
 
-	if (pcap_setfilter(handle, &fp) == -1)
+/* Adds the packets received and dropped since the previous call to the capture totals. Returns 0 on success and -1 on error. */
+int readCaptureStatistics()
+{
+	if(captureBackend == CAPTURE_BACKEND_RING)
 	{
-		fprintf(stderr, "[pcapThreadFunction] Couldn't install filter %s: %s. Terminating process.\n", filter_exp.c_str(), pcap_geterr(handle));
-		exit(1);
+		// The ring's counts start over at every read
+		unsigned int packets, drops;
+		if(packetRing.getStatistics(&packets, &drops) == -1)
+		{
+			return -1;
+		}
+
+		captureReceived += packets;
+		captureDropped += drops;
+
+		return 0;
 	}
 
-	// Start packet capture
-	pcap_loop(handle, -1, got_packet, NULL);
+	struct pcap_stat stats;
+	if(pcap_stats(handle, &stats) == -1)
+	{
+		fprintf(stderr, "[readCaptureStatistics] Couldn't read capture statistics: %s.\n", pcap_geterr(handle));
+		return -1;
+	}
 
-	// Close the session
-	pcap_freecode(&fp);
-	pcap_close(handle);
+	// Unsigned differences stay correct when the 32-bit counters wrap
+	captureReceived += stats.ps_recv - lastStatistics.ps_recv;
+	captureDropped += stats.ps_drop - lastStatistics.ps_drop;
+	captureIfDropped += stats.ps_ifdrop - lastStatistics.ps_ifdrop;
 
-	pthread_exit(NULL);
+	lastStatistics = stats;
+
+	return 0;
 }
 
-void got_packet(unsigned char* args, const struct pcap_pkthdr* header, const unsigned char* packet)
+/* Returns the milliseconds until the next statistics sample of any flow is due, at most CAPTURE_POLL_TIMEOUT. */
+int getStatisticsTimeout(double now)
 {
-	if((exitFlag == true) || ((duration != 0) && (secCounter >= duration)))
-	{
-		exitFlag = true;
+	int timeout = CAPTURE_POLL_TIMEOUT;
 
-		pcap_freecode(&fp);
-		pcap_close(handle);
+	for(int k = 0; k < probeCount + prebuildDepth; k++)
+	{
+		StatisticsSampler* sampler = &statisticsSamplers[k];
+		if(sampler->flow != -1)
+		{
+			double due = sampler->origin + (sampler->bin + 1) * measurementInterval;
+			int wait = (int)ceil((due - now) * 1000);
 
-		pthread_exit(NULL);
+			if(wait < timeout)
+			{
+				timeout = (wait > 0) ? wait : 0;
+			}
+		}
 	}
-	else
+
+	return timeout;
+}
+
+/*
+Once now has passed the end of a bin of a flow being measured, adds the packets
+received and dropped since that flow's previous sample to the bin that just
+ended. Every flow has its own bin grid, set when its worker starts measuring,
+so each probe slot is sampled on its own. Samples fall on the grid, not on
+packet arrivals, so a bin without packets still gets its drops; when the
+capture thread was late, the bins it missed are added to the last one. Only
+the capture thread calls it, so the capture handle is never used concurrently.
+*/
+void sampleCaptureStatistics(double now)
+{
+	bool read = false;
+
+	for(int k = 0; k < probeCount + prebuildDepth; k++)
 	{
-		Packet p(packet, header->len);
+		StatisticsSampler* sampler = &statisticsSamplers[k];
+		int flow = __atomic_load_n(&activeFlows[k], __ATOMIC_ACQUIRE);
+
+		// A flow's bins have no origin until its worker starts measuring
+		IntervalBinner* flowBinner = (flow != -1) ? flowTable->getBinner(flow) : NULL;
+		double origin = (flowBinner != NULL) ? flowBinner->getOrigin() : 0;
+		if(origin == 0)
+		{
+			sampler->flow = -1;
+			continue;
+		}
+
+		int64_t bin = (int64_t)floor((now - origin) / measurementInterval);
+		bool restart = (sampler->flow != flow) || (sampler->origin != origin);
+
+		if((restart == false) && (bin <= sampler->bin))
+		{
+			continue;
+		}
+
+		if(read == false)
+		{
+			if(readCaptureStatistics() == -1)
+			{
+				return;
+			}
+
+			read = true;
+		}
+
+		if(restart == true)
+		{
+			// The first sample counts from here
+			sampler->flow = flow;
+			sampler->origin = origin;
+			sampler->bin = (bin > 0) ? bin : 0;
+			sampler->received = captureReceived;
+			sampler->dropped = captureDropped;
+			sampler->ifDropped = captureIfDropped;
+			continue;
+		}
 
-		// fprintf(stdout, "Got packet, length: %d\n", p.getPayloadLength());
+		// The middle of the bin that ended, clear of rounding at its edges
+		double ts = origin + (bin - 0.5) * measurementInterval;
 
-		pthread_mutex_lock(&pcapMutex);
-		pcapBytesReceived += p.getPayloadLength();
-		pthread_mutex_unlock(&pcapMutex);
+		flowBinner->add(BIN_SERIES_RECEIVED, ts, captureReceived - sampler->received);
+		flowBinner->add(BIN_SERIES_DROPPED, ts, captureDropped - sampler->dropped);
+		flowBinner->add(BIN_SERIES_IFDROPPED, ts, captureIfDropped - sampler->ifDropped);
+
+		sampler->bin = bin;
+		sampler->received = captureReceived;
+		sampler->dropped = captureDropped;
+		sampler->ifDropped = captureIfDropped;
 	}
 }
 
-void* recvThreadFunction(void* arg)
+/* Returns the CLOCK_MONOTONIC nanoseconds since start. */
+uint64_t getElapsedNanoseconds(const struct timespec* start)
 {
-	setThreadAsyncCancel();
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-	char recvBuffer[MAX_BUFFER_SIZE];
-	int res;
+	return (uint64_t)(now.tv_sec - start->tv_sec) * 1000000000ULL + now.tv_nsec - start->tv_nsec;
+}
 
-	fprintf(stdout, "[recvThreadFunction] Starting data transfer.\n");
+/* Reads the worker's stream into the goodput bins while a measurement runs. */
+void* recvThreadFunction(void* arg)
+{
+	MeasurementWorker* worker = (MeasurementWorker*)arg;
+	Measurement* measurement = &worker->measurement;
 
-	while(exitFlag == false)
+	while(true)
 	{
-		if((duration != 0) && (secCounter >= duration))
+		pthread_mutex_lock(&worker->mutex);
+		while((worker->receiving == false) && (worker->state != WORKER_QUIT))
 		{
-			exitFlag = true;
-			break;
+			pthread_cond_wait(&worker->cond, &worker->mutex);
 		}
+		bool quit = (worker->receiving == false);
+		pthread_mutex_unlock(&worker->mutex);
 
-		res = recv(clientSocket, recvBuffer, MAX_BUFFER_SIZE, 0);
-		if(res == -1)
+		if(quit == true)
 		{
-			fprintf(stderr, "[recvThreadFunction] TCP recv failure. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", middlemanNodeName.c_str(), exitNodeName.c_str());
-			exitFlag = true;
 			break;
 		}
-		else
+
+		fprintf(stdout, "[recvThreadFunction] Starting data transfer.\n");
+
+		while(__atomic_load_n(&worker->stopFlag, __ATOMIC_ACQUIRE) == false)
 		{
-			pthread_mutex_lock(&tcpMutex);
-			tcpBytesReceived += res;
-			pthread_mutex_unlock(&tcpMutex);
+			int res = recv(worker->clientSocket, worker->recvBuffer, MAX_BUFFER_SIZE, 0);
+			if(res == -1)
+			{
+				if(__atomic_load_n(&worker->stopFlag, __ATOMIC_ACQUIRE) == false)
+				{
+					fprintf(stderr, "[recvThreadFunction] TCP recv failure. Skipping this circuit. [Middleman: %s] [Exit: %s]\n", measurement->middlemanName.c_str(), exitNodeName.c_str());
+				}
+				__atomic_store_n(&worker->stopFlag, true, __ATOMIC_RELEASE);
+				break;
+			}
+			else if(res == 0)
+			{
+				// The stream is over; the monitor reports the rest of the duration
+				break;
+			}
 
-			// data[res - 1] = '\0';
-			// fprintf(stdout, "%s", data);
+			measurement->binner->add(BIN_SERIES_TCP, getTime(), res);
 		}
-	}
 
-	fprintf(stdout, "[recvThreadFunction] Completed data transfer.\n");
+		fprintf(stdout, "[recvThreadFunction] Completed data transfer.\n");
 
-	pthread_exit(NULL);
+		pthread_mutex_lock(&worker->mutex);
+		worker->receiving = false;
+		pthread_cond_broadcast(&worker->cond);
+		pthread_mutex_unlock(&worker->mutex);
+	}
+
+	return NULL;
 }
 
 void signalHandler(int sig)
 {
-	if(torControlSocket != -1)
-	{
-		close(torControlSocket);
-	}
+	torControl.close();
 
 	if(clientSocket != -1)
 	{
@@ -1080,5 +2108,19 @@ void signalHandler(int sig)
 		fclose(tpgpFile);
 	}
 
+	if(traceWriter != NULL)
+	{
+		traceWriter->close();
+	}
+
 	exit(0);
 }
+
+/* Returns the wall clock time in seconds, the clock pcap timestamps use. */
+double getTime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
@@ -3,13 +3,34 @@
 
 #include <sys/types.h>
 #include <unistd.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
+#include <pthread.h>
 #include <pcap.h>
+#include "../myutil/TorControlClient.h"
+#include "../myutil/IntervalTimer.h"
+#include "../myutil/CorrelationAccumulator.h"
+#include "../myutil/RelayTable.h"
 
 using namespace std;
 
 #define MAX_BUFFER_SIZE 4096
 
+#define CAPTURE_BACKEND_PCAP	0
+#define CAPTURE_BACKEND_RING	1
+
+#define BIN_SERIES_PCAP			0
+#define BIN_SERIES_TCP			1
+#define BIN_SERIES_RECEIVED		2	// packets the capture saw, dropped ones included
+#define BIN_SERIES_DROPPED		3	// packets the kernel dropped for lack of buffer space
+#define BIN_SERIES_IFDROPPED	4	// packets the interface dropped
+#define BIN_SERIES_CALLBACK		5	// nanoseconds spent in the capture callbacks
+#define BIN_SERIES_COUNT		6
+
+#define BIN_LAG				0.2	// in seconds, how long an interval stays open for late timestamps
+#define MONITOR_MIN_PERIOD	0.1	// in seconds
+
 #define SOCKS_SERVER_IP_ADDRESS "127.0.0.1"
 #define SOCKS_SERVER_PORT 9050
 
@@ -17,18 +38,148 @@ using namespace std;
 #define TOR_CONTROL_PORT 9051
 
 #define CIRCUIT_CREATION_COUNT 1
-#define CIRCUIT_SETUP_DELAY 10 // in seconds
+#define CIRCUIT_BUILD_TIMEOUT 60 // in seconds, for the circuit to report BUILT
+
+#define FLOW_TABLE_SIZE 16 // middleman flows followed at once by the capture
+#define CAPTURE_FILTER_IDLE "tcp and src port 0" // while no flow is registered; passes nothing
+
+#define MAX_CONCURRENT_PROBES	FLOW_TABLE_SIZE
+#define MAX_PREBUILD_DEPTH		16		// circuits built ahead of the measurements
+#define MAX_PROBE_SLOTS			(MAX_CONCURRENT_PROBES + MAX_PREBUILD_DEPTH)
+#define PROBE_POLL_TIMEOUT		100		// in milliseconds, longest wait for a Tor event when no probe has anything to do
+#define CAPTURE_POLL_TIMEOUT	100		// in milliseconds, longest wait of the capture thread for packets
+
+#define PROBE_FREE		0
+#define PROBE_SETUP		1	// circuit extended, waiting for it to be built and for a measurement slot
+#define PROBE_MEASURING	2	// stream attached, worker measuring
+
+#define CIRCUIT_STATUS_LAUNCHED	0
+#define CIRCUIT_STATUS_BUILT	1
+#define CIRCUIT_STATUS_FAILED	2	// FAILED or CLOSED before it was built
+#define CIRCUIT_STATUS_CLOSED	3	// closed after it was built, before it was used
+
+#define WORKER_IDLE			0
+#define WORKER_MEASURING	1
+#define WORKER_DONE			2	// measurement over, waiting for runProbes() to collect it
+#define WORKER_QUIT			3
+
+class IntervalBinner;
+class TraceFileWriter;
 
+// One middleman in flight
+struct Probe
+{
+	int state;
+	int slot;
+	unsigned int index;		// position in the relay table, from 1
+	string name;
+	string ipAddress;
+	unsigned short int port;
+	string fingerprint;
+	uint32_t flags;			// RELAY_FLAG_*
+	int circuitId;
+	int circuitStatus;		// from the CIRC events of circuitId
+	double buildDeadline;
+	int flow;
+	int worker;				// measuring it
+};
+
+// Reported intervals and averages of one middleman
+struct Measurement
+{
+	string middlemanName;
+	string middlemanFingerprint;
+	IntervalBinner* binner;
+	TraceFileWriter* traceWriter;
+	double secCounter;
+	int mCount;
+	double tpCumulative;
+	double gpCumulative;
+	CorrelationAccumulator referenceCorrelation;
+};
+
+// Capture statistics of one probe slot, sampled by the capture thread at the end of each bin of its flow
+struct StatisticsSampler
+{
+	int flow;				// -1 when the slot has no flow being measured
+	double origin;			// of the flow's bins
+	int64_t bin;			// the bin in which the previous sample was taken
+	uint64_t received;		// capture totals at the previous sample
+	uint64_t dropped;
+	uint64_t ifDropped;
+};
+
+// One relay of a replay
+struct ReplayFlow
+{
+	bool started;			// a packet of the relay was read
+	bool done;				// its duration is reported
+	double lastTime;		// of its latest packet
+	Measurement measurement;
+};
+
+// Monitor and recv threads of one measurement slot, kept from middleman to middleman
+struct MeasurementWorker
+{
+	int state;
+	bool receiving;			// the recv thread is reading clientSocket
+	bool stopFlag;			// ends the transfer
+	int clientSocket;
+	int flow;
+	pthread_t monitorThread;
+	pthread_t recvThread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;	// signals state and receiving changes
+	IntervalTimer timer;
+	char recvBuffer[MAX_BUFFER_SIZE];
+	Measurement measurement;
+};
+
+void setProbeRelay(Probe* probe, const RelayEntry& relay);
+void selectProbe(const Probe* probe);
+void runProbes(const RelayTable& relays);
+int startProbe(Probe* probe, unsigned int index, const RelayEntry& relay);
+int startMeasurement(Probe* probe);
+void abandonProbe(Probe* probe, const char* reason);
+void finishProbe(Probe* probe);
+void updateCaptureFilter();
+
+void closeAllTorCircuits();
 int createTorCircuit();
 int verifyTorCircuit();
-int sendTorCommand(int torControlSocket, const string& command, char* recvBuffer);
-void measureTPandGP();
+int sendTorCommand(const string& command, TorControlReply* reply);
+int queueTorCommand(const string& command);
+void handleTorEvent(void* arg, const TorControlReply* reply);
+void handleCircuitEvent(int id, int state);
+int attachStream(const Probe* probe);
+void startWorkers();
+void stopWorkers();
+bool collectWorker(MeasurementWorker* worker);
+void* monitorThreadFunction(void* arg);
+void measureTPandGP(MeasurementWorker* worker);
+void stopTransfer(MeasurementWorker* worker);
+void resetMeasurement(Measurement* measurement);
+void reportInterval(Measurement* measurement, int64_t index, const uint64_t* bytes);
+void reportSummary(Measurement* measurement);
+
+void replayTPandGP(const RelayTable& relays);
+void replay_packet(unsigned char* args, const struct pcap_pkthdr* header, const unsigned char* packet);
 
 void* pcapThreadFunction(void* arg);
+int compileCaptureFilter(bpf_u_int32 net, struct bpf_program* program);
+void confirmCaptureFilter(int generation);
+void installCaptureFilter(bpf_u_int32 net);
 void got_packet(unsigned char* args, const struct pcap_pkthdr* header, const unsigned char* packet);
+void got_frame(void* arg, const struct timeval* ts, const unsigned char* frame, int captureLength, int length);
+int readCaptureStatistics();
+int getStatisticsTimeout(double now);
+void sampleCaptureStatistics(double now);
+uint64_t getElapsedNanoseconds(const struct timespec* start);
 
 void* recvThreadFunction(void* arg);
 
 void signalHandler(int sig);
 
+double getTime();
+
 #endif /* TOR_NODE_THROUGHPUT_CALC_H_ */
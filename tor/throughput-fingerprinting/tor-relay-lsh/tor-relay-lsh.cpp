@@ -0,0 +1,162 @@
+//============================================================================
+// Name        : tor-relay-lsh.cpp
+// Author      :
+// Version     :
+// Copyright   :
+// Description : Builds and queries an LSH index of relay throughput windows
+//============================================================================
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+#include "../myutil/trace.h"
+#include "../myutil/LSHIndex.h"
+#include "tor-relay-lsh.h"
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+	if((argc >= 4) && (strcmp(argv[1], "build") == 0))
+	{
+		return buildIndex(argc, argv);
+	}
+
+	if((argc >= 5) && (strcmp(argv[1], "query") == 0))
+	{
+		return queryIndex(argc, argv);
+	}
+
+	fprintf(stderr, "USAGE: %s build <relay trace file> <index file> [window length (> 1)] [window stride (> 0)] [bits per table (1-%d)] [table count (> 0)]\n", argv[0], LSH_MAX_BITS_PER_TABLE);
+	fprintf(stderr, "       %s query [-m] <index file> <client trace file> <top K (> 0)>\n", argv[0]);
+	exit(1);
+}
+
+int buildIndex(int argc, char** argv)
+{
+	int windowLength = LSH_DEFAULT_WINDOW_LENGTH;
+	int windowStride = LSH_DEFAULT_WINDOW_STRIDE;
+	int bitsPerTable = LSH_DEFAULT_BITS_PER_TABLE;
+	int tableCount = LSH_DEFAULT_TABLE_COUNT;
+
+	if(argc > 4)
+	{
+		windowLength = atoi(argv[4]);
+	}
+	if(argc > 5)
+	{
+		windowStride = atoi(argv[5]);
+	}
+	if(argc > 6)
+	{
+		bitsPerTable = atoi(argv[6]);
+	}
+	if(argc > 7)
+	{
+		tableCount = atoi(argv[7]);
+	}
+
+	double t = getTime();
+
+	LSHIndex index;
+	int entryCount = index.build(argv[2], windowLength, windowStride, bitsPerTable, tableCount, LSH_DEFAULT_SEED);
+	if(entryCount == -1)
+	{
+		fprintf(stderr, "[TOR-RELAY-LSH] Cannot build index from relay trace file %s. Terminating process.\n", argv[2]);
+		exit(1);
+	}
+
+	if(index.save(argv[3]) == -1)
+	{
+		fprintf(stderr, "[TOR-RELAY-LSH] Cannot write index file %s. Terminating process.\n", argv[3]);
+		exit(1);
+	}
+
+	fprintf(stdout, "[TOR-RELAY-LSH] Indexed %d windows of %d relays in %f seconds.\n", entryCount, index.getRelayCount(), getTime() - t);
+
+	return EXIT_SUCCESS;
+}
+
+int queryIndex(int argc, char** argv)
+{
+	bool multiProbe = false;
+	int a = 2;
+
+	if(strcmp(argv[a], "-m") == 0)
+	{
+		multiProbe = true;
+		a++;
+	}
+
+	if(argc < a + 3)
+	{
+		fprintf(stderr, "[TOR-RELAY-LSH] Missing query arguments. Terminating process.\n");
+		exit(1);
+	}
+
+	int k = atoi(argv[a + 2]);
+	if(k <= 0)
+	{
+		fprintf(stderr, "[TOR-RELAY-LSH] Invalid top K. Must be > 0. Terminating process.\n");
+		exit(1);
+	}
+
+	double t = getTime();
+
+	LSHIndex index;
+	if(index.open(argv[a]) == -1)
+	{
+		fprintf(stderr, "[TOR-RELAY-LSH] Cannot open index file %s. Terminating process.\n", argv[a]);
+		exit(1);
+	}
+
+	fprintf(stdout, "[TOR-RELAY-LSH] Opened index of %d windows of %d relays in %f seconds.\n", index.getEntryCount(), index.getRelayCount(), getTime() - t);
+
+	vector<TraceSample> vClientTrace;
+	if(readTraceFile(argv[a + 1], vClientTrace) <= 0)
+	{
+		fprintf(stderr, "[TOR-RELAY-LSH] Cannot read client trace file %s. Terminating process.\n", argv[a + 1]);
+		exit(1);
+	}
+
+	vector<double> values(vClientTrace.size());
+	for(unsigned int i = 0; i < vClientTrace.size(); i++)
+	{
+		values[i] = vClientTrace[i].throughput;
+	}
+
+	vector<LSHMatch> matches;
+
+	t = getTime();
+	int scored = index.query(&values[0], values.size(), k, multiProbe, matches);
+	t = getTime() - t;
+
+	if(scored == -1)
+	{
+		fprintf(stderr, "[TOR-RELAY-LSH] Query failed. Terminating process.\n");
+		exit(1);
+	}
+
+	fprintf(stdout, "[TOR-RELAY-LSH] Query took %f seconds; re-scored %d of %d windows.\n", t, scored, index.getEntryCount());
+
+	for(unsigned int i = 0; i < matches.size(); i++)
+	{
+		fprintf(stdout, "Rank %u Middleman %s MiddlemanFP %s Offset %d Correlation %f\n", i + 1, index.getName(matches[i].relay).c_str(), index.getFingerprint(matches[i].relay).c_str(), matches[i].offset, matches[i].correlation);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* Returns the wall clock time in seconds. */
+double getTime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
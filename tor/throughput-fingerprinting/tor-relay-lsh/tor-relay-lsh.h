@@ -0,0 +1,15 @@
+#ifndef TOR_RELAY_LSH_H_
+#define TOR_RELAY_LSH_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#define MAX_BUFFER_SIZE 4096
+
+#define LSH_DEFAULT_SEED 1
+
+int buildIndex(int argc, char** argv);
+int queryIndex(int argc, char** argv);
+double getTime();
+
+#endif /* TOR_RELAY_LSH_H_ */
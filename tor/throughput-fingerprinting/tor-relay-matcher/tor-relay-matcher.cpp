@@ -0,0 +1,146 @@
+//============================================================================
+// Name        : tor-relay-matcher.cpp
+// Author      :
+// Version     :
+// Copyright   :
+// Description : Ranks measured relays by how well their throughput matches a client trace
+//============================================================================
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+#include "../myutil/trace.h"
+#include "../myutil/RelayIndex.h"
+#include "tor-relay-matcher.h"
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+	int dtwWindow = -1; // -1 ranks by correlation
+	int opt;
+
+	while((opt = getopt(argc, argv, "d:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'd':
+			dtwWindow = atoi(optarg);
+			if(dtwWindow < 0)
+			{
+				fprintf(stderr, "[TOR-RELAY-MATCHER] Invalid DTW window. Must be >= 0. Terminating process.\n");
+				exit(1);
+			}
+			break;
+		default:
+			exit(1);
+		}
+	}
+
+	// positional arguments start at argv[1] from here on
+	argv[optind - 1] = argv[0];
+	argc -= optind - 1;
+	argv += optind - 1;
+
+	if(argc < 4)
+	{
+		fprintf(stderr, "USAGE: %s [-d <DTW window (>= 0) (in samples)>] <relay trace file> <client trace file> <top K (> 0)> [series length (> 2)] [PAA segment count (> 0)]\n", argv[0]);
+		exit(1);
+	}
+
+	int k = atoi(argv[3]);
+	if(k <= 0)
+	{
+		fprintf(stderr, "[TOR-RELAY-MATCHER] Invalid top K. Must be > 0. Terminating process.\n");
+		exit(1);
+	}
+
+	vector<TraceSample> vClientTrace;
+	if(readTraceFile(argv[2], vClientTrace) <= 0)
+	{
+		fprintf(stderr, "[TOR-RELAY-MATCHER] Cannot read client trace file %s. Terminating process.\n", argv[2]);
+		exit(1);
+	}
+
+	int seriesLength = vClientTrace.size();
+	if(argc > 4)
+	{
+		seriesLength = atoi(argv[4]);
+		if((seriesLength <= 2) || (seriesLength > (int)vClientTrace.size()))
+		{
+			fprintf(stderr, "[TOR-RELAY-MATCHER] Invalid series length. Must be > 2 and <= %u. Terminating process.\n", (unsigned int)vClientTrace.size());
+			exit(1);
+		}
+	}
+
+	int segmentCount = RELAY_INDEX_DEFAULT_SEGMENT_COUNT;
+	if(argc > 5)
+	{
+		segmentCount = atoi(argv[5]);
+		if(segmentCount <= 0)
+		{
+			fprintf(stderr, "[TOR-RELAY-MATCHER] Invalid PAA segment count. Must be > 0. Terminating process.\n");
+			exit(1);
+		}
+	}
+
+	double t = getTime();
+
+	RelayIndex index(seriesLength, segmentCount);
+	if(index.load(argv[1]) == -1)
+	{
+		fprintf(stderr, "[TOR-RELAY-MATCHER] Cannot read relay trace file %s. Terminating process.\n", argv[1]);
+		exit(1);
+	}
+
+	fprintf(stdout, "[TOR-RELAY-MATCHER] Indexed %d relays with at least %d samples in %f seconds.\n", index.getRelayCount(), seriesLength, getTime() - t);
+
+	vector<double> values(seriesLength);
+	for(int i = 0; i < seriesLength; i++)
+	{
+		values[i] = vClientTrace[i].throughput;
+	}
+
+	vector<RelayMatch> matches;
+
+	t = getTime();
+	int scored;
+	if(dtwWindow >= 0)
+	{
+		scored = index.queryDTW(&values[0], seriesLength, k, dtwWindow, matches);
+	}
+	else
+	{
+		scored = index.query(&values[0], seriesLength, k, matches);
+	}
+	t = getTime() - t;
+
+	if(scored == -1)
+	{
+		fprintf(stderr, "[TOR-RELAY-MATCHER] Query failed. Terminating process.\n");
+		exit(1);
+	}
+
+	fprintf(stdout, "[TOR-RELAY-MATCHER] Query took %f seconds; computed %d of %d exact %s.\n", t, scored, index.getRelayCount(), (dtwWindow >= 0) ? "DTW distances" : "correlations");
+
+	for(unsigned int i = 0; i < matches.size(); i++)
+	{
+		fprintf(stdout, "Rank %u Middleman %s MiddlemanFP %s Correlation %f Distance %f\n", i + 1, index.getName(matches[i].relay).c_str(), index.getFingerprint(matches[i].relay).c_str(), matches[i].correlation, matches[i].distance);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* Returns the wall clock time in seconds. */
+double getTime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
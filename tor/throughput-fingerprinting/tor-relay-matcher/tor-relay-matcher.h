@@ -0,0 +1,11 @@
+#ifndef TOR_RELAY_MATCHER_H_
+#define TOR_RELAY_MATCHER_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#define MAX_BUFFER_SIZE 4096
+
+double getTime();
+
+#endif /* TOR_RELAY_MATCHER_H_ */
@@ -0,0 +1,84 @@
+//============================================================================
+// Name        : tor-trace-convert.cpp
+// Author      :
+// Version     :
+// Copyright   :
+// Description : Converts a binary throughput trace file to the text format
+//============================================================================
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../myutil/TraceFile.h"
+#include "tor-trace-convert.h"
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		fprintf(stderr, "USAGE: %s <binary trace file> [text output file]\n", argv[0]);
+		exit(1);
+	}
+
+	TraceFile traceFile;
+	if(traceFile.open(argv[1]) == -1)
+	{
+		fprintf(stderr, "[TOR-TRACE-CONVERT] Cannot read trace file %s. Terminating process.\n", argv[1]);
+		exit(1);
+	}
+
+	FILE* outFile = stdout;
+	if(argc > 2)
+	{
+		outFile = fopen(argv[2], "w");
+		if(outFile == NULL)
+		{
+			fprintf(stderr, "[TOR-TRACE-CONVERT] Cannot open file %s for output. Terminating process.\n", argv[2]);
+			exit(1);
+		}
+	}
+
+	for(int i = 0; i < traceFile.getTraceCount(); i++)
+	{
+		const TraceFileHeader* header = traceFile.getHeader(i);
+
+		writeTextTrace(outFile, header->middleman, header->exit, header->fingerprint, traceFile.getTimes(i), traceFile.getThroughputs(i), traceFile.getGoodputs(i), header->sampleCount);
+	}
+
+	if((fflush(outFile) != 0) || (ferror(outFile) != 0))
+	{
+		fprintf(stderr, "[TOR-TRACE-CONVERT] Error in writing output. Terminating process.\n");
+		exit(1);
+	}
+
+	if(outFile != stdout)
+	{
+		fclose(outFile);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/*
+Writes one trace in the text format of the tool that measured it: the
+tor-node-throughput-calc line when the trace names a middleman, the
+tor-app-client line otherwise.
+*/
+void writeTextTrace(FILE* outFile, const char* middleman, const char* exit, const char* fingerprint, const double* times, const double* throughputs, const double* goodputs, int sampleCount)
+{
+	for(int i = 0; i < sampleCount; i++)
+	{
+		if(middleman[0] != '\0')
+		{
+			fprintf(outFile, "Middleman %s Exit %s Time %f Throughput(KBps) %f Goodput(KBps) %f MiddlemanFP %s\n", middleman, exit, times[i], throughputs[i], goodputs[i], fingerprint);
+		}
+		else
+		{
+			fprintf(outFile, "Time %f Throughput(KBps) %f Goodput(KBps) %f\n", times[i], throughputs[i], goodputs[i]);
+		}
+	}
+}
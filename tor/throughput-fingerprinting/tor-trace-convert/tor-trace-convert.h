@@ -0,0 +1,10 @@
+#ifndef TOR_TRACE_CONVERT_H_
+#define TOR_TRACE_CONVERT_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdio>
+
+void writeTextTrace(FILE* outFile, const char* middleman, const char* exit, const char* fingerprint, const double* times, const double* throughputs, const double* goodputs, int sampleCount);
+
+#endif /* TOR_TRACE_CONVERT_H_ */